@@ -0,0 +1,845 @@
+/*
+churnsim.c - long session workload simulator for the_entitytainer.h
+
+Drives a random mix of adds, removes, reparents and reserves against an entitytainer, the way a game spawns and
+despawns things for hours, and checks every change against a plain reference model (a parent and a child count per
+entity). Each window of operations it prints the p50/p99/p999 latency of every kind of operation, and how full and
+scattered each bucket list is:
+
+* used: buckets in use out of the list's total.
+* span: one past the highest bucket in use, the part of the list that's actually touched.
+* frag: the share of the span that's free, i.e. holes left behind by removals.
+* free list: its length, the mean distance in buckets between consecutive free buckets, and how many of those steps
+  land on another 4 KiB page. Buckets are handed out in free list order, so a scattered free list means scattered
+  allocations. With -lowest there's no free list to report.
+
+Usage:
+
+    churnsim [-ops N] [-window N] [-check N] [-seed N] [-entities N] [-hubs N]
+             [-mix add,remove,reparent,reserve] [-tiers size:count,size:count,...] [-holes] [-keep] [-lowest]
+             [-interleaved]
+
+Build it with optimizations for meaningful numbers, e.g. gcc -std=c99 -O2 churnsim.c -o churnsim
+
+Operations that would need a bucket from a full list are skipped (and counted), the simulator is about how the
+container behaves, not about running it out of memory.
+
+*/
+
+#if !defined( _WIN32 ) && !defined( _POSIX_C_SOURCE )
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#pragma warning( disable : 4710 ) // printf not inlined - I don't care. :)
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static void churnsim_assert( bool condition, const char* text, int line );
+
+#define ENTITYTAINER_IMPLEMENTATION
+#define ENTITYTAINER_assert( condition, ... ) churnsim_assert( condition, #condition, __LINE__ )
+
+#pragma warning( disable : 4464 ) // Include with ".."
+#include "../../the_entitytainer.h"
+#pragma warning( disable : 5045 ) // warning C5045: Compiler will insert Spectre mitigation for memory load if /Qspectre
+                                  // switch specified
+
+#define SIM_AddEntity 0
+#define SIM_AddChild 1
+#define SIM_RemoveChild 2
+#define SIM_RemoveEntity 3
+#define SIM_Reparent 4
+#define SIM_Reserve 5
+#define SIM_NumOps 6
+
+#define SIM_MixAdd 0
+#define SIM_MixRemove 1
+#define SIM_MixReparent 2
+#define SIM_MixReserve 3
+#define SIM_NumMix 4
+
+// Latencies are kept in a log-linear histogram: exact below 64 ns, then 32 bins per power of 2, so within about 3%.
+#define SIM_HistogramLinear 64
+#define SIM_HistogramSubBins 32
+#define SIM_HistogramBins ( SIM_HistogramLinear + SIM_HistogramSubBins * 40 )
+
+#define SIM_PageSize 4096
+
+static const char* g_op_names[SIM_NumOps] = {
+    "add_entity", "add_child", "remove_child", "remove_entity", "reparent", "reserve",
+};
+
+typedef struct {
+    unsigned long long counts[SIM_HistogramBins];
+    unsigned long long total;
+    unsigned long long max;
+} SimHistogram;
+
+typedef struct {
+    long long          ops;
+    long long          window;
+    long long          check_interval;
+    unsigned long long seed;
+    int                num_entities;
+    int                num_hubs;
+    int                mix[SIM_NumMix];
+    int                bucket_sizes[ENTITYTAINER_MAX_BUCKET_LISTS];
+    int                bucket_list_sizes[ENTITYTAINER_MAX_BUCKET_LISTS];
+    int                num_bucket_lists;
+    bool               remove_with_holes;
+    bool               keep_capacity_on_remove;
+    bool               lowest_free_bucket;
+    bool               interleaved_lookups;
+} SimOptions;
+
+// The reference model, and the live and parented entities as arrays so a random one can be picked in O(1).
+typedef struct {
+    TheEntitytainer*       entitytainer;
+    const SimOptions*      options;
+    unsigned long long     rng;
+    int                    max_live;
+    TheEntitytainerEntity* parent;
+    int*                   num_children;
+    TheEntitytainerEntity* live;
+    int*                   live_index; // Into live, or -1
+    int                    num_live;
+    TheEntitytainerEntity* linked;
+    int*                   linked_index; // Into linked, or -1
+    int                    num_linked;
+    long long              skipped;
+    SimHistogram           window[SIM_NumOps];
+    SimHistogram           total[SIM_NumOps];
+} Sim;
+
+static void
+churnsim_assert( bool condition, const char* text, int line ) {
+    if ( !condition ) {
+        printf( "Entitytainer assert failed at the_entitytainer.h:%d: %s\n", line, text );
+        exit( 1 );
+    }
+}
+
+static unsigned long long
+sim_now_ns( void ) {
+#if defined( _WIN32 )
+    static LARGE_INTEGER frequency;
+    if ( frequency.QuadPart == 0 ) {
+        QueryPerformanceFrequency( &frequency );
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter( &counter );
+    return (unsigned long long)( (double)counter.QuadPart * 1000000000.0 / (double)frequency.QuadPart );
+#else
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (unsigned long long)now.tv_sec * 1000000000ull + (unsigned long long)now.tv_nsec;
+#endif
+}
+
+// xorshift64*
+static unsigned
+sim_random( Sim* sim ) {
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return (unsigned)( ( sim->rng * 2685821657736338717ull ) >> 32 );
+}
+
+static int
+sim_random_below( Sim* sim, int n ) {
+    return (int)( sim_random( sim ) % (unsigned)n );
+}
+
+static int
+sim_histogram_bin( unsigned long long ns ) {
+    if ( ns < SIM_HistogramLinear ) {
+        return (int)ns;
+    }
+
+    int exponent = 6;
+    while ( ( ns >> ( exponent + 1 ) ) != 0 ) {
+        ++exponent;
+    }
+
+    int bin = SIM_HistogramLinear + ( exponent - 6 ) * SIM_HistogramSubBins +
+              (int)( ( ns >> ( exponent - 5 ) ) & ( SIM_HistogramSubBins - 1 ) );
+    return bin < SIM_HistogramBins ? bin : SIM_HistogramBins - 1;
+}
+
+// The lowest latency that falls in the bin.
+static unsigned long long
+sim_histogram_value( int bin ) {
+    if ( bin < SIM_HistogramLinear ) {
+        return (unsigned long long)bin;
+    }
+
+    int exponent = 6 + ( bin - SIM_HistogramLinear ) / SIM_HistogramSubBins;
+    int sub_bin  = ( bin - SIM_HistogramLinear ) % SIM_HistogramSubBins;
+    return (unsigned long long)( SIM_HistogramSubBins + sub_bin ) << ( exponent - 5 );
+}
+
+static unsigned long long
+sim_histogram_percentile( const SimHistogram* histogram, double percentile ) {
+    unsigned long long target = (unsigned long long)( percentile * (double)histogram->total + 0.999999 );
+    unsigned long long seen   = 0;
+    for ( int bin = 0; bin < SIM_HistogramBins; ++bin ) {
+        seen += histogram->counts[bin];
+        if ( seen >= target && seen > 0 ) {
+            return sim_histogram_value( bin );
+        }
+    }
+
+    return histogram->max;
+}
+
+static void
+sim_record( Sim* sim, int op, unsigned long long start ) {
+    unsigned long long ns            = sim_now_ns() - start;
+    int                bin           = sim_histogram_bin( ns );
+    SimHistogram*      histograms[2] = { &sim->window[op], &sim->total[op] };
+    for ( int i = 0; i < 2; ++i ) {
+        ++histograms[i]->counts[bin];
+        ++histograms[i]->total;
+        if ( ns > histograms[i]->max ) {
+            histograms[i]->max = ns;
+        }
+    }
+}
+
+static void
+sim_set_add( TheEntitytainerEntity* set, int* index, int* count, TheEntitytainerEntity entity ) {
+    index[entity] = *count;
+    set[*count]   = entity;
+    ++*count;
+}
+
+static void
+sim_set_remove( TheEntitytainerEntity* set, int* index, int* count, TheEntitytainerEntity entity ) {
+    int                   i    = index[entity];
+    TheEntitytainerEntity last = set[*count - 1];
+    set[i]                     = last;
+    index[last]                = i;
+    index[entity]              = -1;
+    --*count;
+}
+
+static void
+sim_link( Sim* sim, TheEntitytainerEntity parent, TheEntitytainerEntity child ) {
+    sim->parent[child] = parent;
+    ++sim->num_children[parent];
+    sim_set_add( sim->linked, sim->linked_index, &sim->num_linked, child );
+}
+
+static void
+sim_unlink( Sim* sim, TheEntitytainerEntity child ) {
+    --sim->num_children[sim->parent[child]];
+    sim->parent[child] = ENTITYTAINER_InvalidEntity;
+    sim_set_remove( sim->linked, sim->linked_index, &sim->num_linked, child );
+}
+
+// The bucket list an added entity's children are in.
+static int
+sim_tier( Sim* sim, TheEntitytainerEntity entity ) {
+    TheEntitytainerEntity* children;
+    int                    num_children;
+    int                    capacity;
+    entitytainer_get_children( sim->entitytainer, entity, &children, &num_children, &capacity );
+    for ( int i = 0; i < sim->entitytainer->num_bucket_lists; ++i ) {
+        if ( sim->entitytainer->bucket_lists[i].bucket_size == capacity + 1 ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Keeps a spare bucket, as a reparent can take one from the same list both for growing the new parent and for
+// shrinking the old one.
+static bool
+sim_has_room( Sim* sim, int bucket_list_index ) {
+    TheEntitytainerBucketList* list = &sim->entitytainer->bucket_lists[bucket_list_index];
+    return list->total_buckets - list->used_buckets >= 2;
+}
+
+static bool
+sim_can_grow( Sim* sim, TheEntitytainerEntity parent ) {
+    int tier = sim_tier( sim, parent );
+    if ( sim->num_children[parent] + 2 <= sim->entitytainer->bucket_lists[tier].bucket_size ) {
+        return true;
+    }
+
+    return tier + 1 < sim->entitytainer->num_bucket_lists && sim_has_room( sim, tier + 1 );
+}
+
+// A removal can shrink the parent to any smaller bucket list (in holes mode it depends on the last used slot).
+static bool
+sim_can_shrink( Sim* sim, TheEntitytainerEntity parent ) {
+    if ( sim->options->keep_capacity_on_remove ) {
+        return true;
+    }
+
+    int tier = sim_tier( sim, parent );
+    for ( int i = 0; i < tier; ++i ) {
+        if ( !sim_has_room( sim, i ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Some parents (hubs, like a level root or a crowded room) get a big share of the children, which is what ends up in
+// the largest buckets and makes removals move a lot of children.
+static TheEntitytainerEntity
+sim_pick_parent( Sim* sim ) {
+    if ( sim->options->num_hubs > 0 && sim_random_below( sim, 2 ) == 0 ) {
+        TheEntitytainerEntity hub = (TheEntitytainerEntity)( 1 + sim_random_below( sim, sim->options->num_hubs ) );
+        if ( sim->live_index[hub] >= 0 ) {
+            return hub;
+        }
+    }
+
+    return sim->live[sim_random_below( sim, sim->num_live )];
+}
+
+static void
+sim_remove_child( Sim* sim, TheEntitytainerEntity child ) {
+    TheEntitytainerEntity parent = sim->parent[child];
+    unsigned long long    start  = sim_now_ns();
+    if ( sim->options->remove_with_holes ) {
+        entitytainer_remove_child_with_holes( sim->entitytainer, parent, child );
+    }
+    else {
+        entitytainer_remove_child_no_holes( sim->entitytainer, parent, child );
+    }
+
+    sim_record( sim, SIM_RemoveChild, start );
+    sim_unlink( sim, child );
+}
+
+static void
+sim_add( Sim* sim ) {
+    bool add_entity =
+      sim->num_live < 2 || ( sim->num_live < sim->max_live && sim_random_below( sim, sim->max_live ) >= sim->num_live );
+    if ( add_entity ) {
+        TheEntitytainerEntity entity = ENTITYTAINER_InvalidEntity;
+        for ( int i_try = 0; i_try < 16 && entity == ENTITYTAINER_InvalidEntity; ++i_try ) {
+            TheEntitytainerEntity candidate =
+              (TheEntitytainerEntity)( 1 + sim_random_below( sim, sim->options->num_entities - 1 ) );
+            if ( sim->live_index[candidate] < 0 ) {
+                entity = candidate;
+            }
+        }
+
+        if ( entity == ENTITYTAINER_InvalidEntity || !sim_has_room( sim, 0 ) ) {
+            ++sim->skipped;
+            return;
+        }
+
+        unsigned long long start = sim_now_ns();
+        entitytainer_add_entity( sim->entitytainer, entity );
+        sim_record( sim, SIM_AddEntity, start );
+        sim_set_add( sim->live, sim->live_index, &sim->num_live, entity );
+        return;
+    }
+
+    TheEntitytainerEntity parent = sim_pick_parent( sim );
+    TheEntitytainerEntity child  = ENTITYTAINER_InvalidEntity;
+    for ( int i_try = 0; i_try < 8 && child == ENTITYTAINER_InvalidEntity; ++i_try ) {
+        TheEntitytainerEntity candidate = sim->live[sim_random_below( sim, sim->num_live )];
+        if ( candidate != parent && sim->parent[candidate] == ENTITYTAINER_InvalidEntity ) {
+            child = candidate;
+        }
+    }
+
+    if ( child == ENTITYTAINER_InvalidEntity || !sim_can_grow( sim, parent ) ) {
+        ++sim->skipped;
+        return;
+    }
+
+    unsigned long long start = sim_now_ns();
+    entitytainer_add_child( sim->entitytainer, parent, child );
+    sim_record( sim, SIM_AddChild, start );
+    sim_link( sim, parent, child );
+}
+
+static void
+sim_remove( Sim* sim ) {
+    if ( sim->num_linked > 0 && sim_random_below( sim, 2 ) == 0 ) {
+        TheEntitytainerEntity child = sim->linked[sim_random_below( sim, sim->num_linked )];
+        if ( !sim_can_shrink( sim, sim->parent[child] ) ) {
+            ++sim->skipped;
+            return;
+        }
+
+        sim_remove_child( sim, child );
+        return;
+    }
+
+    if ( sim->num_live == 0 ) {
+        ++sim->skipped;
+        return;
+    }
+
+    // Despawning an entity takes its children off it first, then the entity itself, which also takes it off its
+    // parent.
+    TheEntitytainerEntity entity = sim->live[sim_random_below( sim, sim->num_live )];
+    TheEntitytainerEntity parent = sim->parent[entity];
+    if ( !sim_can_shrink( sim, entity ) ||
+         ( parent != ENTITYTAINER_InvalidEntity && !sim_can_shrink( sim, parent ) ) ) {
+        ++sim->skipped;
+        return;
+    }
+
+    while ( sim->num_children[entity] > 0 ) {
+        TheEntitytainerEntity* children;
+        int                    num_children;
+        int                    capacity;
+        entitytainer_get_children( sim->entitytainer, entity, &children, &num_children, &capacity );
+        int i_child = 0;
+        while ( children[i_child] == ENTITYTAINER_InvalidEntity ) {
+            ++i_child;
+        }
+
+        sim_remove_child( sim, children[i_child] );
+    }
+
+    unsigned long long start = sim_now_ns();
+    entitytainer_remove_entity( sim->entitytainer, entity );
+    sim_record( sim, SIM_RemoveEntity, start );
+    if ( parent != ENTITYTAINER_InvalidEntity ) {
+        sim_unlink( sim, entity );
+    }
+
+    sim_set_remove( sim->live, sim->live_index, &sim->num_live, entity );
+}
+
+static void
+sim_reparent( Sim* sim ) {
+    if ( sim->num_live < 2 ) {
+        ++sim->skipped;
+        return;
+    }
+
+    TheEntitytainerEntity child      = sim->live[sim_random_below( sim, sim->num_live )];
+    TheEntitytainerEntity old_parent = sim->parent[child];
+    TheEntitytainerEntity new_parent = sim_pick_parent( sim );
+    if ( new_parent == child || new_parent == old_parent || !sim_can_grow( sim, new_parent ) ||
+         ( old_parent != ENTITYTAINER_InvalidEntity && !sim_can_shrink( sim, old_parent ) ) ) {
+        ++sim->skipped;
+        return;
+    }
+
+    unsigned long long start = sim_now_ns();
+    entitytainer_reparent( sim->entitytainer, child, new_parent );
+    sim_record( sim, SIM_Reparent, start );
+    if ( old_parent != ENTITYTAINER_InvalidEntity ) {
+        sim_unlink( sim, child );
+    }
+
+    sim_link( sim, new_parent, child );
+}
+
+static void
+sim_reserve( Sim* sim ) {
+    if ( sim->num_live == 0 ) {
+        ++sim->skipped;
+        return;
+    }
+
+    TheEntitytainer*      entitytainer = sim->entitytainer;
+    TheEntitytainerEntity parent       = sim->live[sim_random_below( sim, sim->num_live )];
+    int                   largest      = entitytainer->bucket_lists[entitytainer->num_bucket_lists - 1].bucket_size;
+    int                   capacity     = sim->num_children[parent] + 1 + sim_random_below( sim, 16 );
+    if ( capacity > largest - 1 ) {
+        capacity = largest - 1;
+    }
+
+    int tier = 0;
+    while ( entitytainer->bucket_lists[tier].bucket_size <= capacity ) {
+        ++tier;
+    }
+
+    if ( tier > sim_tier( sim, parent ) && !sim_has_room( sim, tier ) ) {
+        ++sim->skipped;
+        return;
+    }
+
+    unsigned long long start = sim_now_ns();
+    entitytainer_reserve( entitytainer, parent, capacity );
+    sim_record( sim, SIM_Reserve, start );
+}
+
+// Compares the entitytainer with the reference model, and has it validate itself.
+static bool
+sim_check( Sim* sim, void* scratch, int scratch_size ) {
+    TheEntitytainer* entitytainer = sim->entitytainer;
+    for ( int i_entity = 1; i_entity < sim->options->num_entities; ++i_entity ) {
+        TheEntitytainerEntity entity = (TheEntitytainerEntity)i_entity;
+        bool                  added  = sim->live_index[entity] >= 0;
+        if ( entitytainer_is_added( entitytainer, entity ) != added ||
+             entitytainer_get_parent( entitytainer, entity ) != sim->parent[entity] ) {
+            printf( "Entity " ENTITYTAINER_EntityFormat " doesn't match the reference model.\n", entity );
+            return false;
+        }
+
+        if ( !added ) {
+            continue;
+        }
+
+        TheEntitytainerEntity* children;
+        int                    num_children;
+        int                    capacity;
+        entitytainer_get_children( entitytainer, entity, &children, &num_children, &capacity );
+        int num_slots   = sim->options->remove_with_holes ? capacity : num_children;
+        int num_matches = 0;
+        for ( int i_slot = 0; i_slot < num_slots; ++i_slot ) {
+            if ( children[i_slot] != ENTITYTAINER_InvalidEntity && sim->parent[children[i_slot]] == entity ) {
+                ++num_matches;
+            }
+        }
+
+        if ( num_children != sim->num_children[entity] || num_matches != num_children ) {
+            printf( "Children of " ENTITYTAINER_EntityFormat " don't match the reference model.\n", entity );
+            return false;
+        }
+    }
+
+    TheEntitytainerValidation report;
+    if ( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) ) {
+        printf( "Validation found %d problems, the first at entity " ENTITYTAINER_EntityFormat ", bucket list %d.\n",
+                report.num_problems,
+                report.first_entity,
+                report.first_bucket_list );
+        return false;
+    }
+
+    return true;
+}
+
+static void
+sim_format_ns( char* buffer, size_t buffer_size, unsigned long long ns ) {
+    if ( ns < 10000 ) {
+        snprintf( buffer, buffer_size, "%lluns", ns );
+    }
+    else if ( ns < 10000000 ) {
+        snprintf( buffer, buffer_size, "%.1fus", (double)ns / 1000.0 );
+    }
+    else {
+        snprintf( buffer, buffer_size, "%.1fms", (double)ns / 1000000.0 );
+    }
+}
+
+static void
+sim_print_latencies( const SimHistogram* histograms ) {
+    printf( "  %-14s %10s %9s %9s %9s %9s\n", "op", "count", "p50", "p99", "p999", "max" );
+    for ( int op = 0; op < SIM_NumOps; ++op ) {
+        const SimHistogram* histogram = &histograms[op];
+        if ( histogram->total == 0 ) {
+            continue;
+        }
+
+        char p50[32], p99[32], p999[32], max[32];
+        sim_format_ns( p50, sizeof( p50 ), sim_histogram_percentile( histogram, 0.5 ) );
+        sim_format_ns( p99, sizeof( p99 ), sim_histogram_percentile( histogram, 0.99 ) );
+        sim_format_ns( p999, sizeof( p999 ), sim_histogram_percentile( histogram, 0.999 ) );
+        sim_format_ns( max, sizeof( max ), histogram->max );
+        printf( "  %-14s %10llu %9s %9s %9s %9s\n", g_op_names[op], histogram->total, p50, p99, p999, max );
+    }
+}
+
+static void
+sim_print_tiers( Sim* sim ) {
+    TheEntitytainer* entitytainer = sim->entitytainer;
+    int              spans[ENTITYTAINER_MAX_BUCKET_LISTS];
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        spans[i] = i == 0 ? 1 : 0; // Bucket 0 of the first list is reserved
+    }
+
+    for ( int i_entity = 1; i_entity < sim->options->num_entities; ++i_entity ) {
+        TheEntitytainerEntry entry = *entitytainer__entry( entitytainer, (TheEntitytainerEntity)i_entity );
+        if ( entry == 0 ) {
+            continue;
+        }
+
+        int bucket_list_index = entry >> entitytainer->bucket_list_offset;
+        int bucket_index      = entry & entitytainer->bucket_mask;
+        if ( bucket_index + 1 > spans[bucket_list_index] ) {
+            spans[bucket_list_index] = bucket_index + 1;
+        }
+    }
+
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        printf( "  tier %d (%4d): used %6d/%-6d %5.1f%%  span %6d  frag %5.1f%%",
+                i,
+                list->bucket_size,
+                list->used_buckets,
+                list->total_buckets,
+                100.0 * list->used_buckets / list->total_buckets,
+                spans[i],
+                spans[i] > 0 ? 100.0 * ( spans[i] - list->used_buckets ) / spans[i] : 0.0 );
+        if ( list->free_bits != NULL ) {
+            printf( "\n" );
+            continue;
+        }
+
+        int       bucket_bytes = list->bucket_size * (int)sizeof( TheEntitytainerEntity );
+        int       length       = 0;
+        int       far          = 0;
+        long long distance     = 0;
+        int       bucket_index = list->first_free_bucket;
+        while ( bucket_index != ENTITYTAINER_NoFreeBucket && length < list->total_buckets ) {
+            int next = *entitytainer__bucket( list, bucket_index );
+            ++length;
+            if ( next != ENTITYTAINER_NoFreeBucket ) {
+                distance += next > bucket_index ? next - bucket_index : bucket_index - next;
+                far += ( next * bucket_bytes ) / SIM_PageSize != ( bucket_index * bucket_bytes ) / SIM_PageSize;
+            }
+
+            bucket_index = next;
+        }
+
+        printf( "  free list %6d  jump %8.1f  far %5.1f%%\n",
+                length,
+                length > 1 ? (double)distance / ( length - 1 ) : 0.0,
+                length > 1 ? 100.0 * far / ( length - 1 ) : 0.0 );
+    }
+}
+
+static bool
+sim_parse_tiers( SimOptions* options, const char* text ) {
+    options->num_bucket_lists = 0;
+    while ( *text != '\0' ) {
+        int size, count, consumed;
+        if ( options->num_bucket_lists == ENTITYTAINER_MAX_BUCKET_LISTS ||
+             sscanf( text, "%d:%d%n", &size, &count, &consumed ) != 2 ) {
+            return false;
+        }
+
+        options->bucket_sizes[options->num_bucket_lists]      = size;
+        options->bucket_list_sizes[options->num_bucket_lists] = count;
+        ++options->num_bucket_lists;
+        text += consumed;
+        if ( *text == ',' ) {
+            ++text;
+        }
+    }
+
+    return options->num_bucket_lists > 0;
+}
+
+static bool
+sim_parse_options( SimOptions* options, int argc, char** argv ) {
+    for ( int i = 1; i < argc; ++i ) {
+        const char* arg   = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if ( strcmp( arg, "-holes" ) == 0 ) {
+            options->remove_with_holes = true;
+        }
+        else if ( strcmp( arg, "-keep" ) == 0 ) {
+            options->keep_capacity_on_remove = true;
+        }
+        else if ( strcmp( arg, "-lowest" ) == 0 ) {
+            options->lowest_free_bucket = true;
+        }
+        else if ( strcmp( arg, "-interleaved" ) == 0 ) {
+            options->interleaved_lookups = true;
+        }
+        else if ( value == NULL ) {
+            return false;
+        }
+        else if ( strcmp( arg, "-ops" ) == 0 ) {
+            options->ops = atoll( value );
+            ++i;
+        }
+        else if ( strcmp( arg, "-window" ) == 0 ) {
+            options->window = atoll( value );
+            ++i;
+        }
+        else if ( strcmp( arg, "-check" ) == 0 ) {
+            options->check_interval = atoll( value );
+            ++i;
+        }
+        else if ( strcmp( arg, "-seed" ) == 0 ) {
+            options->seed = strtoull( value, NULL, 10 );
+            ++i;
+        }
+        else if ( strcmp( arg, "-entities" ) == 0 ) {
+            options->num_entities = atoi( value );
+            ++i;
+        }
+        else if ( strcmp( arg, "-hubs" ) == 0 ) {
+            options->num_hubs = atoi( value );
+            ++i;
+        }
+        else if ( strcmp( arg, "-mix" ) == 0 ) {
+            int* mix = options->mix;
+            if ( sscanf( value, "%d,%d,%d,%d", &mix[0], &mix[1], &mix[2], &mix[3] ) != 4 ) {
+                return false;
+            }
+            ++i;
+        }
+        else if ( strcmp( arg, "-tiers" ) == 0 ) {
+            if ( !sim_parse_tiers( options, value ) ) {
+                return false;
+            }
+            ++i;
+        }
+        else {
+            return false;
+        }
+    }
+
+    int mix_total = options->mix[0] + options->mix[1] + options->mix[2] + options->mix[3];
+    return options->ops > 0 && options->window > 0 && options->num_entities > 2 &&
+           options->num_entities <= (int)(TheEntitytainerEntity)-1 && options->num_hubs < options->num_entities &&
+           mix_total > 0 && options->seed != 0;
+}
+
+int
+main( int argc, char** argv ) {
+    SimOptions options               = { 0 };
+    options.ops                      = 10000000;
+    options.window                   = 1000000;
+    options.check_interval           = 100000;
+    options.seed                     = 1;
+    options.num_entities             = 8192;
+    options.num_hubs                 = 8;
+    options.mix[SIM_MixAdd]          = 40;
+    options.mix[SIM_MixRemove]       = 35;
+    options.mix[SIM_MixReparent]     = 20;
+    options.mix[SIM_MixReserve]      = 5;
+    options.num_bucket_lists         = 4;
+    options.bucket_sizes[0]          = 4;
+    options.bucket_sizes[1]          = 16;
+    options.bucket_sizes[2]          = 64;
+    options.bucket_sizes[3]          = 256;
+    options.bucket_list_sizes[0]     = 8192;
+    options.bucket_list_sizes[1]     = 2048;
+    options.bucket_list_sizes[2]     = 256;
+    options.bucket_list_sizes[3]     = 32;
+    if ( !sim_parse_options( &options, argc, argv ) ) {
+        printf( "Usage: churnsim [-ops N] [-window N] [-check N] [-seed N] [-entities N] [-hubs N]\n"
+                "                [-mix add,remove,reparent,reserve] [-tiers size:count,size:count,...]\n"
+                "                [-holes] [-keep] [-lowest] [-interleaved]\n" );
+        return 1;
+    }
+
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = options.num_entities;
+    config.num_bucket_lists             = options.num_bucket_lists;
+    config.remove_with_holes            = options.remove_with_holes;
+    config.keep_capacity_on_remove      = options.keep_capacity_on_remove;
+    config.lowest_free_bucket           = options.lowest_free_bucket;
+    config.interleaved_lookups          = options.interleaved_lookups;
+    for ( int i = 0; i < options.num_bucket_lists; ++i ) {
+        config.bucket_sizes[i]      = options.bucket_sizes[i];
+        config.bucket_list_sizes[i] = options.bucket_list_sizes[i];
+    }
+
+    config.memory_size = entitytainer_needed_size( &config );
+    config.memory      = malloc( (size_t)config.memory_size );
+
+    Sim* sim          = (Sim*)calloc( 1, sizeof( Sim ) );
+    sim->entitytainer = entitytainer_create( &config );
+    sim->options      = &options;
+    sim->rng          = options.seed;
+    sim->max_live     = options.num_entities * 3 / 4;
+    sim->parent       = (TheEntitytainerEntity*)calloc( (size_t)options.num_entities, sizeof( TheEntitytainerEntity ) );
+    sim->num_children = (int*)calloc( (size_t)options.num_entities, sizeof( int ) );
+    sim->live         = (TheEntitytainerEntity*)calloc( (size_t)options.num_entities, sizeof( TheEntitytainerEntity ) );
+    sim->live_index   = (int*)malloc( (size_t)options.num_entities * sizeof( int ) );
+    sim->linked       = (TheEntitytainerEntity*)calloc( (size_t)options.num_entities, sizeof( TheEntitytainerEntity ) );
+    sim->linked_index = (int*)malloc( (size_t)options.num_entities * sizeof( int ) );
+    for ( int i = 0; i < options.num_entities; ++i ) {
+        sim->live_index[i]   = -1;
+        sim->linked_index[i] = -1;
+    }
+
+    int   scratch_size = entitytainer_validate_scratch_size( sim->entitytainer );
+    void* scratch      = malloc( (size_t)scratch_size );
+    int   mix_total    = options.mix[0] + options.mix[1] + options.mix[2] + options.mix[3];
+
+    printf( "churnsim: %lld ops, %d entities, %d hubs, mix %d/%d/%d/%d, %d tiers%s%s%s%s, seed %llu\n",
+            options.ops,
+            options.num_entities,
+            options.num_hubs,
+            options.mix[0],
+            options.mix[1],
+            options.mix[2],
+            options.mix[3],
+            options.num_bucket_lists,
+            options.remove_with_holes ? ", holes" : "",
+            options.keep_capacity_on_remove ? ", keep capacity" : "",
+            options.lowest_free_bucket ? ", lowest free bucket" : "",
+            options.interleaved_lookups ? ", interleaved lookups" : "",
+            options.seed );
+
+    unsigned long long start_ns = sim_now_ns();
+    bool               ok       = true;
+    for ( long long i_op = 1; i_op <= options.ops && ok; ++i_op ) {
+        int roll = sim_random_below( sim, mix_total );
+        if ( roll < options.mix[SIM_MixAdd] ) {
+            sim_add( sim );
+        }
+        else if ( roll < options.mix[SIM_MixAdd] + options.mix[SIM_MixRemove] ) {
+            sim_remove( sim );
+        }
+        else if ( roll < options.mix[SIM_MixAdd] + options.mix[SIM_MixRemove] + options.mix[SIM_MixReparent] ) {
+            sim_reparent( sim );
+        }
+        else {
+            sim_reserve( sim );
+        }
+
+        if ( options.check_interval > 0 && i_op % options.check_interval == 0 ) {
+            ok = sim_check( sim, scratch, scratch_size );
+        }
+
+        if ( i_op % options.window == 0 || i_op == options.ops ) {
+            printf( "\n[%lld ops, %.2fs] live %d, parented %d, skipped %lld\n",
+                    i_op,
+                    (double)( sim_now_ns() - start_ns ) / 1000000000.0,
+                    sim->num_live,
+                    sim->num_linked,
+                    sim->skipped );
+            sim_print_latencies( sim->window );
+            sim_print_tiers( sim );
+            memset( sim->window, 0, sizeof( sim->window ) );
+        }
+    }
+
+    if ( ok ) {
+        printf( "\nWhole run:\n" );
+        sim_print_latencies( sim->total );
+    }
+    else {
+        printf( "Stopped, the entitytainer doesn't match the reference model.\n" );
+    }
+
+    free( scratch );
+    free( sim->parent );
+    free( sim->num_children );
+    free( sim->live );
+    free( sim->live_index );
+    free( sim->linked );
+    free( sim->linked_index );
+    entitytainer_destroy( sim->entitytainer );
+    free( sim );
+    free( config.memory );
+    return ok ? 0 : 1;
+}
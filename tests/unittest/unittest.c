@@ -5,16 +5,26 @@
 
 #include "unittest.h"
 
+// The threaded tests assert from several threads at once.
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define UNITTEST_atomic_increment( ptr ) ( (unsigned)_InterlockedIncrement( (volatile long*)( ptr ) ) - 1u )
+#else
+#define UNITTEST_atomic_increment( ptr ) __atomic_fetch_add( ( ptr ), 1u, __ATOMIC_RELAXED )
+#endif
+
 static UnitTestData g_testdata;
 
 void
 unittest_entitytainer_assert( bool test ) {
-    ++g_testdata.num_tests;
-    if ( g_testdata.error_index == 256 ) {
-        assert( false );
-    }
+    UNITTEST_atomic_increment( &g_testdata.num_tests );
     if ( !test ) {
-        memcpy( g_testdata.errors[g_testdata.error_index++], "LOL", 4 );
+        unsigned error_index = UNITTEST_atomic_increment( &g_testdata.error_index );
+        if ( error_index >= 256 ) {
+            assert( false );
+            return;
+        }
+        memcpy( g_testdata.errors[error_index], "LOL", 4 );
     }
     // DebugBreak();
 }
@@ -27,8 +37,8 @@ main( int argc, char** argv ) {
     memset( &g_testdata, 0, sizeof( g_testdata ) );
     UnitTestData* testdata = &g_testdata;
 
-    // unittest_run_entity32( testdata );
     unittest_run_default( testdata );
+    unittest_run_entity32( testdata );
 
     // A bit of a hack.
     system( "pause" );
@@ -9,6 +9,16 @@
 #include <stdbool.h>
 #endif
 
+#if ENTITYTAINER_CONCURRENT
+#if defined( _WIN32 )
+#pragma warning( push, 0 )
+#include <windows.h>
+#pragma warning( pop )
+#else
+#include <pthread.h>
+#endif
+#endif
+
 #include "unittest.h"
 
 // #define ENTITYTAINER_assert unittest_entitytainer_assert
@@ -152,7 +162,7 @@ do_multi_parent_tests( TheEntitytainer* entitytainer ) {
 
     for ( TheEntitytainerEntity i_child = 0; i_child < 15; ++i_child ) {
         ASSERT( entitytainer_get_parent( entitytainer, 41 + i_child ) == 40 );
-        ASSERT( entitytainer_get_child_index( entitytainer, 40, 41 + i_child ) == i_child );
+        ASSERT( entitytainer_get_child_index( entitytainer, 40, 41 + i_child ) == (int)i_child );
     }
 
     for ( TheEntitytainerEntity i_child = 0; i_child < 8; ++i_child ) {
@@ -493,6 +503,1887 @@ do_save_load_upgrade_test( void ) {
     ASSERT( num_children == 1 );
 }
 
+static void
+do_ancestry_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 16;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.ancestry_levels              = 2; // Small on purpose, so deep chains need more than one pass
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // Chain 1 -> 2 -> ... -> 10, with a branch 5 -> 20 -> 21
+    for ( TheEntitytainerEntity i_entity = 1; i_entity < 10; ++i_entity ) {
+        entitytainer_add_entity( entitytainer, i_entity );
+        entitytainer_add_child( entitytainer, i_entity, i_entity + 1 );
+    }
+
+    entitytainer_add_entity( entitytainer, 20 );
+    entitytainer_add_child( entitytainer, 5, 20 );
+    entitytainer_add_child( entitytainer, 20, 21 );
+
+    ASSERT( entitytainer_get_depth( entitytainer, 1 ) == 0 );
+    ASSERT( entitytainer_get_depth( entitytainer, 10 ) == 9 );
+    ASSERT( entitytainer_get_depth( entitytainer, 21 ) == 6 );
+    ASSERT( entitytainer_get_root( entitytainer, 10 ) == 1 );
+    ASSERT( entitytainer_get_root( entitytainer, 21 ) == 1 );
+    ASSERT( entitytainer_get_root( entitytainer, 1 ) == 1 );
+    ASSERT( entitytainer_is_ancestor( entitytainer, 1, 10 ) );
+    ASSERT( entitytainer_is_ancestor( entitytainer, 5, 21 ) );
+    ASSERT( !entitytainer_is_ancestor( entitytainer, 6, 21 ) );
+    ASSERT( !entitytainer_is_ancestor( entitytainer, 10, 1 ) );
+    ASSERT( !entitytainer_is_ancestor( entitytainer, 10, 10 ) );
+    ASSERT( entitytainer_lowest_common_ancestor( entitytainer, 10, 21 ) == 5 );
+    ASSERT( entitytainer_lowest_common_ancestor( entitytainer, 9, 10 ) == 9 );
+    ASSERT( entitytainer_lowest_common_ancestor( entitytainer, 21, 21 ) == 21 );
+
+    // Detaching a subtree invalidates the index, which is rebuilt on the next query.
+    entitytainer_remove_child_no_holes( entitytainer, 4, 5 );
+    ASSERT( entitytainer->ancestry_dirty );
+    ASSERT( entitytainer_get_root( entitytainer, 21 ) == 5 );
+    ASSERT( entitytainer_get_depth( entitytainer, 10 ) == 5 );
+    ASSERT( entitytainer_lowest_common_ancestor( entitytainer, 10, 4 ) == ENTITYTAINER_InvalidEntity );
+    ASSERT( !entitytainer->ancestry_dirty );
+
+    // Leaves are updated in place.
+    entitytainer_add_child( entitytainer, 4, 30 );
+    ASSERT( !entitytainer->ancestry_dirty );
+    ASSERT( entitytainer_get_depth( entitytainer, 30 ) == 4 );
+    ASSERT( entitytainer_lowest_common_ancestor( entitytainer, 30, 2 ) == 2 );
+    entitytainer_remove_child_no_holes( entitytainer, 4, 30 );
+    ASSERT( !entitytainer->ancestry_dirty );
+    ASSERT( entitytainer_get_root( entitytainer, 30 ) == 30 );
+
+    free( config.memory );
+}
+
+static void
+do_preorder_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 16;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.remove_with_holes            = true;
+    config.preorder_index               = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // 1 { 2 { 4, 5 }, 3 { 6 } }, 10 { 11 }, 20
+    entitytainer_add_entity( entitytainer, 1 );
+    entitytainer_add_entity( entitytainer, 2 );
+    entitytainer_add_entity( entitytainer, 3 );
+    entitytainer_add_entity( entitytainer, 10 );
+    entitytainer_add_entity( entitytainer, 20 );
+    entitytainer_add_child( entitytainer, 1, 2 );
+    entitytainer_add_child( entitytainer, 1, 7 );
+    entitytainer_add_child( entitytainer, 1, 3 );
+    entitytainer_add_child( entitytainer, 2, 4 );
+    entitytainer_add_child( entitytainer, 2, 5 );
+    entitytainer_add_child( entitytainer, 3, 6 );
+    entitytainer_add_child( entitytainer, 10, 11 );
+    entitytainer_remove_child_with_holes( entitytainer, 1, 7 ); // Leaves a hole between 2 and 3
+
+    const TheEntitytainerEntity* entities;
+    const int*                   subtree_sizes;
+    const int*                   parent_indices;
+    int                          count;
+    entitytainer_get_preorder( entitytainer, &entities, &subtree_sizes, &parent_indices, &count );
+
+    TheEntitytainerEntity expected_entities[]       = { 1, 2, 4, 5, 3, 6, 10, 11, 20 };
+    int                   expected_subtree_sizes[]  = { 6, 3, 1, 1, 2, 1, 2, 1, 1 };
+    int                   expected_parent_indices[] = { -1, 0, 1, 1, 0, 4, -1, 6, -1 };
+    ASSERT( count == 9 );
+    for ( int i = 0; i < count && i < 9; ++i ) {
+        ASSERT( entities[i] == expected_entities[i] );
+        ASSERT( subtree_sizes[i] == expected_subtree_sizes[i] );
+        ASSERT( parent_indices[i] == expected_parent_indices[i] );
+        ASSERT( entitytainer_get_preorder_index( entitytainer, entities[i] ) == i );
+    }
+
+    ASSERT( entitytainer_get_preorder_index( entitytainer, 7 ) == -1 );
+
+    // Moving a subtree shows up after the next rebuild.
+    entitytainer_remove_child_with_holes( entitytainer, 1, 2 );
+    entitytainer_add_entity( entitytainer, 11 );
+    entitytainer_add_child( entitytainer, 11, 2 );
+    ASSERT( entitytainer->preorder_dirty );
+    entitytainer_get_preorder( entitytainer, &entities, &subtree_sizes, &parent_indices, &count );
+    ASSERT( count == 9 );
+    ASSERT( entities[0] == 1 );
+    ASSERT( subtree_sizes[0] == 3 );
+    ASSERT( entities[3] == 10 );
+    ASSERT( subtree_sizes[3] == 5 );
+    ASSERT( entities[5] == 2 );
+    ASSERT( parent_indices[5] == 4 );
+    ASSERT( entitytainer_get_preorder_index( entitytainer, 5 ) == 7 );
+
+    free( config.memory );
+}
+
+static void
+do_dirty_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 256;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 16;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.dirty_tracking               = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // 100 { 3, 150 { 5, 70 } }, 200 { 201 }
+    entitytainer_add_entity( entitytainer, 100 );
+    entitytainer_add_entity( entitytainer, 150 );
+    entitytainer_add_entity( entitytainer, 200 );
+    entitytainer_add_child( entitytainer, 100, 3 );
+    entitytainer_add_child( entitytainer, 100, 150 );
+    entitytainer_add_child( entitytainer, 150, 5 );
+    entitytainer_add_child( entitytainer, 150, 70 );
+    entitytainer_add_child( entitytainer, 200, 201 );
+
+    TheEntitytainerEntity dirty[16];
+    ASSERT( entitytainer_consume_dirty( entitytainer, dirty, 16 ) == 0 );
+
+    entitytainer_mark_dirty_subtree( entitytainer, 150 );
+    ASSERT( entitytainer_is_dirty( entitytainer, 70 ) );
+    ASSERT( !entitytainer_is_dirty( entitytainer, 100 ) );
+
+    entitytainer_mark_dirty_subtree( entitytainer, 100 );
+    ASSERT( entitytainer_is_dirty( entitytainer, 3 ) );
+    ASSERT( !entitytainer_is_dirty( entitytainer, 201 ) );
+
+    ASSERT( entitytainer_consume_dirty( entitytainer, dirty, 2 ) == 2 );
+    ASSERT( dirty[0] == 100 );
+    ASSERT( dirty[1] == 3 );
+    ASSERT( !entitytainer_is_dirty( entitytainer, 100 ) );
+
+    ASSERT( entitytainer_consume_dirty( entitytainer, dirty, 16 ) == 3 );
+    ASSERT( dirty[0] == 150 );
+    ASSERT( dirty[1] == 5 );
+    ASSERT( dirty[2] == 70 );
+    ASSERT( entitytainer_consume_dirty( entitytainer, dirty, 16 ) == 0 );
+
+    // Children added to a dirty parent become dirty too.
+    entitytainer_mark_dirty_subtree( entitytainer, 150 );
+    entitytainer_add_child( entitytainer, 150, 80 );
+    ASSERT( entitytainer_is_dirty( entitytainer, 80 ) );
+    entitytainer_remove_entity( entitytainer, 80 );
+    ASSERT( !entitytainer_is_dirty( entitytainer, 80 ) );
+    ASSERT( entitytainer_consume_dirty( entitytainer, dirty, 16 ) == 3 );
+    ASSERT( dirty[0] == 150 );
+
+    free( config.memory );
+}
+
+static void
+do_reparent_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 256;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_sizes[2]              = 32;
+    config.bucket_list_sizes[0]         = 8;
+    config.bucket_list_sizes[1]         = 4;
+    config.bucket_list_sizes[2]         = 2;
+    config.num_bucket_lists             = 3;
+    config.ancestry_levels              = 2;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    entitytainer_add_entity( entitytainer, 10 );
+    entitytainer_add_entity( entitytainer, 20 );
+    for ( TheEntitytainerEntity i_child = 0; i_child < 6; ++i_child ) {
+        entitytainer_add_child( entitytainer, 10, 11 + i_child );
+    }
+
+    entitytainer_reparent( entitytainer, 13, 20 );
+    ASSERT( entitytainer_get_parent( entitytainer, 13 ) == 20 );
+    ASSERT( entitytainer_num_children( entitytainer, 10 ) == 5 );
+    ASSERT( entitytainer_get_child_index( entitytainer, 10, 14 ) == 2 );
+    ASSERT( entitytainer_get_child_index( entitytainer, 20, 13 ) == 0 );
+    ASSERT( entitytainer_get_depth( entitytainer, 13 ) == 1 );
+
+    entitytainer_reparent( entitytainer, 13, 0 );
+    ASSERT( entitytainer_get_parent( entitytainer, 13 ) == 0 );
+    ASSERT( entitytainer_num_children( entitytainer, 20 ) == 0 );
+    ASSERT( entitytainer_get_depth( entitytainer, 13 ) == 0 );
+
+    // Moving everything shrinks 10 down to the smallest bucket list and grows 20 to the biggest in one go.
+    TheEntitytainerEntity moved[] = { 11, 12, 14, 15, 16 };
+    entitytainer_reparent_batch( entitytainer, 10, 20, moved, 5 );
+    ASSERT( entitytainer_num_children( entitytainer, 10 ) == 0 );
+    ASSERT( entitytainer_num_children( entitytainer, 20 ) == 5 );
+    ASSERT( ( *entitytainer__entry( entitytainer, 10 ) >> entitytainer->bucket_list_offset ) == 0 );
+    ASSERT( ( *entitytainer__entry( entitytainer, 20 ) >> entitytainer->bucket_list_offset ) == 1 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 1 );
+    ASSERT( entitytainer->bucket_lists[2].used_buckets == 0 );
+    for ( int i = 0; i < 5; ++i ) {
+        ASSERT( entitytainer_get_parent( entitytainer, moved[i] ) == 20 );
+        ASSERT( entitytainer_get_child_index( entitytainer, 20, moved[i] ) == i );
+    }
+
+    // Buckets freed by shrinking are reused instead of leaking.
+    entitytainer_reparent_batch( entitytainer, 20, 10, moved, 5 );
+    entitytainer_reparent_batch( entitytainer, 10, 20, moved, 5 );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 2 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 1 );
+
+    free( config.memory );
+}
+
+static void
+do_remove_subtree_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 256;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.remove_with_holes            = true;
+    config.ancestry_levels              = 2;
+    config.dirty_tracking               = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // 1 { 2, 10 { 11, 12, 13, 14 { 15 }, 16 } }
+    entitytainer_add_entity( entitytainer, 1 );
+    entitytainer_add_entity( entitytainer, 10 );
+    entitytainer_add_entity( entitytainer, 14 );
+    entitytainer_add_child( entitytainer, 1, 2 );
+    entitytainer_add_child( entitytainer, 1, 10 );
+    for ( TheEntitytainerEntity i_child = 0; i_child < 6; ++i_child ) {
+        entitytainer_add_child( entitytainer, 10, 11 + i_child );
+    }
+
+    entitytainer_remove_child_with_holes( entitytainer, 10, 15 );
+    entitytainer_add_child( entitytainer, 14, 15 );
+    entitytainer_mark_dirty_subtree( entitytainer, 10 );
+
+    TheEntitytainerEntity removed[8];
+    ASSERT( entitytainer_remove_subtree( entitytainer, 10, removed, 8 ) == 7 );
+    ASSERT( removed[6] == 10 );
+    for ( int i = 0; i < 6; ++i ) {
+        ASSERT( removed[i] != 10 );
+        ASSERT( entitytainer_get_parent( entitytainer, removed[i] ) == 0 );
+        ASSERT( !entitytainer_is_dirty( entitytainer, removed[i] ) );
+        if ( removed[i] == 15 ) {
+            ASSERT( removed[i + 1] == 14 );
+        }
+    }
+
+    ASSERT( !entitytainer_is_added( entitytainer, 10 ) );
+    ASSERT( !entitytainer_is_added( entitytainer, 14 ) );
+    ASSERT( entitytainer_num_children( entitytainer, 1 ) == 1 );
+    ASSERT( entitytainer_get_depth( entitytainer, 15 ) == 0 );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 2 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 0 );
+
+    // Only the first entities are reported when out of room, the rest are still removed.
+    ASSERT( entitytainer_remove_subtree( entitytainer, 1, removed, 1 ) == 2 );
+    ASSERT( removed[0] == 2 );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 1 );
+
+    free( config.memory );
+}
+
+static void
+do_sorted_children_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 256;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 16;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.sorted_children              = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    TheEntitytainerEntity stash_items[]   = { 50, 12, 40, 7, 33, 90 };
+    TheEntitytainerEntity loadout_items[] = { 20, 3, 99, 60 };
+    entitytainer_add_entity( entitytainer, 1 );
+    entitytainer_add_entity( entitytainer, 2 );
+    for ( int i = 0; i < 6; ++i ) {
+        entitytainer_add_child( entitytainer, 1, stash_items[i] );
+    }
+
+    for ( int i = 0; i < 4; ++i ) {
+        entitytainer_add_child( entitytainer, 2, loadout_items[i] );
+    }
+
+    int                    num_children;
+    int                    capacity;
+    TheEntitytainerEntity* children;
+    entitytainer_get_children( entitytainer, 1, &children, &num_children, &capacity );
+    ASSERT( num_children == 6 );
+    for ( int i = 1; i < num_children; ++i ) {
+        ASSERT( children[i - 1] < children[i] );
+    }
+
+    ASSERT( entitytainer_get_child_index( entitytainer, 1, 7 ) == 0 );
+    ASSERT( entitytainer_get_child_index( entitytainer, 1, 90 ) == 5 );
+    ASSERT( entitytainer_get_child_index( entitytainer, 1, 41 ) == -1 );
+
+    TheEntitytainerEntity dense[8];
+    ASSERT( entitytainer_copy_children_dense( entitytainer, 1, dense ) == 6 );
+    ASSERT( dense[0] == 7 && dense[5] == 90 );
+
+    entitytainer_remove_child_no_holes( entitytainer, 1, 33 );
+    ASSERT( entitytainer_get_child_index( entitytainer, 1, 40 ) == 2 );
+    entitytainer_add_child( entitytainer, 1, 33 );
+
+    // Stash: 40 50 90, loadout: 3 7 12 20 33 60 99
+    entitytainer_reparent( entitytainer, 33, 2 );
+    TheEntitytainerEntity moved[] = { 7, 12 };
+    entitytainer_reparent_batch( entitytainer, 1, 2, moved, 2 );
+    entitytainer_get_children( entitytainer, 2, &children, &num_children, &capacity );
+    ASSERT( num_children == 7 );
+    for ( int i = 1; i < num_children; ++i ) {
+        ASSERT( children[i - 1] < children[i] );
+    }
+
+    // With a single parent per child, two parents never share children.
+    TheEntitytainerEntity out[8];
+    ASSERT( entitytainer_intersect_children( entitytainer, 1, 2, out, 8 ) == 0 );
+    ASSERT( entitytainer_difference_children( entitytainer, 1, 2, out, 8 ) == 3 );
+    ASSERT( out[0] == 40 && out[1] == 50 && out[2] == 90 );
+    ASSERT( entitytainer_difference_children( entitytainer, 2, 1, out, 2 ) == 2 );
+    ASSERT( out[0] == 3 && out[1] == 7 );
+
+    free( config.memory );
+}
+
+static void
+do_child_slot_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 512;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 256;
+    config.bucket_list_sizes[0]         = 8;
+    config.bucket_list_sizes[1]         = 2;
+    config.num_bucket_lists             = 2;
+    config.remove_with_holes            = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    entitytainer_add_entity( entitytainer, 1 );
+    for ( TheEntitytainerEntity i_child = 0; i_child < 200; ++i_child ) {
+        entitytainer_add_child( entitytainer, 1, 100 + i_child );
+    }
+
+    const TheEntitytainerBitWord* slot_bits;
+    int                           num_words;
+    entitytainer_get_child_slots( entitytainer, 1, &slot_bits, &num_words );
+    ASSERT( num_words == 4 );
+    ASSERT( slot_bits[0] == ~0ull && slot_bits[2] == ~0ull );
+    ASSERT( slot_bits[3] == ( 1ull << 8 ) - 1 );
+
+    entitytainer_remove_child_with_holes( entitytainer, 1, 100 + 70 );
+    entitytainer_remove_child_with_holes( entitytainer, 1, 100 + 3 );
+    entitytainer_remove_child_with_holes( entitytainer, 1, 100 + 199 );
+    entitytainer_get_child_slots( entitytainer, 1, &slot_bits, &num_words );
+    ASSERT( slot_bits[0] == ~( 1ull << 3 ) );
+    ASSERT( slot_bits[1] == ~( 1ull << 6 ) );
+    ASSERT( slot_bits[3] == ( 1ull << 7 ) - 1 );
+
+    // Holes are refilled lowest first
+    int                    num_children;
+    int                    capacity;
+    TheEntitytainerEntity* children;
+    entitytainer_add_child( entitytainer, 1, 400 );
+    entitytainer_add_child( entitytainer, 1, 401 );
+    entitytainer_get_children( entitytainer, 1, &children, &num_children, &capacity );
+    ASSERT( children[3] == 400 );
+    ASSERT( children[70] == 401 );
+    ASSERT( children[199] == ENTITYTAINER_InvalidEntity );
+
+    // Walking the set bits visits exactly the live children
+    int found = 0;
+    for ( int i_word = 0; i_word < num_words; ++i_word ) {
+        TheEntitytainerBitWord word = slot_bits[i_word];
+        while ( word != 0 ) {
+            int slot = i_word * ENTITYTAINER_BitWordBits + ENTITYTAINER_ctz64( word );
+            ASSERT( children[slot] != ENTITYTAINER_InvalidEntity );
+            ++found;
+            word &= word - 1;
+        }
+    }
+
+    ASSERT( found == num_children );
+
+    TheEntitytainerEntity dense[256];
+    ASSERT( entitytainer_copy_children_dense( entitytainer, 1, dense ) == 199 );
+    ASSERT( dense[0] == 100 && dense[3] == 400 && dense[70] == 401 && dense[198] == 100 + 198 );
+    for ( int i = 0; i < 199; ++i ) {
+        ASSERT( dense[i] != ENTITYTAINER_InvalidEntity );
+    }
+
+    // The bits follow the children down to a smaller bucket list
+    entitytainer_add_entity( entitytainer, 2 );
+    entitytainer_add_child( entitytainer, 2, 3 );
+    entitytainer_add_child( entitytainer, 2, 4 );
+    entitytainer_add_child( entitytainer, 2, 5 );
+    entitytainer_add_child( entitytainer, 2, 6 );
+    entitytainer_remove_child_with_holes( entitytainer, 2, 3 );
+    entitytainer_remove_child_with_holes( entitytainer, 2, 6 );
+    entitytainer_remove_child_with_holes( entitytainer, 2, 5 );
+    ASSERT( ( *entitytainer__entry( entitytainer, 2 ) >> entitytainer->bucket_list_offset ) == 0 );
+    entitytainer_get_child_slots( entitytainer, 2, &slot_bits, &num_words );
+    ASSERT( slot_bits[0] == 2 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    entitytainer_get_child_slots( loaded, 1, &slot_bits, &num_words );
+    ASSERT( slot_bits[1] == ~0ull );
+    entitytainer_add_child( loaded, 2, 7 );
+    entitytainer_get_children( loaded, 2, &children, &num_children, &capacity );
+    ASSERT( children[0] == 7 );
+    ASSERT( entitytainer_copy_children_dense( loaded, 2, dense ) == 2 );
+    ASSERT( dense[0] == 7 && dense[1] == 4 );
+
+    // Holes in most blocks of four, copied into a buffer with no room to spare.
+    for ( TheEntitytainerEntity i_child = 2; i_child < 200; i_child += 3 ) {
+        entitytainer_remove_child_with_holes( entitytainer, 1, 100 + i_child );
+    }
+
+    entitytainer_get_children( entitytainer, 1, &children, &num_children, &capacity );
+    TheEntitytainerEntity* exact = malloc( num_children * sizeof( TheEntitytainerEntity ) );
+    ASSERT( entitytainer_copy_children_dense( entitytainer, 1, exact ) == num_children );
+    for ( int i_slot = 0, i_dense = 0; i_slot < capacity; ++i_slot ) {
+        if ( children[i_slot] != ENTITYTAINER_InvalidEntity ) {
+            ASSERT( i_dense < num_children && exact[i_dense++] == children[i_slot] );
+        }
+    }
+
+    free( exact );
+
+    free( buffer );
+    free( config.memory );
+}
+
+static void
+do_channel_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.num_channels                 = 3;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+    TheEntitytainer* attachments        = entitytainer_get_channel( entitytainer, 1 );
+    TheEntitytainer* inventory          = entitytainer_get_channel( entitytainer, 2 );
+    ASSERT( entitytainer_get_channel( entitytainer, 0 ) == entitytainer );
+
+    // 10 holds 11 in its hand and has 12, 13, 14, 15 in its inventory, 11 is in 20's inventory.
+    entitytainer_add_entity( attachments, 10 );
+    entitytainer_add_entity( inventory, 10 );
+    entitytainer_add_entity( inventory, 20 );
+    entitytainer_add_child( attachments, 10, 11 );
+    entitytainer_add_child( inventory, 20, 11 );
+    for ( TheEntitytainerEntity i_child = 0; i_child < 4; ++i_child ) {
+        entitytainer_add_child( inventory, 10, 12 + i_child );
+    }
+
+    ASSERT( !entitytainer_is_added( entitytainer, 10 ) );
+    ASSERT( entitytainer_get_parent( attachments, 11 ) == 10 );
+    ASSERT( entitytainer_get_parent( inventory, 11 ) == 20 );
+    ASSERT( entitytainer_get_parent( attachments, 12 ) == 0 );
+    ASSERT( entitytainer_num_children( attachments, 10 ) == 1 );
+    ASSERT( entitytainer_num_children( inventory, 10 ) == 4 );
+
+    // One pool for all channels, and an entity's entries are next to each other.
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 3 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 1 );
+    ASSERT( entitytainer__entry( inventory, 10 ) == entitytainer->entry_lookup + 10 * 3 + 2 );
+    ASSERT( entitytainer__parent( attachments, 11 ) == entitytainer->entry_parent_lookup + 11 * 3 + 1 );
+
+    entitytainer_remove_child_no_holes( inventory, 20, 11 );
+    ASSERT( entitytainer_get_parent( inventory, 11 ) == 0 );
+    ASSERT( entitytainer_get_parent( attachments, 11 ) == 10 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( entitytainer_get_parent( entitytainer_get_channel( loaded, 1 ), 11 ) == 10 );
+    ASSERT( entitytainer_num_children( entitytainer_get_channel( loaded, 2 ), 10 ) == 4 );
+    entitytainer_add_child( entitytainer_get_channel( loaded, 2 ), 20, 11 );
+    ASSERT( loaded->bucket_lists[0].used_buckets == 3 );
+
+    free( buffer );
+    free( config.memory );
+}
+
+static void
+do_dag_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.multi_parent                 = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // 30 is shared by 10, 11, 12 and 13, 31 only by 10.
+    for ( TheEntitytainerEntity i_parent = 0; i_parent < 4; ++i_parent ) {
+        entitytainer_add_entity( entitytainer, 10 + i_parent );
+        entitytainer_add_child( entitytainer, 10 + i_parent, 30 );
+    }
+
+    entitytainer_add_child( entitytainer, 10, 31 );
+    ASSERT( entitytainer_num_parents( entitytainer, 30 ) == 4 );
+    ASSERT( entitytainer_num_parents( entitytainer, 31 ) == 1 );
+    ASSERT( entitytainer_num_parents( entitytainer, 32 ) == 0 );
+    ASSERT( entitytainer_get_parent( entitytainer, 30 ) == 10 );
+    ASSERT( entitytainer_get_parent( entitytainer, 32 ) == 0 );
+    ASSERT( *entitytainer__parents_entry( entitytainer, 30 ) >> entitytainer->bucket_list_offset == 1 );
+
+    TheEntitytainerEntity* parents;
+    int                    num_parents;
+    entitytainer_get_parents( entitytainer, 30, &parents, &num_parents );
+    ASSERT( num_parents == 4 );
+    ASSERT( parents[0] == 10 && parents[1] == 11 && parents[2] == 12 && parents[3] == 13 );
+
+    // Parents and children share the bucket pools: the reserved bucket, 10-13 and the parents of 31.
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 1 + 4 + 1 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 1 );
+
+    entitytainer_remove_child_no_holes( entitytainer, 11, 30 );
+    entitytainer_get_parents( entitytainer, 30, &parents, &num_parents );
+    ASSERT( num_parents == 3 );
+    ASSERT( parents[0] == 10 && parents[1] == 12 && parents[2] == 13 );
+    ASSERT( *entitytainer__parents_entry( entitytainer, 30 ) >> entitytainer->bucket_list_offset == 0 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( entitytainer_num_parents( loaded, 30 ) == 3 );
+    ASSERT( entitytainer_get_parent( loaded, 31 ) == 10 );
+
+    // Removing the child takes it out of every parent and frees its parent bucket.
+    entitytainer_remove_entity( entitytainer, 30 );
+    ASSERT( entitytainer_num_parents( entitytainer, 30 ) == 0 );
+    ASSERT( entitytainer_num_children( entitytainer, 10 ) == 1 );
+    ASSERT( entitytainer_num_children( entitytainer, 12 ) == 0 );
+    ASSERT( entitytainer_num_children( entitytainer, 13 ) == 0 );
+    ASSERT( *entitytainer__parents_entry( entitytainer, 30 ) == 0 );
+
+    free( buffer );
+    free( config.memory );
+}
+
+static void
+do_payload_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 8;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.payload_size                 = sizeof( int );
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // Five children pushes 10 up to the second bucket list, the payloads have to come along.
+    entitytainer_add_entity( entitytainer, 10 );
+    entitytainer_add_entity( entitytainer, 20 );
+    for ( int i_child = 0; i_child < 5; ++i_child ) {
+        int stack_count = 100 + i_child;
+        entitytainer_add_child_with_payload( entitytainer, 10, (TheEntitytainerEntity)( 30 + i_child ), &stack_count );
+    }
+
+    ASSERT( *entitytainer__entry( entitytainer, 10 ) >> entitytainer->bucket_list_offset == 1 );
+    TheEntitytainerEntity* children;
+    void*                  payloads;
+    int                    num_children;
+    int                    capacity;
+    entitytainer_get_children_with_payload( entitytainer, 10, &children, &payloads, &num_children, &capacity );
+    ASSERT( num_children == 5 );
+    for ( int i_child = 0; i_child < num_children; ++i_child ) {
+        ASSERT( ( (int*)payloads )[i_child] == 100 + (int)children[i_child] - 30 );
+    }
+
+    // Removing from the middle shifts the payloads with the children, and demotes back down.
+    entitytainer_remove_child_no_holes( entitytainer, 10, 31 );
+    entitytainer_remove_child_no_holes( entitytainer, 10, 33 );
+    ASSERT( *entitytainer__entry( entitytainer, 10 ) >> entitytainer->bucket_list_offset == 0 );
+    entitytainer_get_children_with_payload( entitytainer, 10, &children, &payloads, &num_children, &capacity );
+    ASSERT( num_children == 3 );
+    ASSERT( children[0] == 30 && children[1] == 32 && children[2] == 34 );
+    ASSERT( ( (int*)payloads )[0] == 100 && ( (int*)payloads )[1] == 102 && ( (int*)payloads )[2] == 104 );
+
+    // Plain adds get a zeroed payload, reparenting keeps it.
+    entitytainer_add_child( entitytainer, 20, 35 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 20, 35 ) == 0 );
+    *(int*)entitytainer_get_child_payload( entitytainer, 20, 35 ) = 7;
+    entitytainer_reparent( entitytainer, 32, 20 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 20, 32 ) == 102 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 10, 34 ) == 104 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( *(int*)entitytainer_get_child_payload( loaded, 20, 35 ) == 7 );
+    ASSERT( *(int*)entitytainer_get_child_payload( loaded, 10, 30 ) == 100 );
+
+    free( buffer );
+    free( config.memory );
+}
+
+static int g_growth_allocations;
+
+static void*
+growth_allocate( void* user_data, void* memory, int old_size, int new_size ) {
+    (void)user_data;
+    (void)old_size;
+    if ( new_size == 0 ) {
+        --g_growth_allocations;
+        free( memory );
+        return NULL;
+    }
+
+    ++g_growth_allocations;
+    return malloc( new_size );
+}
+
+static void
+do_growth_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 4;
+    config.bucket_list_sizes[1]         = 2;
+    config.num_bucket_lists             = 2;
+    config.allocate                     = growth_allocate;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    entitytainer_add_entity( entitytainer, 1 );
+    for ( TheEntitytainerEntity i_child = 0; i_child < 5; ++i_child ) {
+        entitytainer_add_child( entitytainer, 1, 40 + i_child );
+    }
+
+    TheEntitytainerEntity* tier_1_data = entitytainer->bucket_lists[1].bucket_data;
+    TheEntitytainerEntry*  lookup      = entitytainer->entry_lookup;
+
+    // Bucket 0 is reserved, so the fourth entity is the first that doesn't fit in the first list.
+    for ( TheEntitytainerEntity entity = 2; entity < 12; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+        entitytainer_add_child( entitytainer, entity, 20 + entity );
+    }
+
+    ASSERT( entitytainer->bucket_lists[0].total_buckets == 16 );
+    ASSERT( entitytainer->bucket_lists[0].generation == 2 );
+    ASSERT( entitytainer->config.bucket_list_sizes[0] == 16 );
+    ASSERT( g_growth_allocations == 1 );
+    ASSERT( entitytainer->bucket_lists[1].bucket_data == tier_1_data );
+    ASSERT( entitytainer->entry_lookup == lookup );
+    for ( TheEntitytainerEntity entity = 2; entity < 12; ++entity ) {
+        ASSERT( entitytainer_get_parent( entitytainer, 20 + entity ) == entity );
+        ASSERT( entitytainer_num_children( entitytainer, entity ) == 1 );
+    }
+
+    ASSERT( entitytainer_num_children( entitytainer, 1 ) == 5 );
+
+    // The saved image has the grown list inline, like one created that big.
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( loaded->bucket_lists[0].total_buckets == 16 );
+    ASSERT( loaded->bucket_lists[0].grown_memory == NULL );
+    ASSERT( loaded->config.allocate == NULL );
+    for ( TheEntitytainerEntity entity = 2; entity < 12; ++entity ) {
+        TheEntitytainerEntity* children;
+        int                    num_children;
+        int                    capacity;
+        entitytainer_get_children( loaded, entity, &children, &num_children, &capacity );
+        ASSERT( num_children == 1 && children[0] == 20 + entity );
+    }
+
+    entitytainer_add_child( loaded, 1, 50 );
+    ASSERT( entitytainer_num_children( loaded, 1 ) == 6 );
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( buffer );
+    free( config.memory );
+}
+
+// Reparenting into a parent that needs a new bucket can grow the list the old parent's bucket is in, so the payload
+// has to be read after the insert.
+static void
+do_growth_payload_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 4;
+    config.bucket_list_sizes[1]         = 1;
+    config.num_bucket_lists             = 2;
+    config.payload_size                 = sizeof( int );
+    config.keep_capacity_on_remove      = true;
+    config.allocate                     = growth_allocate;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // 1 takes the only bucket of the second list, 2, 3 and 4 are full in the first.
+    for ( TheEntitytainerEntity entity = 1; entity < 5; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    for ( int i_child = 0; i_child < 5; ++i_child ) {
+        int payload = 100 + i_child;
+        entitytainer_add_child_with_payload( entitytainer, 1, (TheEntitytainerEntity)( 10 + i_child ), &payload );
+    }
+
+    for ( int i_child = 0; i_child < 3; ++i_child ) {
+        entitytainer_add_child( entitytainer, 2, (TheEntitytainerEntity)( 20 + i_child ) );
+        entitytainer_add_child( entitytainer, 3, (TheEntitytainerEntity)( 30 + i_child ) );
+        entitytainer_add_child( entitytainer, 4, (TheEntitytainerEntity)( 40 + i_child ) );
+    }
+
+    // The second growth frees the memory of the first, which 1's bucket was in.
+    ASSERT( entitytainer->bucket_lists[1].total_buckets == 1 );
+    entitytainer_reparent( entitytainer, 11, 2 );
+    ASSERT( entitytainer->bucket_lists[1].total_buckets == 2 );
+    entitytainer_reparent( entitytainer, 12, 3 );
+    ASSERT( entitytainer->bucket_lists[1].total_buckets == 4 );
+    TheEntitytainerEntity batch[] = { 13, 14 };
+    entitytainer_reparent_batch( entitytainer, 1, 4, batch, 2 );
+    ASSERT( entitytainer->bucket_lists[1].total_buckets == 4 );
+
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 2, 11 ) == 101 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 3, 12 ) == 102 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 4, 13 ) == 103 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 4, 14 ) == 104 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 1, 10 ) == 100 );
+    ASSERT( *(int*)entitytainer_get_child_payload( entitytainer, 2, 20 ) == 0 );
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( config.memory );
+}
+
+static void
+do_paged_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 4;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.remove_with_holes            = true;
+    config.payload_size                 = 2;
+    config.bucket_page_size             = 4;
+    config.max_bucket_list_sizes[0]     = 16;
+    config.allocate                     = growth_allocate;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    entitytainer_add_entity( entitytainer, 1 );
+    entitytainer_add_child( entitytainer, 1, 40 );
+    TheEntitytainerEntity* children_before;
+    int                    num_children;
+    int                    capacity;
+    entitytainer_get_children( entitytainer, 1, &children_before, &num_children, &capacity );
+
+    // Three more pages in the first list, nothing that was there moves.
+    for ( TheEntitytainerEntity entity = 2; entity < 16; ++entity ) {
+        unsigned short payload = (unsigned short)( 1000 + entity );
+        entitytainer_add_entity( entitytainer, entity );
+        entitytainer_add_child_with_payload( entitytainer, entity, 20 + entity, &payload );
+    }
+
+    TheEntitytainerEntity* children_after;
+    entitytainer_get_children( entitytainer, 1, &children_after, &num_children, &capacity );
+    ASSERT( children_after == children_before );
+    ASSERT( entitytainer->bucket_lists[0].num_pages == 4 );
+    ASSERT( entitytainer->bucket_lists[0].total_buckets == 16 );
+    ASSERT( entitytainer->bucket_lists[0].generation == 0 );
+    ASSERT( g_growth_allocations == 3 );
+    for ( TheEntitytainerEntity entity = 2; entity < 16; ++entity ) {
+        ASSERT( entitytainer_get_parent( entitytainer, 20 + entity ) == entity );
+        ASSERT( *(unsigned short*)entitytainer_get_child_payload( entitytainer, entity, 20 + entity ) == 1000 + entity );
+    }
+
+    // Buckets on appended pages are freed and reused like any other.
+    entitytainer_remove_child_with_holes( entitytainer, 14, 34 );
+    entitytainer_remove_entity( entitytainer, 14 );
+    entitytainer_add_entity( entitytainer, 14 );
+    ASSERT( entitytainer->bucket_lists[0].num_pages == 4 );
+    ASSERT( entitytainer_num_children( entitytainer, 14 ) == 0 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( loaded->bucket_lists[0].num_pages == 4 );
+    ASSERT( loaded->bucket_lists[0].num_inline_pages == 4 );
+    for ( TheEntitytainerEntity entity = 2; entity < 14; ++entity ) {
+        ASSERT( entitytainer_get_parent( loaded, 20 + entity ) == entity );
+        ASSERT( *(unsigned short*)entitytainer_get_child_payload( loaded, entity, 20 + entity ) == 1000 + entity );
+    }
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( buffer );
+    free( config.memory );
+
+    // The page tables only have room for the pages the lists can get, however many buckets an entry can index.
+    struct TheEntitytainerConfig sized = { 0 };
+    sized.num_entries                  = 64;
+    sized.num_bucket_lists             = 4;
+    sized.bucket_page_size             = 64;
+    for ( int i = 0; i < 4; ++i ) {
+        sized.bucket_sizes[i]      = 4 << i;
+        sized.bucket_list_sizes[i] = i == 0 ? 256 : 64;
+    }
+
+    int fixed_size = entitytainer_needed_size( &sized );
+    ASSERT( fixed_size > 0 && fixed_size < 64 * 1024 );
+
+    // Same for the free bitmaps, they start out covering the lists as they are.
+    sized.lowest_free_bucket = true;
+    ASSERT( entitytainer_needed_size( &sized ) - fixed_size < 1024 );
+    sized.lowest_free_bucket = false;
+    sized.max_bucket_list_sizes[0] = 1024;
+    ASSERT( entitytainer_needed_size( &sized ) == fixed_size + 12 * (int)sizeof( TheEntitytainerBucketPage ) );
+}
+
+static void
+do_lowest_free_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 8;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.lowest_free_bucket           = true;
+    config.allocate                     = growth_allocate;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // Grows the first list past its 8 buckets, bucket 0 is reserved.
+    for ( TheEntitytainerEntity entity = 1; entity <= 12; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    ASSERT( entitytainer->bucket_lists[0].total_buckets == 16 );
+    ASSERT( ( entitytainer->entry_lookup[12] & entitytainer->bucket_mask ) == 12 );
+
+    // Freed buckets come back lowest first, not in the order they were freed.
+    entitytainer_remove_entity( entitytainer, 9 );
+    entitytainer_remove_entity( entitytainer, 2 );
+    entitytainer_remove_entity( entitytainer, 5 );
+    entitytainer_add_entity( entitytainer, 30 );
+    ASSERT( ( entitytainer->entry_lookup[30] & entitytainer->bucket_mask ) == 2 );
+
+    // Moving to a bigger bucket frees the small one, which is the lowest again.
+    for ( TheEntitytainerEntity child = 40; child < 45; ++child ) {
+        entitytainer_add_child( entitytainer, 30, child );
+    }
+
+    ASSERT( ( entitytainer->entry_lookup[30] >> entitytainer->bucket_list_offset ) == 1 );
+    entitytainer_add_entity( entitytainer, 31 );
+    ASSERT( ( entitytainer->entry_lookup[31] & entitytainer->bucket_mask ) == 2 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    entitytainer_add_entity( loaded, 32 );
+    entitytainer_add_entity( loaded, 33 );
+    entitytainer_add_entity( loaded, 34 );
+    ASSERT( ( loaded->entry_lookup[32] & loaded->bucket_mask ) == 5 );
+    ASSERT( ( loaded->entry_lookup[33] & loaded->bucket_mask ) == 9 );
+    ASSERT( ( loaded->entry_lookup[34] & loaded->bucket_mask ) == 13 );
+    ASSERT( loaded->bucket_lists[0].used_buckets == 14 );
+    ASSERT( entitytainer_num_children( loaded, 30 ) == 5 );
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( buffer );
+    free( config.memory );
+
+    // With pages the bitmap starts out as big as the list, and is moved to a bigger one as pages are added.
+    struct TheEntitytainerConfig paged = { 0 };
+    paged.num_entries                  = 128;
+    paged.bucket_sizes[0]              = 4;
+    paged.bucket_list_sizes[0]         = 4;
+    paged.max_bucket_list_sizes[0]     = 1024;
+    paged.num_bucket_lists             = 1;
+    paged.bucket_page_size             = 4;
+    paged.lowest_free_bucket           = true;
+    paged.allocate                     = growth_allocate;
+    int paged_size                     = entitytainer_needed_size( &paged );
+    paged.memory                       = malloc( paged_size );
+    paged.memory_size                  = paged_size;
+    entitytainer                       = entitytainer_create( &paged );
+    ASSERT( entitytainer->bucket_lists[0].free_words == 1 );
+
+    // Seven pages, and the bitmap's last move is still allocated.
+    for ( TheEntitytainerEntity entity = 1; entity < 32; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    ASSERT( entitytainer->bucket_lists[0].total_buckets == 32 );
+    ASSERT( g_growth_allocations == 8 );
+    entitytainer_remove_entity( entitytainer, 20 );
+    entitytainer_remove_entity( entitytainer, 5 );
+    entitytainer_add_entity( entitytainer, 40 );
+    ASSERT( ( entitytainer->entry_lookup[40] & entitytainer->bucket_mask ) == 5 );
+
+    // Past 64 buckets the bitmap takes another word.
+    for ( TheEntitytainerEntity entity = 41; entity <= 100; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    ASSERT( entitytainer->bucket_lists[0].free_words == 2 );
+    ASSERT( ( entitytainer->entry_lookup[41] & entitytainer->bucket_mask ) == 20 );
+    ASSERT( ( entitytainer->entry_lookup[100] & entitytainer->bucket_mask ) == 90 );
+
+    buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( loaded->bucket_lists[0].free_words == 2 );
+    entitytainer_remove_entity( loaded, 70 );
+    entitytainer_remove_entity( loaded, 80 );
+    entitytainer_add_entity( loaded, 101 );
+    ASSERT( ( loaded->entry_lookup[101] & loaded->bucket_mask ) == 60 );
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( buffer );
+    free( paged.memory );
+}
+
+static void
+do_snapshot_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 8;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.payload_size                 = 2;
+    config.bucket_page_size             = 4;
+    config.allocate                     = growth_allocate;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    for ( TheEntitytainerEntity entity = 1; entity < 8; ++entity ) {
+        unsigned short payload = (unsigned short)( 1000 + entity );
+        entitytainer_add_entity( entitytainer, entity );
+        entitytainer_add_child_with_payload( entitytainer, entity, 20 + entity, &payload );
+    }
+
+    // Both pages of the first list and one of the second are shared, the lookups are copied.
+    TheEntitytainer* snapshot = entitytainer_snapshot( entitytainer );
+    ASSERT( g_growth_allocations == 1 );
+
+    // Reading the shared pages leaves them shared.
+    TheEntitytainerEntity*    children;
+    int                       num_children;
+    int                       capacity;
+    TheEntitytainerValidation report;
+    int                       generation   = entitytainer->bucket_lists[0].generation;
+    int                       scratch_size = entitytainer_validate_scratch_size( entitytainer );
+    void*                     scratch      = malloc( scratch_size );
+    entitytainer_get_children( entitytainer, 1, &children, &num_children, &capacity );
+    ASSERT( num_children == 1 && children[0] == 21 );
+    ASSERT( entitytainer_num_children( entitytainer, 6 ) == 1 );
+    ASSERT( entitytainer_get_parent( entitytainer, 27 ) == 7 );
+    ASSERT( entitytainer_get_child_index( entitytainer, 5, 25 ) == 0 );
+    ASSERT( entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( g_growth_allocations == 1 );
+    ASSERT( entitytainer->bucket_lists[0].generation == generation );
+    free( scratch );
+
+    entitytainer_add_child( entitytainer, 1, 40 );
+    ASSERT( g_growth_allocations == 2 );
+    entitytainer_add_child( entitytainer, 2, 41 );
+    ASSERT( g_growth_allocations == 2 );
+    entitytainer_remove_child_no_holes( entitytainer, 6, 26 );
+    entitytainer_reparent( entitytainer, 27, 1 );
+    entitytainer_add_child( entitytainer, 1, 42 );
+    entitytainer_add_child( entitytainer, 1, 43 );
+
+    entitytainer_get_children( snapshot, 1, &children, &num_children, &capacity );
+    ASSERT( num_children == 1 && children[0] == 21 );
+    ASSERT( entitytainer_num_children( snapshot, 6 ) == 1 );
+    ASSERT( entitytainer_get_parent( snapshot, 27 ) == 7 );
+    ASSERT( entitytainer_get_parent( snapshot, 40 ) == 0 );
+    for ( TheEntitytainerEntity entity = 1; entity < 8; ++entity ) {
+        ASSERT( *(unsigned short*)entitytainer_get_child_payload( snapshot, entity, 20 + entity ) == 1000 + entity );
+    }
+
+    entitytainer_get_children( entitytainer, 1, &children, &num_children, &capacity );
+    ASSERT( num_children == 5 && children[0] == 21 && children[1] == 40 && children[2] == 27 );
+    ASSERT( entitytainer_num_children( entitytainer, 6 ) == 0 );
+    ASSERT( entitytainer_get_parent( entitytainer, 27 ) == 1 );
+    ASSERT( *(unsigned short*)entitytainer_get_child_payload( entitytainer, 1, 21 ) == 1001 );
+
+    // The copies stay with the entitytainer, and so does the layout they need when saving.
+    entitytainer_release_snapshot( entitytainer, snapshot );
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( entitytainer_num_children( loaded, 1 ) == 5 );
+    ASSERT( entitytainer_get_parent( loaded, 41 ) == 2 );
+    ASSERT( *(unsigned short*)entitytainer_get_child_payload( loaded, 5, 25 ) == 1005 );
+
+    // Pages copied for the first snapshot are shared again by the next one.
+    snapshot = entitytainer_snapshot( entitytainer );
+    entitytainer_add_child( entitytainer, 3, 44 );
+    ASSERT( entitytainer_num_children( snapshot, 3 ) == 1 );
+    ASSERT( entitytainer_num_children( entitytainer, 3 ) == 2 );
+    entitytainer_release_snapshot( entitytainer, snapshot );
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( buffer );
+    free( config.memory );
+
+    // The ancestry and pre-order indices aren't copied, the snapshot builds its own from its tree.
+    struct TheEntitytainerConfig indexed = config;
+    indexed.ancestry_levels              = 4;
+    indexed.preorder_index               = true;
+    indexed.memory_size                  = entitytainer_needed_size( &indexed );
+    indexed.memory                       = malloc( indexed.memory_size );
+    entitytainer                         = entitytainer_create( &indexed );
+    for ( TheEntitytainerEntity entity = 1; entity < 4; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    entitytainer_add_child( entitytainer, 1, 2 );
+    entitytainer_add_child( entitytainer, 2, 3 );
+    ASSERT( entitytainer_get_depth( entitytainer, 3 ) == 2 );
+    ASSERT( entitytainer_get_preorder_index( entitytainer, 3 ) == 2 );
+
+    snapshot = entitytainer_snapshot( entitytainer );
+    ASSERT( snapshot->ancestry_dirty && snapshot->preorder_dirty );
+    entitytainer_reparent( entitytainer, 3, 1 );
+    ASSERT( entitytainer_get_depth( entitytainer, 3 ) == 1 );
+    ASSERT( entitytainer_get_depth( snapshot, 3 ) == 2 );
+    ASSERT( entitytainer_get_root( snapshot, 3 ) == 1 );
+    ASSERT( entitytainer_get_preorder_index( snapshot, 3 ) == 2 );
+    ASSERT( entitytainer_get_preorder_index( snapshot, 2 ) == 1 );
+    entitytainer_release_snapshot( entitytainer, snapshot );
+
+    entitytainer_destroy( entitytainer );
+    ASSERT( g_growth_allocations == 0 );
+    free( indexed.memory );
+}
+
+static void
+do_journal_tests( void ) {
+    TheEntitytainerJournalRecord journal[8];
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 16;
+    config.bucket_list_sizes[0]         = 16;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.journal                      = journal;
+    config.journal_size                 = 8;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    entitytainer_add_entity( entitytainer, 1 );
+    entitytainer_add_entity( entitytainer, 2 );
+    entitytainer_add_child( entitytainer, 1, 10 );
+    entitytainer_add_child( entitytainer, 1, 11 );
+    entitytainer_reparent( entitytainer, 10, 2 );
+    entitytainer_remove_entity( entitytainer, 11 );
+
+    TheEntitytainerJournalRecord records[16];
+    int                          num_dropped = -1;
+    ASSERT( entitytainer_drain_journal( entitytainer, records, 3, &num_dropped ) == 3 );
+    ASSERT( num_dropped == 0 );
+    ASSERT( records[0].op == ENTITYTAINER_JournalAddEntity && records[0].entity == 1 );
+    ASSERT( records[2].op == ENTITYTAINER_JournalAddChild && records[2].entity == 10 && records[2].parent == 1 );
+    ASSERT( entitytainer_drain_journal( entitytainer, records, 16, &num_dropped ) == 3 );
+    ASSERT( num_dropped == 0 );
+    ASSERT( records[1].op == ENTITYTAINER_JournalReparent && records[1].entity == 10 );
+    ASSERT( records[1].parent == 2 && records[1].old_parent == 1 );
+    ASSERT( records[2].op == ENTITYTAINER_JournalRemoveChild && records[2].entity == 11 && records[2].parent == 1 );
+
+    // The ring wraps around, and what doesn't fit is counted until it's drained empty.
+    for ( TheEntitytainerEntity child = 20; child < 30; ++child ) {
+        entitytainer_add_child( entitytainer, 2, child );
+    }
+
+    ASSERT( entitytainer_drain_journal( entitytainer, records, 4, &num_dropped ) == 4 );
+    ASSERT( num_dropped == 0 );
+    ASSERT( records[0].entity == 20 && records[3].entity == 23 );
+    ASSERT( entitytainer_drain_journal( entitytainer, records, 16, &num_dropped ) == 4 );
+    ASSERT( num_dropped == 2 );
+    ASSERT( records[3].entity == 27 );
+
+    // A removed subtree is journaled bottom up, so replaying it removes children before their parents.
+    entitytainer_add_entity( entitytainer, 20 );
+    entitytainer_add_child( entitytainer, 20, 30 );
+    entitytainer_drain_journal( entitytainer, records, 16, NULL );
+    TheEntitytainerEntity removed[16];
+    entitytainer_remove_subtree( entitytainer, 20, removed, 16 );
+    ASSERT( entitytainer_drain_journal( entitytainer, records, 16, &num_dropped ) == 3 );
+    ASSERT( records[0].op == ENTITYTAINER_JournalRemoveChild && records[0].entity == 20 && records[0].parent == 2 );
+    ASSERT( records[1].op == ENTITYTAINER_JournalRemoveChild && records[1].entity == 30 && records[1].parent == 20 );
+    ASSERT( records[2].op == ENTITYTAINER_JournalRemoveEntity && records[2].entity == 20 );
+    ASSERT( entitytainer_drain_journal( entitytainer, records, 16, &num_dropped ) == 0 );
+
+    free( config.memory );
+}
+
+static void
+do_diff_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 256;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 64;
+    config.bucket_list_sizes[0]         = 128;
+    config.bucket_list_sizes[1]         = 8;
+    config.num_bucket_lists             = 2;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    void* memory_a                      = malloc( needed_memory_size );
+    void* memory_b                      = malloc( needed_memory_size );
+    config.memory                       = memory_a;
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer_a     = entitytainer_create( &config );
+    config.memory                       = memory_b;
+    TheEntitytainer* entitytainer_b     = entitytainer_create( &config );
+
+    // The same hierarchy, built in a different order, has nothing to diff.
+    for ( TheEntitytainerEntity entity = 1; entity < 5; ++entity ) {
+        entitytainer_add_entity( entitytainer_a, entity );
+        entitytainer_add_entity( entitytainer_b, (TheEntitytainerEntity)( 5 - entity ) );
+    }
+
+    for ( TheEntitytainerEntity child = 100; child < 200; ++child ) {
+        TheEntitytainerEntity child_b = (TheEntitytainerEntity)( 299 - child );
+        entitytainer_add_child( entitytainer_a, (TheEntitytainerEntity)( 1 + child % 4 ), child );
+        entitytainer_add_child( entitytainer_b, (TheEntitytainerEntity)( 1 + child_b % 4 ), child_b );
+    }
+
+    TheEntitytainerJournalRecord ops[16];
+    ASSERT( entitytainer_diff( entitytainer_a, entitytainer_b, ops, 16 ) == 0 );
+
+    entitytainer_add_entity( entitytainer_b, 150 );
+    entitytainer_reparent( entitytainer_b, 101, 150 );
+    entitytainer_reparent( entitytainer_b, 102, 0 );
+    entitytainer_add_child( entitytainer_b, 3, 250 );
+    entitytainer_remove_child_no_holes( entitytainer_b, 4, 103 );
+    entitytainer_add_child( entitytainer_b, 4, 3 );
+    entitytainer_add_child( entitytainer_b, 150, 103 );
+    entitytainer_reparent( entitytainer_b, 199, 2 );
+    entitytainer_reparent( entitytainer_b, 199, 4 );
+    entitytainer_remove_child_no_holes( entitytainer_b, 1, 104 );
+
+    // Too small an array still gives the count.
+    ASSERT( entitytainer_diff( entitytainer_a, entitytainer_b, ops, 2 ) == 7 );
+    ASSERT( entitytainer_diff( entitytainer_a, entitytainer_b, ops, 16 ) == 7 );
+    ASSERT( ops[0].op == ENTITYTAINER_JournalAddEntity && ops[0].entity == 150 );
+    ASSERT( ops[1].op == ENTITYTAINER_JournalAddChild && ops[1].entity == 3 && ops[1].parent == 4 );
+    ASSERT( ops[2].op == ENTITYTAINER_JournalReparent && ops[2].entity == 101 );
+    ASSERT( ops[2].parent == 150 && ops[2].old_parent == 2 );
+    ASSERT( ops[3].op == ENTITYTAINER_JournalRemoveChild && ops[3].entity == 102 && ops[3].parent == 3 );
+    ASSERT( ops[4].op == ENTITYTAINER_JournalReparent && ops[4].entity == 103 && ops[4].parent == 150 );
+    ASSERT( ops[5].op == ENTITYTAINER_JournalRemoveChild && ops[5].entity == 104 );
+    ASSERT( ops[6].op == ENTITYTAINER_JournalAddChild && ops[6].entity == 250 && ops[6].parent == 3 );
+
+    // Applying them makes a the same as b.
+    entitytainer_apply_records( entitytainer_a, ops, 7 );
+    ASSERT( entitytainer_diff( entitytainer_a, entitytainer_b, ops, 16 ) == 0 );
+    ASSERT( entitytainer_num_children( entitytainer_a, 150 ) == 2 );
+    ASSERT( entitytainer_get_parent( entitytainer_a, 199 ) == 4 );
+
+    // A removed entity comes after its children, and its own parent, have let go of it.
+    entitytainer_remove_child_no_holes( entitytainer_b, 150, 101 );
+    entitytainer_remove_child_no_holes( entitytainer_b, 150, 103 );
+    entitytainer_remove_entity( entitytainer_b, 150 );
+    ASSERT( entitytainer_diff( entitytainer_a, entitytainer_b, ops, 16 ) == 4 );
+    ASSERT( ops[2].op == ENTITYTAINER_JournalRemoveChild && ops[2].entity == 150 && ops[2].parent == 3 );
+    ASSERT( ops[3].op == ENTITYTAINER_JournalRemoveEntity && ops[3].entity == 150 );
+    entitytainer_apply_records( entitytainer_a, ops, 4 );
+    ASSERT( entitytainer_diff( entitytainer_a, entitytainer_b, ops, 16 ) == 0 );
+    ASSERT( !entitytainer_is_added( entitytainer_a, 150 ) );
+
+    free( memory_a );
+    free( memory_b );
+}
+
+static void
+do_validate_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 128;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 16;
+    config.bucket_list_sizes[0]         = 32;
+    config.bucket_list_sizes[1]         = 8;
+    config.num_bucket_lists             = 2;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    for ( TheEntitytainerEntity entity = 1; entity < 10; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+        for ( TheEntitytainerEntity child = 0; child < entity; ++child ) {
+            entitytainer_add_child( entitytainer, entity, (TheEntitytainerEntity)( 20 + entity * 10 + child ) );
+        }
+    }
+
+    for ( TheEntitytainerEntity entity = 2; entity < 4; ++entity ) {
+        for ( TheEntitytainerEntity child = 0; child < entity; ++child ) {
+            TheEntitytainerEntity removed = (TheEntitytainerEntity)( 20 + entity * 10 + child );
+            entitytainer_remove_child_no_holes( entitytainer, entity, removed );
+        }
+
+        entitytainer_remove_entity( entitytainer, entity );
+    }
+
+    entitytainer_remove_child_no_holes( entitytainer, 5, 71 );
+
+    int                       scratch_size = entitytainer_validate_scratch_size( entitytainer );
+    void*                     scratch      = malloc( scratch_size );
+    TheEntitytainerValidation report;
+    ASSERT( entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.num_problems == 0 );
+
+    // A child that thinks it has another parent.
+    *entitytainer__parent( entitytainer, 72 ) = 6;
+    ASSERT( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.wrong_parents == 1 && report.num_problems == 1 && report.first_entity == 5 );
+    *entitytainer__parent( entitytainer, 72 ) = 5;
+
+    // The same child twice, and a count that's off.
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket =
+      entitytainer__get_bucket( entitytainer, *entitytainer__entry( entitytainer, 8 ), &bucket_list );
+    TheEntitytainerEntity second = bucket[2];
+    bucket[2]                    = bucket[1];
+    ASSERT( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.duplicate_children == 1 && report.wrong_parents == 1 && report.first_entity == 8 );
+    bucket[2] = second;
+    bucket[0]++;
+    ASSERT( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.wrong_counts == 1 );
+    bucket[0]--;
+
+    // A free list that loops back on itself, and buckets that went missing.
+    TheEntitytainerBucketList* list = &entitytainer->bucket_lists[0];
+    ASSERT( list->first_free_bucket != (int)ENTITYTAINER_NoFreeBucket );
+    TheEntitytainerEntity* free_bucket = entitytainer__bucket( list, list->first_free_bucket );
+    TheEntitytainerEntity  next        = *free_bucket;
+    *free_bucket                       = (TheEntitytainerEntity)list->first_free_bucket;
+    ASSERT( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.bad_free_lists == 1 && report.first_bucket_list == 0 );
+    *free_bucket = next;
+    ++list->used_buckets;
+    ASSERT( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.wrong_used_buckets == 1 && report.num_problems == 1 );
+    --list->used_buckets;
+
+    // An entry pointing at a free bucket.
+    TheEntitytainerEntry entry                = *entitytainer__entry( entitytainer, 9 );
+    *entitytainer__entry( entitytainer, 9 ) = entitytainer__make_entry( entitytainer, 0, list->first_free_bucket );
+    ASSERT( !entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.bad_entries == 1 && report.first_entity == 9 );
+    *entitytainer__entry( entitytainer, 9 ) = entry;
+    ASSERT( entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+
+    free( scratch );
+    free( config.memory );
+}
+
+#if ENTITYTAINER_CONCURRENT
+static void
+do_concurrent_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 8;
+    config.bucket_list_sizes[1]         = 4;
+    config.num_bucket_lists             = 2;
+    config.concurrent                   = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    for ( TheEntitytainerEntity entity = 1; entity <= 4; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    ASSERT( entitytainer->bucket_lists[0].next_bucket == 5 );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 5 );
+
+    // Growing past the first list frees its bucket onto the lock-free list, the change count goes up with each push
+    // and pop.
+    for ( TheEntitytainerEntity child = 10; child < 14; ++child ) {
+        entitytainer_add_child( entitytainer, 1, child );
+    }
+
+    TheEntitytainerBucketList* list = &entitytainer->bucket_lists[0];
+    ASSERT( ( list->free_head & 0xffffffffu ) == 1 );
+    ASSERT( ( list->free_head >> 32 ) == 1 );
+    ASSERT( list->used_buckets == 4 );
+
+    entitytainer_add_entity( entitytainer, 5 );
+    ASSERT( ( entitytainer->entry_lookup[5] & entitytainer->bucket_mask ) == 1 );
+    ASSERT( ( list->free_head & 0xffffffffu ) == ENTITYTAINER_NoFreeBucket );
+    ASSERT( ( list->free_head >> 32 ) == 2 );
+
+    // And back down again when the children go.
+    for ( TheEntitytainerEntity child = 10; child < 14; ++child ) {
+        entitytainer_remove_child_no_holes( entitytainer, 1, child );
+    }
+
+    ASSERT( ( entitytainer->entry_lookup[1] >> entitytainer->bucket_list_offset ) == 0 );
+    ASSERT( ( entitytainer->entry_lookup[1] & entitytainer->bucket_mask ) == 5 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 0 );
+    ASSERT( entitytainer_num_children( entitytainer, 1 ) == 0 );
+
+    free( config.memory );
+}
+
+static void
+do_thread_cache_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 64;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_list_sizes[0]         = 32;
+    config.bucket_list_sizes[1]         = 16;
+    config.num_bucket_lists             = 2;
+    config.concurrent                   = true;
+    config.thread_bucket_caches         = true;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    // A batch is claimed at once and counted as used, handed out lowest first.
+    entitytainer_add_entity( entitytainer, 1 );
+    entitytainer_add_entity( entitytainer, 2 );
+    ASSERT( ( entitytainer->entry_lookup[1] & entitytainer->bucket_mask ) == 1 );
+    ASSERT( ( entitytainer->entry_lookup[2] & entitytainer->bucket_mask ) == 2 );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 1 + ENTITYTAINER_BucketCacheBatch );
+
+    // Freed buckets stay with the thread and come straight back.
+    for ( TheEntitytainerEntity child = 10; child < 14; ++child ) {
+        entitytainer_add_child( entitytainer, 1, child );
+    }
+
+    ASSERT( ( entitytainer->bucket_lists[0].free_head & 0xffffffffu ) == ENTITYTAINER_NoFreeBucket );
+    entitytainer_add_entity( entitytainer, 3 );
+    ASSERT( ( entitytainer->entry_lookup[3] & entitytainer->bucket_mask ) == 1 );
+
+    // Filling the cache gives a batch back to the shared list.
+    for ( TheEntitytainerEntity entity = 20; entity < 40; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+    }
+
+    for ( TheEntitytainerEntity entity = 20; entity < 40; ++entity ) {
+        entitytainer_remove_entity( entitytainer, entity );
+    }
+
+    ASSERT( ( entitytainer->bucket_lists[0].free_head & 0xffffffffu ) != ENTITYTAINER_NoFreeBucket );
+
+    // Exact again after a flush: the entities 1 (in the second list), 2 and 3, plus the reserved bucket.
+    entitytainer_flush_thread_caches( entitytainer );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 3 );
+    ASSERT( entitytainer->bucket_lists[1].used_buckets == 1 );
+    ASSERT( entitytainer_num_children( entitytainer, 1 ) == 4 );
+
+    entitytainer_add_entity( entitytainer, 4 );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 3 + ENTITYTAINER_BucketCacheBatch );
+    entitytainer_flush_thread_caches( entitytainer );
+    ASSERT( entitytainer->bucket_lists[0].used_buckets == 4 );
+
+    free( config.memory );
+}
+
+#define STRESS_NUM_THREADS 8
+#define STRESS_NUM_PARENTS 4
+#define STRESS_NUM_CHILDREN 24
+#define STRESS_NUM_ROUNDS 200
+
+// Each thread works on its own parents and children, which is all concurrent asks for, but they all share the
+// bucket lists. Children come and go so the parents keep moving between lists, freeing and taking buckets. With
+// thread caches, some threads also flush along the way so batches go back and forth between them.
+typedef struct {
+    TheEntitytainer*      entitytainer;
+    TheEntitytainerEntity first_entity;
+    int                   flush_interval;
+} StressThread;
+
+static TheEntitytainerEntity
+stress_parent( const StressThread* thread, int i_parent ) {
+    return (TheEntitytainerEntity)( thread->first_entity + i_parent * ( STRESS_NUM_CHILDREN + 1 ) );
+}
+
+static int
+stress_final_children( int i_parent ) {
+    return ( i_parent * 7 ) % STRESS_NUM_CHILDREN;
+}
+
+static void
+stress_thread_run( StressThread* thread ) {
+    TheEntitytainer* entitytainer = thread->entitytainer;
+    for ( int i_parent = 0; i_parent < STRESS_NUM_PARENTS; ++i_parent ) {
+        entitytainer_add_entity( entitytainer, stress_parent( thread, i_parent ) );
+    }
+
+    for ( int round = 0; round <= STRESS_NUM_ROUNDS; ++round ) {
+        for ( int i_parent = 0; i_parent < STRESS_NUM_PARENTS; ++i_parent ) {
+            TheEntitytainerEntity parent       = stress_parent( thread, i_parent );
+            int                   num_children = round == STRESS_NUM_ROUNDS
+                                                   ? stress_final_children( i_parent )
+                                                   : 1 + ( round * 5 + i_parent * 3 ) % STRESS_NUM_CHILDREN;
+            for ( int i_child = 1; i_child <= num_children; ++i_child ) {
+                entitytainer_add_child( entitytainer, parent, (TheEntitytainerEntity)( parent + i_child ) );
+            }
+
+            ASSERT( entitytainer_num_children( entitytainer, parent ) == num_children );
+            if ( round == STRESS_NUM_ROUNDS ) {
+                continue;
+            }
+
+            // From both ends, so the children in between are moved down too.
+            for ( int i_child = 1; i_child <= num_children; ++i_child ) {
+                int offset = i_child % 2 == 0 ? i_child / 2 : num_children - i_child / 2;
+                entitytainer_remove_child_no_holes( entitytainer, parent, (TheEntitytainerEntity)( parent + offset ) );
+            }
+
+            ASSERT( entitytainer_num_children( entitytainer, parent ) == 0 );
+        }
+
+        if ( thread->flush_interval > 0 && round % thread->flush_interval == 0 ) {
+            entitytainer_flush_thread_caches( entitytainer );
+        }
+    }
+
+    if ( entitytainer->config.thread_bucket_caches ) {
+        entitytainer_flush_thread_caches( entitytainer );
+    }
+}
+
+#if defined( _WIN32 )
+static DWORD WINAPI
+stress_thread_main( LPVOID data ) {
+    stress_thread_run( (StressThread*)data );
+    return 0;
+}
+#else
+static void*
+stress_thread_main( void* data ) {
+    stress_thread_run( (StressThread*)data );
+    return NULL;
+}
+#endif
+
+static void
+do_threaded_tests( bool thread_bucket_caches ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 1024;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 8;
+    config.bucket_sizes[2]              = 16;
+    config.bucket_sizes[3]              = 32;
+    config.bucket_list_sizes[0]         = 192;
+    config.bucket_list_sizes[1]         = 192;
+    config.bucket_list_sizes[2]         = 192;
+    config.bucket_list_sizes[3]         = 192;
+    config.num_bucket_lists             = 4;
+    config.concurrent                   = true;
+    config.thread_bucket_caches         = thread_bucket_caches;
+    int needed_memory_size              = entitytainer_needed_size( &config );
+    config.memory                       = malloc( needed_memory_size );
+    config.memory_size                  = needed_memory_size;
+    TheEntitytainer* entitytainer       = entitytainer_create( &config );
+
+    StressThread threads[STRESS_NUM_THREADS];
+    for ( int i = 0; i < STRESS_NUM_THREADS; ++i ) {
+        int first_entity          = 1 + i * STRESS_NUM_PARENTS * ( STRESS_NUM_CHILDREN + 1 );
+        threads[i].entitytainer   = entitytainer;
+        threads[i].first_entity   = (TheEntitytainerEntity)first_entity;
+        threads[i].flush_interval = thread_bucket_caches && i % 2 == 1 ? 16 : 0;
+    }
+
+#if defined( _WIN32 )
+    HANDLE handles[STRESS_NUM_THREADS];
+    for ( int i = 0; i < STRESS_NUM_THREADS; ++i ) {
+        handles[i] = CreateThread( NULL, 0, stress_thread_main, &threads[i], 0, NULL );
+    }
+
+    WaitForMultipleObjects( STRESS_NUM_THREADS, handles, TRUE, INFINITE );
+    for ( int i = 0; i < STRESS_NUM_THREADS; ++i ) {
+        CloseHandle( handles[i] );
+    }
+#else
+    pthread_t handles[STRESS_NUM_THREADS];
+    for ( int i = 0; i < STRESS_NUM_THREADS; ++i ) {
+        pthread_create( &handles[i], NULL, stress_thread_main, &threads[i] );
+    }
+
+    for ( int i = 0; i < STRESS_NUM_THREADS; ++i ) {
+        pthread_join( handles[i], NULL );
+    }
+#endif
+
+    for ( int i = 0; i < STRESS_NUM_THREADS; ++i ) {
+        for ( int i_parent = 0; i_parent < STRESS_NUM_PARENTS; ++i_parent ) {
+            TheEntitytainerEntity parent       = stress_parent( &threads[i], i_parent );
+            int                   num_children = stress_final_children( i_parent );
+            ASSERT( entitytainer_num_children( entitytainer, parent ) == num_children );
+            for ( int i_child = 1; i_child <= num_children; ++i_child ) {
+                TheEntitytainerEntity child = (TheEntitytainerEntity)( parent + i_child );
+                ASSERT( entitytainer_get_parent( entitytainer, child ) == parent );
+            }
+        }
+    }
+
+    // Every parent has a bucket, plus the reserved one. Exact with thread caches too, since every thread flushed.
+    int used_buckets = 0;
+    for ( int i = 0; i < config.num_bucket_lists; ++i ) {
+        used_buckets += entitytainer->bucket_lists[i].used_buckets;
+    }
+
+    ASSERT( used_buckets == 1 + STRESS_NUM_THREADS * STRESS_NUM_PARENTS );
+
+    int                       scratch_size = entitytainer_validate_scratch_size( entitytainer );
+    void*                     scratch      = malloc( scratch_size );
+    TheEntitytainerValidation report;
+    ASSERT( entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+    ASSERT( report.num_problems == 0 );
+
+    free( scratch );
+    free( config.memory );
+}
+#endif
+
+#if ENTITYTAINER_MMAP
+static void
+do_arena_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 4096;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 64;
+    config.bucket_list_sizes[0]         = 16000;
+    config.bucket_list_sizes[1]         = 1000;
+    config.num_bucket_lists             = 2;
+    config.remove_with_holes            = true;
+    TheEntitytainer* entitytainer       = entitytainer_create_arena( &config, false );
+    ASSERT( entitytainer->bucket_lists[0].committed_buckets == 0 );
+
+    // Only a chunk of buckets is committed, the rest of the reservation stays untouched.
+    for ( TheEntitytainerEntity entity = 1; entity < 100; ++entity ) {
+        entitytainer_add_entity( entitytainer, entity );
+        entitytainer_add_child( entitytainer, entity, 1000 + entity );
+    }
+
+    ASSERT( entitytainer->bucket_lists[0].committed_buckets >= 100 );
+    ASSERT( entitytainer->bucket_lists[0].committed_buckets < 16000 );
+    ASSERT( entitytainer->bucket_lists[1].committed_buckets == 0 );
+
+    // Moving to the next list commits its first chunk.
+    for ( TheEntitytainerEntity child = 2000; child < 2010; ++child ) {
+        entitytainer_add_child( entitytainer, 1, child );
+    }
+
+    ASSERT( entitytainer->bucket_lists[1].committed_buckets > 0 );
+    ASSERT( entitytainer_num_children( entitytainer, 1 ) == 11 );
+    ASSERT( entitytainer_get_parent( entitytainer, 2009 ) == 1 );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( !loaded->arena );
+    ASSERT( loaded->bucket_lists[0].committed_buckets == 16000 );
+    for ( TheEntitytainerEntity entity = 2; entity < 100; ++entity ) {
+        ASSERT( entitytainer_get_parent( loaded, 1000 + entity ) == entity );
+    }
+
+    ASSERT( entitytainer_num_children( loaded, 1 ) == 11 );
+    entitytainer_add_entity( loaded, 200 );
+    entitytainer_add_child( loaded, 200, 201 );
+    ASSERT( entitytainer_get_parent( loaded, 201 ) == 200 );
+
+    entitytainer_destroy( entitytainer );
+    free( buffer );
+}
+#endif
+
+static void
+do_interleaved_tests( void ) {
+    struct TheEntitytainerConfig config = { 0 };
+    config.num_entries                  = 256;
+    config.bucket_sizes[0]              = 4;
+    config.bucket_sizes[1]              = 64;
+    config.bucket_list_sizes[0]         = 128;
+    config.bucket_list_sizes[1]         = 8;
+    config.num_bucket_lists             = 2;
+    config.num_channels                 = 2;
+    config.memory_size                  = entitytainer_needed_size( &config );
+    config.memory                       = malloc( config.memory_size );
+    TheEntitytainer* separate           = entitytainer_create( &config );
+    void*            memory_separate    = config.memory;
+
+    config.interleaved_lookups          = true;
+    int              interleaved_size   = entitytainer_needed_size( &config );
+    config.memory_size                  = interleaved_size;
+    config.memory                       = malloc( interleaved_size );
+    TheEntitytainer* interleaved        = entitytainer_create( &config );
+    void*            memory_interleaved = config.memory;
+    config.memory                       = malloc( interleaved_size );
+    TheEntitytainer* interleaved_b      = entitytainer_create( &config );
+
+    // Both channels' entries, then both channels' parents, in one record per entity.
+    unsigned char* record = (unsigned char*)interleaved->entry_lookup;
+    ASSERT( interleaved->entry_stride == 2 * sizeof( TheEntitytainerEntry ) + 2 * sizeof( TheEntitytainerEntity ) );
+    ASSERT( interleaved->parent_stride == interleaved->entry_stride );
+    ASSERT( (unsigned char*)interleaved->entry_parent_lookup == record + 2 * sizeof( TheEntitytainerEntry ) );
+    ASSERT( (unsigned char*)entitytainer_get_channel( interleaved, 1 )->entry_lookup ==
+            record + sizeof( TheEntitytainerEntry ) );
+
+    // The same changes give the same hierarchies in either layout.
+    TheEntitytainer* entitytainers[2] = { separate, interleaved };
+    for ( int i = 0; i < 2; ++i ) {
+        for ( int channel = 0; channel < 2; ++channel ) {
+            TheEntitytainer* entitytainer = entitytainer_get_channel( entitytainers[i], channel );
+            for ( TheEntitytainerEntity entity = 1; entity < 5; ++entity ) {
+                entitytainer_add_entity( entitytainer, entity );
+            }
+
+            for ( TheEntitytainerEntity child = 100; child < 160; ++child ) {
+                entitytainer_add_child( entitytainer, (TheEntitytainerEntity)( 1 + ( child + channel ) % 4 ), child );
+            }
+
+            entitytainer_reparent( entitytainer, 101, 4 );
+            entitytainer_remove_child_no_holes( entitytainer, entitytainer_get_parent( entitytainer, 102 ), 102 );
+            entitytainer_add_child( entitytainer, 3, 255 );
+        }
+    }
+
+    for ( int channel = 0; channel < 2; ++channel ) {
+        TheEntitytainer* channel_separate    = entitytainer_get_channel( separate, channel );
+        TheEntitytainer* channel_interleaved = entitytainer_get_channel( interleaved, channel );
+        for ( int i = 0; i < 256; ++i ) {
+            TheEntitytainerEntity entity = (TheEntitytainerEntity)i;
+            ASSERT( entitytainer_get_parent( channel_separate, entity ) ==
+                    entitytainer_get_parent( channel_interleaved, entity ) );
+            ASSERT( entitytainer_is_added( channel_separate, entity ) ==
+                    entitytainer_is_added( channel_interleaved, entity ) );
+        }
+
+        for ( TheEntitytainerEntity parent = 1; parent < 5; ++parent ) {
+            TheEntitytainerEntity* children_separate;
+            TheEntitytainerEntity* children_interleaved;
+            int                    num_separate, num_interleaved, capacity;
+            entitytainer_get_children( channel_separate, parent, &children_separate, &num_separate, &capacity );
+            entitytainer_get_children(
+              channel_interleaved, parent, &children_interleaved, &num_interleaved, &capacity );
+            ASSERT( num_separate == num_interleaved );
+            ASSERT( memcmp( children_separate, children_interleaved, num_separate * sizeof( TheEntitytainerEntity ) ) ==
+                    0 );
+        }
+    }
+
+    ASSERT( entitytainer_get_parent( interleaved, 255 ) == 3 );
+    ASSERT( entitytainer_get_parent( entitytainer_get_channel( interleaved, 1 ), 101 ) == 4 );
+    ASSERT( entitytainer_get_parent( interleaved, 102 ) == 0 );
+
+    int                       scratch_size = entitytainer_validate_scratch_size( interleaved );
+    void*                     scratch      = malloc( scratch_size );
+    TheEntitytainerValidation report;
+    ASSERT( entitytainer_validate( interleaved, &report, scratch, scratch_size ) );
+
+    // load_into converts from the separate layout, and diff steps over the other channel and the parents.
+    entitytainer_load_into( interleaved_b, separate );
+    TheEntitytainerJournalRecord ops[4];
+    ASSERT( entitytainer_diff( interleaved, interleaved_b, ops, 4 ) == 0 );
+    entitytainer_reparent( entitytainer_get_channel( interleaved_b, 1 ), 255, 2 );
+    ASSERT( entitytainer_diff( interleaved, interleaved_b, ops, 4 ) == 0 );
+    ASSERT( entitytainer_diff(
+              entitytainer_get_channel( interleaved, 1 ), entitytainer_get_channel( interleaved_b, 1 ), ops, 4 ) == 1 );
+    ASSERT( ops[0].op == ENTITYTAINER_JournalReparent && ops[0].entity == 255 && ops[0].channel == 1 );
+    ASSERT( ops[0].parent == 2 && ops[0].old_parent == 3 );
+    entitytainer_remove_child_no_holes( interleaved_b, 3, 255 );
+    entitytainer_add_entity( interleaved_b, 200 );
+    ASSERT( entitytainer_diff( interleaved, interleaved_b, ops, 4 ) == 2 );
+    ASSERT( ops[0].op == ENTITYTAINER_JournalAddEntity && ops[0].entity == 200 );
+    ASSERT( ops[1].op == ENTITYTAINER_JournalRemoveChild && ops[1].entity == 255 && ops[1].parent == 3 );
+
+    // Saved and loaded as it is.
+    int            buffer_size = entitytainer_save( interleaved, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( interleaved, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( loaded->config.interleaved_lookups );
+    ASSERT( loaded->entry_stride == interleaved->entry_stride );
+    ASSERT( entitytainer_get_parent( loaded, 255 ) == 3 );
+    ASSERT( entitytainer_get_parent( entitytainer_get_channel( loaded, 1 ), 101 ) == 4 );
+    ASSERT( entitytainer_num_children( entitytainer_get_channel( loaded, 1 ), 4 ) ==
+            entitytainer_num_children( entitytainer_get_channel( interleaved, 1 ), 4 ) );
+    ASSERT( entitytainer_validate( loaded, &report, scratch, scratch_size ) );
+
+    free( buffer );
+    free( scratch );
+    free( interleaved_b->config.memory );
+    free( memory_interleaved );
+    free( memory_separate );
+}
+
+static void
+do_deep_tier_tests( void ) {
+    int                          bucket_sizes[8] = { 2, 4, 8, 16, 32, 64, 128, 512 };
+    struct TheEntitytainerConfig config          = { 0 };
+    config.num_entries                           = 1024;
+    config.num_bucket_lists                      = 8;
+    for ( int i = 0; i < 8; ++i ) {
+        config.bucket_sizes[i]      = bucket_sizes[i];
+        config.bucket_list_sizes[i] = 4;
+    }
+
+    config.memory_size            = entitytainer_needed_size( &config );
+    config.memory                 = malloc( config.memory_size );
+    TheEntitytainer* entitytainer = entitytainer_create( &config );
+
+    // Eight lists take three bits of an entry.
+    ASSERT( entitytainer->bucket_list_offset == ENTITYTAINER_EntryBits - 3 );
+    ASSERT( entitytainer->bucket_mask == ( 1 << ( ENTITYTAINER_EntryBits - 3 ) ) - 1 );
+
+    // A parent goes through every tier on the way up, and back down again.
+    entitytainer_add_entity( entitytainer, 1 );
+    for ( int i = 0; i < 500; ++i ) {
+        entitytainer_add_child( entitytainer, 1, (TheEntitytainerEntity)( 2 + i ) );
+        int tier = 0;
+        while ( bucket_sizes[tier] - 1 < i + 1 ) {
+            ++tier;
+        }
+
+        ASSERT( (int)( *entitytainer__entry( entitytainer, 1 ) >> entitytainer->bucket_list_offset ) == tier );
+    }
+
+    ASSERT( *entitytainer__entry( entitytainer, 1 ) >> entitytainer->bucket_list_offset == 7 );
+    ASSERT( entitytainer_num_children( entitytainer, 1 ) == 500 );
+    ASSERT( entitytainer_get_parent( entitytainer, 501 ) == 1 );
+
+    int                       scratch_size = entitytainer_validate_scratch_size( entitytainer );
+    void*                     scratch      = malloc( scratch_size );
+    TheEntitytainerValidation report;
+    ASSERT( entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+
+    int            buffer_size = entitytainer_save( entitytainer, NULL, 0 );
+    unsigned char* buffer      = malloc( buffer_size );
+    entitytainer_save( entitytainer, buffer, buffer_size );
+    TheEntitytainer* loaded = entitytainer_load( buffer, buffer_size );
+    ASSERT( loaded->bucket_list_offset == entitytainer->bucket_list_offset );
+    ASSERT( *entitytainer__entry( loaded, 1 ) >> loaded->bucket_list_offset == 7 );
+    ASSERT( entitytainer_num_children( loaded, 1 ) == 500 );
+    ASSERT( entitytainer_get_parent( loaded, 300 ) == 1 );
+
+    for ( int i = 499; i >= 0; --i ) {
+        entitytainer_remove_child_no_holes( entitytainer, 1, (TheEntitytainerEntity)( 2 + i ) );
+        int tier = 0;
+        while ( bucket_sizes[tier] - 1 < i ) {
+            ++tier;
+        }
+
+        ASSERT( (int)( *entitytainer__entry( entitytainer, 1 ) >> entitytainer->bucket_list_offset ) == tier );
+    }
+
+    // Reserving skips the tiers in between.
+    entitytainer_add_entity( entitytainer, 600 );
+    entitytainer_reserve( entitytainer, 600, 100 );
+    ASSERT( *entitytainer__entry( entitytainer, 600 ) >> entitytainer->bucket_list_offset == 6 );
+    ASSERT( entitytainer_validate( entitytainer, &report, scratch, scratch_size ) );
+
+    free( buffer );
+    free( scratch );
+    free( config.memory );
+
+    // Two lists only need one bit, leaving the rest for the buckets.
+    config.num_bucket_lists = 2;
+    config.memory_size      = entitytainer_needed_size( &config );
+    config.memory           = malloc( config.memory_size );
+    entitytainer            = entitytainer_create( &config );
+    // Up to 30 bits, so a bucket index still fits in an int.
+    int bucket_bits = ENTITYTAINER_EntryBits - 1 < 30 ? ENTITYTAINER_EntryBits - 1 : 30;
+    ASSERT( entitytainer->bucket_list_offset == bucket_bits );
+    entitytainer_add_entity( entitytainer, 1 );
+    for ( int i = 0; i < 3; ++i ) {
+        entitytainer_add_child( entitytainer, 1, (TheEntitytainerEntity)( 2 + i ) );
+    }
+
+    ASSERT( *entitytainer__entry( entitytainer, 1 ) >> entitytainer->bucket_list_offset == 1 );
+    free( config.memory );
+}
+
 static void
 unittest_run_base( UnitTestData* testdata ) {
     testdata->num_tests = 0;
@@ -502,7 +2393,7 @@ unittest_run_base( UnitTestData* testdata ) {
     config.bucket_sizes[0]              = 4;
     config.bucket_sizes[1]              = 8;
     config.bucket_sizes[2]              = 16;
-    config.bucket_list_sizes[0]         = 4;
+    config.bucket_list_sizes[0]         = 8;
     config.bucket_list_sizes[1]         = 2;
     config.bucket_list_sizes[2]         = 2;
     config.num_bucket_lists             = 3;
@@ -546,6 +2437,35 @@ unittest_run_base( UnitTestData* testdata ) {
     do_save_load_test( entitytainer );
 
     do_save_load_upgrade_test();
+    do_ancestry_tests();
+    do_preorder_tests();
+    do_dirty_tests();
+    do_reparent_tests();
+    do_remove_subtree_tests();
+    do_sorted_children_tests();
+    do_child_slot_tests();
+    do_channel_tests();
+    do_dag_tests();
+    do_payload_tests();
+    do_growth_tests();
+    do_growth_payload_tests();
+    do_paged_tests();
+    do_lowest_free_tests();
+    do_snapshot_tests();
+    do_journal_tests();
+    do_diff_tests();
+    do_validate_tests();
+    do_interleaved_tests();
+    do_deep_tier_tests();
+#if ENTITYTAINER_MMAP
+    do_arena_tests();
+#endif
+#if ENTITYTAINER_CONCURRENT
+    do_concurrent_tests();
+    do_thread_cache_tests();
+    do_threaded_tests( false );
+    do_threaded_tests( true );
+#endif
 
     printf( "Run errors found:   %u/%u\n", testdata->error_index, testdata->num_tests );
 
@@ -0,0 +1,181 @@
+/*
+unittest_cpp.cpp - tests for the C++17 front end, the_entitytainer.hpp
+
+Checks that the wrapper's constant layout still matches what the C code builds, so a layout change in
+the_entitytainer.h that the wrapper doesn't follow fails here. The C implementation is compiled by
+unittest_cpp_impl.c.
+
+*/
+
+#pragma warning( disable : 4710 ) // printf not inlined - I don't care. :)
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" void unittest_cpp_assert( bool test );
+
+#define ASSERT unittest_cpp_assert
+#define ENTITYTAINER_assert( condition, ... ) unittest_cpp_assert( condition )
+
+#pragma warning( disable : 4464 ) // Include with ".."
+#include "../../the_entitytainer.hpp"
+
+static unsigned g_num_tests;
+static unsigned g_num_errors;
+
+extern "C" void
+unittest_cpp_assert( bool test ) {
+    ++g_num_tests;
+    if ( !test ) {
+        ++g_num_errors;
+    }
+}
+
+using Hierarchy = entitytainer::Entitytainer<TheEntitytainerEntity,
+                                             TheEntitytainerEntry,
+                                             1024,
+                                             entitytainer::Tier<4, 256>,
+                                             entitytainer::Tier<16, 32>,
+                                             entitytainer::Tier<256, 4>>;
+
+// Bucket sizes that aren't powers of two take the multiply path.
+using OddHierarchy = entitytainer::Entitytainer<TheEntitytainerEntity,
+                                                TheEntitytainerEntry,
+                                                256,
+                                                entitytainer::Tier<3, 64>,
+                                                entitytainer::Tier<10, 16>,
+                                                entitytainer::Tier<100, 2>>;
+
+static entitytainer::Storage<Hierarchy>    g_storage;
+static entitytainer::Storage<OddHierarchy> g_odd_storage;
+
+template<typename THierarchy>
+static void
+do_needed_size_tests( void* memory, int memory_size ) {
+    TheEntitytainerConfig config = THierarchy::config( memory, memory_size );
+    ASSERT( THierarchy::needed_size == entitytainer_needed_size( &config ) );
+}
+
+template<typename THierarchy>
+static void
+do_children_tests( THierarchy& hierarchy ) {
+    hierarchy.add_entity( 3 );
+    hierarchy.add_entity( 4 );
+    ASSERT( hierarchy.is_added( 3 ) );
+    ASSERT( !hierarchy.is_added( 5 ) );
+    ASSERT( hierarchy.children( 3 ).empty() );
+
+    // Enough children to go through all the tiers.
+    for ( TheEntitytainerEntity child = 10; child < 50; ++child ) {
+        hierarchy.add_child( 3, child );
+    }
+
+    int                   count    = 0;
+    TheEntitytainerEntity expected = 10;
+    for ( TheEntitytainerEntity child : hierarchy.children( 3 ) ) {
+        ASSERT( child == expected++ );
+        ++count;
+    }
+
+    ASSERT( count == 40 );
+    ASSERT( hierarchy.num_children( 3 ) == 40 );
+    ASSERT( hierarchy.children( 3 ).size() == 40 );
+    ASSERT( hierarchy.parent( 15 ) == 3 );
+    ASSERT( hierarchy.parent( 4 ) == 0 );
+
+    // Reads agree with the C API on the same data.
+    TheEntitytainerEntity* children;
+    int                    num_children;
+    int                    capacity;
+    entitytainer_get_children( hierarchy.get(), 3, &children, &num_children, &capacity );
+    ASSERT( num_children == 40 );
+    ASSERT( hierarchy.children( 3 ).begin() == children );
+    ASSERT( hierarchy.slots( 3 ).size() == capacity );
+
+    hierarchy.reparent( 15, 4 );
+    ASSERT( hierarchy.parent( 15 ) == 4 );
+    ASSERT( hierarchy.num_children( 3 ) == 39 );
+    ASSERT( hierarchy.children( 4 ).size() == 1 && hierarchy.children( 4 )[0] == 15 );
+
+    hierarchy.remove_child( 4, 15 );
+    ASSERT( hierarchy.parent( 15 ) == 0 );
+    ASSERT( hierarchy.children( 4 ).empty() );
+}
+
+static void
+do_slots_tests() {
+    // Holes need the slot bits too, so it's created by the C API with room for them.
+    TheEntitytainerConfig config = Hierarchy::config( NULL, 0 );
+    config.remove_with_holes     = true;
+    config.memory_size           = entitytainer_needed_size( &config );
+    config.memory                = malloc( config.memory_size );
+    Hierarchy hierarchy( entitytainer_create( &config ) );
+
+    hierarchy.add_entity( 1 );
+    for ( TheEntitytainerEntity child = 2; child < 7; ++child ) {
+        hierarchy.add_child( 1, child );
+    }
+
+    hierarchy.remove_child( 1, 3 );
+    ASSERT( hierarchy.parent( 3 ) == 0 );
+    ASSERT( hierarchy.num_children( 1 ) == 4 );
+
+    entitytainer::Children<TheEntitytainerEntity> slots = hierarchy.slots( 1 );
+    ASSERT( slots.size() == 15 );
+    ASSERT( slots[0] == 2 && slots[1] == ENTITYTAINER_InvalidEntity && slots[2] == 4 && slots[4] == 6 );
+    int found = 0;
+    for ( TheEntitytainerEntity child : slots ) {
+        if ( child != ENTITYTAINER_InvalidEntity ) {
+            ASSERT( hierarchy.parent( child ) == 1 );
+            ++found;
+        }
+    }
+
+    ASSERT( found == 4 );
+    free( config.memory );
+}
+
+static void
+do_save_load_tests() {
+    Hierarchy hierarchy( g_storage.memory, sizeof( g_storage.memory ) );
+    hierarchy.add_entity( 7 );
+    hierarchy.add_child( 7, 8 );
+    hierarchy.add_child( 7, 9 );
+
+    // Saved through the C API and wrapped again after loading.
+    int            buffer_size = entitytainer_save( hierarchy.get(), NULL, 0 );
+    unsigned char* buffer      = (unsigned char*)malloc( buffer_size );
+    entitytainer_save( hierarchy.get(), buffer, buffer_size );
+    Hierarchy loaded( entitytainer_load( buffer, buffer_size ) );
+    ASSERT( loaded.num_children( 7 ) == 2 );
+    ASSERT( loaded.children( 7 )[1] == 9 );
+    ASSERT( loaded.parent( 8 ) == 7 );
+    free( buffer );
+}
+
+int
+main( int argc, char** argv ) {
+    (void)( argc );
+    (void)( argv );
+
+    do_needed_size_tests<Hierarchy>( g_storage.memory, sizeof( g_storage.memory ) );
+    do_needed_size_tests<OddHierarchy>( g_odd_storage.memory, sizeof( g_odd_storage.memory ) );
+
+    Hierarchy hierarchy( g_storage.memory, sizeof( g_storage.memory ) );
+    do_children_tests( hierarchy );
+    OddHierarchy odd_hierarchy( g_odd_storage.memory, sizeof( g_odd_storage.memory ) );
+    do_children_tests( odd_hierarchy );
+
+    do_slots_tests();
+    do_save_load_tests();
+
+    printf( "Run errors found:   %u/%u\n", g_num_errors, g_num_tests );
+    printf( "\n" );
+    if ( g_num_errors == 0 ) {
+        printf( "No errors found, YAY!\n" );
+    }
+    else {
+        printf( "U are teh sux.\n" );
+    }
+
+    return g_num_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+// The C implementation for unittest_cpp.cpp, the header is C99 so it's compiled as C.
+#include <stddef.h>
+
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+void unittest_cpp_assert( bool test );
+
+#define ENTITYTAINER_IMPLEMENTATION
+#define ENTITYTAINER_assert( condition, ... ) unittest_cpp_assert( condition )
+
+#pragma warning( disable : 4464 ) // Include with ".."
+#include "../../the_entitytainer.h"
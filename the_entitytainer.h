@@ -109,6 +109,38 @@ extern "C" {
 #define ENTITYTAINER_memset memset
 #endif
 
+#ifndef ENTITYTAINER_memmove
+#include <string.h>
+#define ENTITYTAINER_memmove memmove
+#endif
+
+#ifndef ENTITYTAINER_SSE2
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define ENTITYTAINER_SSE2 1
+#else
+#define ENTITYTAINER_SSE2 0
+#endif
+#endif
+
+// pshufb, for compressing children out of buckets with holes. Needs SSE2 as well.
+#ifndef ENTITYTAINER_SSSE3
+#if ENTITYTAINER_SSE2 && ( defined( __SSSE3__ ) || defined( __AVX__ ) )
+#define ENTITYTAINER_SSSE3 1
+#else
+#define ENTITYTAINER_SSSE3 0
+#endif
+#endif
+
+// Linux only, for entitytainer_create_arena. Strict C99 builds need _DEFAULT_SOURCE for MAP_ANONYMOUS.
+#ifndef ENTITYTAINER_MMAP
+#define ENTITYTAINER_MMAP 0
+#endif
+
+// Needs atomics from the compiler (GCC/Clang builtins or MSVC intrinsics), for config.concurrent.
+#ifndef ENTITYTAINER_CONCURRENT
+#define ENTITYTAINER_CONCURRENT 0
+#endif
+
 #ifndef ENTITYTAINER_alignof
 #define ENTITYTAINER_alignof( type ) \
     offsetof(                        \
@@ -127,13 +159,21 @@ typedef unsigned short TheEntitytainerEntity;
 
 #ifndef ENTITYTAINER_Entry
 typedef unsigned short TheEntitytainerEntry;
-#define ENTITYTAINER_BucketMask 0x3fff
-#define ENTITYTAINER_BucketListBitCount 2
-#define ENTITYTAINER_BucketListOffset ( sizeof( TheEntitytainerEntry ) * 8 - ENTITYTAINER_BucketListBitCount )
 #endif
 
+// An entry is the index of a bucket list in its top bits, as few as num_bucket_lists needs (but at least one), and the
+// index of a bucket in that list in the rest. See TheEntitytainer::bucket_list_offset.
+#define ENTITYTAINER_EntryBits ( (int)sizeof( TheEntitytainerEntry ) * 8 )
+
+typedef unsigned long long TheEntitytainerBitWord;
+#define ENTITYTAINER_BitWordBits 64
+
 #define ENTITYTAINER_NoFreeBucket ( (TheEntitytainerEntity)-1 )
 #define ENTITYTAINER_ShrinkMargin 1
+#define ENTITYTAINER_CommitChunkSize ( 64 * 1024 )
+#define ENTITYTAINER_BucketCacheSize 16
+#define ENTITYTAINER_BucketCacheBatch 8
+#define ENTITYTAINER_HugePageSize ( 2 * 1024 * 1024 )
 
 #if defined( ENTITYTAINER_STATIC )
 #define ENTITYTAINER_API static
@@ -151,6 +191,25 @@ typedef unsigned short TheEntitytainerEntry;
 #define ENTITYTAINER_DEFENSIVE_ASSERTS 0
 #endif
 
+// Allocates new_size bytes, or frees memory (of old_size bytes) when new_size is 0. The memory must be aligned for
+// pointers, like malloc's.
+typedef void* ( *TheEntitytainerAllocFunc )( void* user_data, void* memory, int old_size, int new_size );
+
+#define ENTITYTAINER_JournalAddEntity 1
+#define ENTITYTAINER_JournalRemoveEntity 2
+#define ENTITYTAINER_JournalAddChild 3
+#define ENTITYTAINER_JournalRemoveChild 4
+#define ENTITYTAINER_JournalReparent 5
+
+// One change to the hierarchy, see config.journal. Replaying them in order on a copy gives the same relations.
+typedef struct {
+    unsigned char         op;      // ENTITYTAINER_Journal*
+    unsigned char         channel; // Which of the config's num_channels relations changed
+    TheEntitytainerEntity entity;  // The child for the child ops and reparent
+    TheEntitytainerEntity parent;  // The new parent for reparent, ENTITYTAINER_InvalidEntity when it was detached
+    TheEntitytainerEntity old_parent; // Only for reparent
+} TheEntitytainerJournalRecord;
+
 struct TheEntitytainerConfig {
     void* memory;
     int   memory_size;
@@ -160,30 +219,233 @@ struct TheEntitytainerConfig {
     int   num_bucket_lists;
     bool  remove_with_holes;
     bool  keep_capacity_on_remove;
+
+    // Number of binary lifting levels to keep per entity for the ancestry index (depth, root and lowest common
+    // ancestor queries). 0 disables it. Each level doubles how far a single jump reaches, so 8 levels cover
+    // hierarchies up to 255 deep in one pass, deeper ones just take a few more jumps.
+    int ancestry_levels;
+
+    // Keep a pre-order linearization of all hierarchies, where every subtree is contiguous. It's rebuilt lazily when
+    // asked for after the hierarchy has changed.
+    bool preorder_index;
+
+    // Keep a dirty bit per entity, see entitytainer_mark_dirty_subtree.
+    bool dirty_tracking;
+
+    // Keep every parent's children sorted by entity, so finding and removing a child is a binary search. Can't be
+    // combined with remove_with_holes or entitytainer_add_child_at_index.
+    bool sorted_children;
+
+    // Number of independent relations (attachments, inventory, ...) kept in the same allocation, 0 means 1. They
+    // share the bucket lists, and an entity's lookups for all channels sit next to each other. Use
+    // entitytainer_get_channel to get the entitytainer for a channel. Can't be combined with the ancestry, pre-order
+    // or dirty tracking indices.
+    int num_channels;
+
+    // Let a child have several parents. The parents of a child are kept in buckets too, taken from the same bucket
+    // lists as the children, so entitytainer_get_parents gives them as one array. Can't be combined with the ancestry,
+    // pre-order or dirty tracking indices, nor with reparenting or removing subtrees.
+    bool multi_parent;
+
+    // Bytes of user data per child, e.g. a bone index or a stack count. Stored in a parallel array per bucket list,
+    // with the same layout as the children, and moved along with them. 0 means no payload.
+    int payload_size;
+
+    // Lets a bucket list that runs out of buckets grow instead, by doubling its size in memory from allocate. Only that
+    // list moves, the lookups and the other lists stay in place. Pointers into it (like the ones from
+    // entitytainer_get_children) become invalid when an add grows it, which bumps its generation. Call
+    // entitytainer_destroy to free the grown lists. Not saved, set it again after loading.
+    TheEntitytainerAllocFunc allocate;
+    void*                    allocate_user_data;
+
+    // Buckets per page, a power of 2, or 0 to keep each bucket list in one block. With pages, a full bucket list gets
+    // another page from allocate instead of moving, so pointers to buckets stay valid. The bucket_list_sizes have to
+    // be multiples of it, those first pages are in the main allocation.
+    int bucket_page_size;
+
+    // With bucket_page_size, the most buckets each bucket list can get pages for, or 0 to keep it at its
+    // bucket_list_sizes. The page tables are sized for these, clamped to what an entry can index.
+    int max_bucket_list_sizes[ENTITYTAINER_MAX_BUCKET_LISTS];
+
+    // Always hand out the lowest free bucket of a bucket list instead of the last one freed, so live buckets stay
+    // packed at the front and the end of each list stays untouched. Freed buckets are tracked in a two level bitmap
+    // per list rather than a free list threaded through the buckets.
+    bool lowest_free_bucket;
+
+    // Keep each entity's entry and parent next to each other in one array, instead of in two arrays of num_entries.
+    // Adding, removing and reparenting touch both for the same entity, so for scattered entities that's one cache miss
+    // instead of two. Saved images keep the layout they were saved with, and entitytainer_load_into converts.
+    bool interleaved_lookups;
+
+    // Lets several threads add and remove children at the same time, as long as each parent (and child) is only
+    // touched by one thread. Buckets are taken from a lock-free free list and bump index per bucket list, and entries
+    // are published atomically. Needs ENTITYTAINER_CONCURRENT. Can't be combined with allocate, lowest_free_bucket,
+    // multi_parent or the ancestry, pre-order and dirty tracking indices.
+    bool concurrent;
+
+    // With concurrent, each thread keeps a few free buckets per bucket list for itself, taken from and given back to
+    // the shared lists in batches, so most adds and removes don't touch shared memory. used_buckets counts the cached
+    // buckets as used until entitytainer_flush_thread_caches. A thread has to flush before it works on another
+    // entitytainer, and before the entitytainer is destroyed. Each thread can hold up to ENTITYTAINER_BucketCacheSize
+    // buckets of every list, so size the lists with some room for that.
+    bool thread_bucket_caches;
+
+    // A ring of journal_size records that every change (add and remove entity, add and remove child, reparent) is
+    // appended to, for replication, undo and the like. Read it with entitytainer_drain_journal. Changes that don't fit
+    // are counted and dropped. Only used by this instance, load clears it. Can't be combined with concurrent.
+    TheEntitytainerJournalRecord* journal;
+    int                           journal_size;
     // char  name[256];
 };
 
 typedef struct {
-    TheEntitytainerEntity* bucket_data;
-    int                    bucket_size;
-    int                    total_buckets;
-    int                    first_free_bucket;
-    int                    used_buckets;
+    TheEntitytainerEntity*  bucket_data;
+    TheEntitytainerBitWord* slot_bits;
+    unsigned char*          payload_data;
+    unsigned char*          memory; // From config.allocate, or NULL for the pages in the main allocation
+    int                     memory_size;
+    int                     generation; // The list's snapshot_generation when the page was made or copied
+} TheEntitytainerBucketPage;
+
+typedef struct {
+    TheEntitytainerEntity*  bucket_data;
+    TheEntitytainerBitWord* slot_bits;  // Only if remove_with_holes, slot_words per bucket, bit i is children[i]
+    int                     slot_words; // Words of slot_bits per bucket
+    TheEntitytainerBitWord* free_bits;  // Only if lowest_free_bucket, a bit per freed bucket, then one per nonzero word
+    int                     free_words; // Words of free_bits before the summary words
+    unsigned char*          payload_data; // Only if payload_size > 0, payload_size bytes per slot in bucket_data
+    unsigned char*          grown_memory; // Only if the list has grown, then it has all of the list's data. For a
+                                          // paged list only the free bitmap, once it outgrew the main allocation
+    int                     grown_memory_size;
+    int                     generation; // Bumped whenever the list grows and its buckets move
+    TheEntitytainerBucketPage* pages; // Only if bucket_page_size > 0, the data pointers above are the first pages
+    int                        page_shift;
+    int                        num_pages;
+    int                        num_inline_pages;
+    int                        committed_buckets; // Buckets that can be touched, fewer than total only in an arena
+    int                        snapshot_generation; // Pages from before it may be shared with a snapshot
+    const struct TheEntitytainerConfig* snapshot_config; // Only while a snapshot is held, to allocate page copies
+    int                     bucket_size;
+    int                     total_buckets;
+    int                     first_free_bucket;
+    int                     used_buckets;
+    unsigned long long      free_head;   // Only if concurrent, first free bucket in the low 32 bits, change count above
+    int                     next_bucket; // Only if concurrent, the bump index, as used_buckets is only a count then
 } TheEntitytainerBucketList;
 
 typedef struct {
     struct TheEntitytainerConfig config;
     TheEntitytainerEntry*        entry_lookup;
     TheEntitytainerEntity*       entry_parent_lookup;
+    TheEntitytainerEntry*        entry_parents_lookup; // Only if multi_parent, instead of entry_parent_lookup
+    TheEntitytainerEntity*       entry_depth_lookup;    // Only if ancestry_levels > 0
+    TheEntitytainerEntity*       entry_ancestor_lookup; // ancestry_levels entries per entity
+    int*                         entry_preorder_lookup; // Only if preorder_index, entity -> preorder index
+    TheEntitytainerEntity*       preorder_entities;
+    int*                         preorder_subtree_sizes;
+    int*                         preorder_parent_indices;
+    int                          preorder_count;
+    TheEntitytainerBitWord*      dirty_bits; // Only if dirty_tracking
     TheEntitytainerBucketList*   bucket_lists;
     int                          num_bucket_lists;
     int                          entry_lookup_size;
+    int                          entry_stride;       // Bytes between two entities' entries
+    int                          bucket_list_offset; // Entries are the bucket list index shifted up by this,
+    int                          bucket_mask;        // and the bucket index in the bits below it
+    int                          parent_stride; // Bytes between two entities' parents
+    int                          channel;
     bool                         remove_with_holes;
     bool                         keep_capacity_on_remove;
+    bool                         ancestry_dirty;
+    bool                         preorder_dirty;
+    bool                         arena;
+    bool                         huge_pages;
+    bool                         has_snapshot;
+    int                          journal_first; // Oldest record in config.journal
+    int                          journal_count;
+    int                          journal_dropped; // Records that didn't fit since the journal was last drained
 } TheEntitytainer;
 
+// What entitytainer_validate found, the number of problems of each kind.
+typedef struct {
+    int num_problems;
+    int bad_entries;        // Entries outside their bucket list, or at a bucket that's free or another entity's
+    int wrong_counts;       // Buckets whose count isn't the number of children in them
+    int duplicate_children; // Children in more than one slot
+    int wrong_parents;      // Children whose parent lookup isn't the parent they're in, or that aren't in it
+    int bad_free_lists;     // Free buckets outside the list, or free lists that loop
+    int wrong_used_buckets; // Lists where used_buckets isn't the number of buckets in use, or that lose buckets
+    // Where the first problem was. The entity is ENTITYTAINER_InvalidEntity and the list -1 when it wasn't about one.
+    TheEntitytainerEntity first_entity;
+    int                   first_bucket_list;
+} TheEntitytainerValidation;
+
 ENTITYTAINER_API int entitytainer_needed_size( struct TheEntitytainerConfig* config );
 ENTITYTAINER_API TheEntitytainer* entitytainer_create( struct TheEntitytainerConfig* config );
+// Frees the bucket lists that have grown with config.allocate. The memory passed to create is still yours.
+ENTITYTAINER_API void             entitytainer_destroy( TheEntitytainer* entitytainer );
+
+#if ENTITYTAINER_MMAP
+// Reserves address space for everything the config asks for and sets its memory and memory_size to it. Nothing is
+// cleared. The lookups and the other per-entity arrays only take memory where they're written, and each bucket list
+// commits its buckets as they're first used, so the config can be sized for the worst case. huge_pages asks for
+// transparent huge pages. Free with entitytainer_destroy. Can't be combined with allocate or bucket_page_size.
+ENTITYTAINER_API TheEntitytainer* entitytainer_create_arena( struct TheEntitytainerConfig* config, bool huge_pages );
+#endif
+
+#if ENTITYTAINER_CONCURRENT
+// Gives the calling thread's cached buckets back to the shared lists, see config.thread_bucket_caches. Call it at the
+// end of a job, after which used_buckets is exact again.
+ENTITYTAINER_API void entitytainer_flush_thread_caches( TheEntitytainer* entitytainer );
+#endif
+
+// Gives a read-only view of the entitytainer as it is now, e.g. for a render thread to read during a frame while the
+// simulation keeps changing the entitytainer. Needs bucket_page_size and allocate. The view shares the bucket pages,
+// and a page is copied the first time it's changed here afterwards. Reads don't copy, but getting payloads to write
+// through does. Changed buckets move like when a list grows. Taking a snapshot still copies every channel's entry and
+// parent lookups and the dirty bits, so it's O(num_entries * channels), plus the page tables. The ancestry and
+// pre-order indices aren't copied, the snapshot rebuilds them on its first query, which is O(num_entries) again.
+// One snapshot at a time, give it back with entitytainer_release_snapshot before taking another one or destroying the
+// entitytainer.
+ENTITYTAINER_API TheEntitytainer* entitytainer_snapshot( TheEntitytainer* entitytainer );
+ENTITYTAINER_API void entitytainer_release_snapshot( TheEntitytainer* entitytainer, TheEntitytainer* snapshot );
+
+// Moves up to max_records of the oldest records in config.journal to records, and gives how many. When that empties
+// the journal, num_dropped (which can be NULL) gets how many changes after them didn't fit, and 0 otherwise. If any
+// did, the records aren't enough to follow the hierarchy and it has to be read in full.
+ENTITYTAINER_API int entitytainer_drain_journal( TheEntitytainer*              entitytainer,
+                                                 TheEntitytainerJournalRecord* records,
+                                                 int                           max_records,
+                                                 int*                          num_dropped );
+
+// Writes the records that turn a into b to ops, at most max_ops of them, and gives how many there are: entities added
+// to b first, then the child links that differ as add child, remove child and reparent, then the entities removed
+// from b. The lookups of both are compared a block at a time, so the cost is mostly in how much differs. The order of
+// children under a parent isn't compared. Both need the same num_entries and num_channels, and not multi_parent.
+ENTITYTAINER_API int entitytainer_diff( TheEntitytainer*              entitytainer_a,
+                                        TheEntitytainer*              entitytainer_b,
+                                        TheEntitytainerJournalRecord* ops,
+                                        int                           max_ops );
+
+// Makes the changes in records from entitytainer_drain_journal or entitytainer_diff, in order. Payloads aren't in
+// the records, so added children get cleared ones.
+ENTITYTAINER_API void entitytainer_apply_records( TheEntitytainer*                    entitytainer,
+                                                  const TheEntitytainerJournalRecord* records,
+                                                  int                                 num_records );
+
+// Checks that the lookups, buckets and free lists agree, in time linear in entities plus buckets, and fills in report.
+// Returns true if nothing was wrong. scratch is for bitsets of the entities and buckets seen, of at least
+// entitytainer_validate_scratch_size bytes, aligned like a pointer. With multi_parent, children in several buckets are
+// expected, so children and parents aren't matched up. Not while other threads change the entitytainer.
+ENTITYTAINER_API int  entitytainer_validate_scratch_size( TheEntitytainer* entitytainer );
+ENTITYTAINER_API bool entitytainer_validate( TheEntitytainer*           entitytainer,
+                                             TheEntitytainerValidation* report,
+                                             void*                      scratch,
+                                             int                        scratch_size );
+
+// Gives the entitytainer for one of the config's num_channels relations. Channel 0 is the one returned by create and
+// load, which is also the one to save and reallocate.
+ENTITYTAINER_API TheEntitytainer* entitytainer_get_channel( TheEntitytainer* entitytainer, int channel );
 
 ENTITYTAINER_API TheEntitytainer*
                  entitytainer_realloc( TheEntitytainer* entitytainer_old, void* memory, int memory_size, float growth );
@@ -196,6 +458,11 @@ ENTITYTAINER_API void entitytainer_reserve( TheEntitytainer* entitytainer, TheEn
 
 ENTITYTAINER_API void
                       entitytainer_add_child( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, TheEntitytainerEntity child );
+// Like entitytainer_add_child, and copies payload_size bytes from payload into the child's slot. NULL zeroes it.
+ENTITYTAINER_API void entitytainer_add_child_with_payload( TheEntitytainer*      entitytainer,
+                                                           TheEntitytainerEntity parent,
+                                                           TheEntitytainerEntity child,
+                                                           const void*           payload );
 ENTITYTAINER_API void entitytainer_add_child_at_index( TheEntitytainer*      entitytainer,
                                                        TheEntitytainerEntity parent,
                                                        TheEntitytainerEntity child,
@@ -207,11 +474,39 @@ ENTITYTAINER_API void entitytainer_remove_child_with_holes( TheEntitytainer*
                                                             TheEntitytainerEntity parent,
                                                             TheEntitytainerEntity child );
 
+// Moves child to new_parent (or detaches it if new_parent is 0). The child's parent goes straight from old to new.
+ENTITYTAINER_API void entitytainer_reparent( TheEntitytainer*      entitytainer,
+                                             TheEntitytainerEntity child,
+                                             TheEntitytainerEntity new_parent );
+// Moves children that all belong to old_parent, resizing each parent's bucket at most once.
+ENTITYTAINER_API void entitytainer_reparent_batch( TheEntitytainer*             entitytainer,
+                                                   TheEntitytainerEntity        old_parent,
+                                                   TheEntitytainerEntity        new_parent,
+                                                   const TheEntitytainerEntity* children,
+                                                   int                          num_children );
+// Removes root and everything below it, in post-order. Writes up to capacity of the removed entities to removed_out
+// and returns how many were removed in total.
+ENTITYTAINER_API int entitytainer_remove_subtree( TheEntitytainer*       entitytainer,
+                                                  TheEntitytainerEntity  root,
+                                                  TheEntitytainerEntity* removed_out,
+                                                  int                    capacity );
+
 ENTITYTAINER_API void entitytainer_get_children( TheEntitytainer*        entitytainer,
                                                  TheEntitytainerEntity   parent,
                                                  TheEntitytainerEntity** children,
                                                  int*                    num_children,
                                                  int*                    capacity );
+// Same as entitytainer_get_children, plus the payloads laid out like the children: children[i] has the payload_size
+// bytes at (unsigned char*)*payloads + i * payload_size.
+ENTITYTAINER_API void entitytainer_get_children_with_payload( TheEntitytainer*        entitytainer,
+                                                              TheEntitytainerEntity   parent,
+                                                              TheEntitytainerEntity** children,
+                                                              void**                  payloads,
+                                                              int*                    num_children,
+                                                              int*                    capacity );
+ENTITYTAINER_API void* entitytainer_get_child_payload( TheEntitytainer*      entitytainer,
+                                                       TheEntitytainerEntity parent,
+                                                       TheEntitytainerEntity child );
 ENTITYTAINER_API int  entitytainer_num_children( TheEntitytainer* entitytainer, TheEntitytainerEntity parent );
 ENTITYTAINER_API int  entitytainer_get_child_index( TheEntitytainer*      entitytainer,
                                                     TheEntitytainerEntity parent,
@@ -219,9 +514,74 @@ ENTITYTAINER_API int  entitytainer_get_child_index( TheEntitytainer*      entity
 ENTITYTAINER_API TheEntitytainerEntity entitytainer_get_parent( TheEntitytainer*      entitytainer,
                                                                 TheEntitytainerEntity child );
 
+// Only with multi_parent. entitytainer_get_parent gives the first of them.
+ENTITYTAINER_API void entitytainer_get_parents( TheEntitytainer*        entitytainer,
+                                                TheEntitytainerEntity   child,
+                                                TheEntitytainerEntity** parents,
+                                                int*                    num_parents );
+ENTITYTAINER_API int  entitytainer_num_parents( TheEntitytainer* entitytainer, TheEntitytainerEntity child );
+
+// Set operations on two parents' children. Require sorted_children. Write at most capacity entities to out, in order,
+// and return how many were written.
+ENTITYTAINER_API int entitytainer_intersect_children( TheEntitytainer*       entitytainer,
+                                                      TheEntitytainerEntity  parent_a,
+                                                      TheEntitytainerEntity  parent_b,
+                                                      TheEntitytainerEntity* out,
+                                                      int                    capacity );
+ENTITYTAINER_API int entitytainer_difference_children( TheEntitytainer*       entitytainer,
+                                                       TheEntitytainerEntity  parent_a,
+                                                       TheEntitytainerEntity  parent_b,
+                                                       TheEntitytainerEntity* out,
+                                                       int                    capacity );
+
 ENTITYTAINER_API bool entitytainer_is_added( TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+
+// Only with remove_with_holes. Gives the occupancy bitmap of the children from entitytainer_get_children, where bit i
+// is set if children[i] is a live child, so iteration can skip over holes a word at a time.
+ENTITYTAINER_API void entitytainer_get_child_slots( TheEntitytainer*               entitytainer,
+                                                    TheEntitytainerEntity          parent,
+                                                    const TheEntitytainerBitWord** slot_bits,
+                                                    int*                           num_words );
+// Copies the live children of parent to out without any holes, returns how many were copied. out needs room for
+// entitytainer_num_children entities. With ENTITYTAINER_SSSE3, 16 and 32 bit entities are compressed four slots at a
+// time with pshufb.
+ENTITYTAINER_API int entitytainer_copy_children_dense( TheEntitytainer*       entitytainer,
+                                                       TheEntitytainerEntity  parent,
+                                                       TheEntitytainerEntity* out );
 ENTITYTAINER_API void entitytainer_remove_holes( TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
 
+// Ancestry queries. Require ancestry_levels > 0 in the config.
+ENTITYTAINER_API int entitytainer_get_depth( TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+ENTITYTAINER_API TheEntitytainerEntity entitytainer_get_root( TheEntitytainer*      entitytainer,
+                                                              TheEntitytainerEntity entity );
+ENTITYTAINER_API bool                  entitytainer_is_ancestor( TheEntitytainer*      entitytainer,
+                                                                 TheEntitytainerEntity ancestor,
+                                                                 TheEntitytainerEntity entity );
+ENTITYTAINER_API TheEntitytainerEntity entitytainer_lowest_common_ancestor( TheEntitytainer*      entitytainer,
+                                                                            TheEntitytainerEntity entity_a,
+                                                                            TheEntitytainerEntity entity_b );
+
+// Pre-order linearization. Requires preorder_index in the config.
+// entities[i] is the i:th entity in pre-order, its subtree is [i, i + subtree_sizes[i]) and its parent is at
+// parent_indices[i], or -1 for roots. Roots are entities added with entitytainer_add_entity that have no parent.
+// The arrays are owned by the entitytainer and valid until the next change to the hierarchy.
+ENTITYTAINER_API void entitytainer_get_preorder( TheEntitytainer*              entitytainer,
+                                                 const TheEntitytainerEntity** entities,
+                                                 const int**                   subtree_sizes,
+                                                 const int**                   parent_indices,
+                                                 int*                          count );
+ENTITYTAINER_API int  entitytainer_get_preorder_index( TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+
+// Dirty tracking. Requires dirty_tracking in the config.
+// Marking stops at entities that are already dirty, since their descendants are dirty as well. To keep that true, a
+// child added to a dirty parent is marked dirty along with its subtree.
+// Consuming returns up to capacity dirty entities, parents before children, and clears them. Whatever didn't fit is
+// returned by the next call.
+ENTITYTAINER_API void entitytainer_mark_dirty_subtree( TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+ENTITYTAINER_API bool entitytainer_is_dirty( TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+ENTITYTAINER_API int
+entitytainer_consume_dirty( TheEntitytainer* entitytainer, TheEntitytainerEntity* dirty_out, int capacity );
+
 ENTITYTAINER_API int entitytainer_save( TheEntitytainer* entitytainer, unsigned char* buffer, int buffer_size );
 ENTITYTAINER_API TheEntitytainer* entitytainer_load( unsigned char* buffer, int buffer_size );
 ENTITYTAINER_API void             entitytainer_load_into( TheEntitytainer*       entitytainer_dst,
@@ -229,36 +589,476 @@ ENTITYTAINER_API void             entitytainer_load_into( TheEntitytainer*
 
 #ifdef ENTITYTAINER_IMPLEMENTATION
 
-static void* entitytainer__ptr_to_aligned_ptr( void* ptr, int align );
-static bool  entitytainer__child_in_bucket( TheEntitytainerEntity*     bucket,
-                                            TheEntitytainerBucketList* bucket_list,
-                                            TheEntitytainerEntity      child );
+#if ENTITYTAINER_CONCURRENT && !defined( ENTITYTAINER_thread_local )
+#if defined( _MSC_VER )
+#define ENTITYTAINER_thread_local __declspec( thread )
+#else
+#define ENTITYTAINER_thread_local __thread
+#endif
+#endif
+
+#if ENTITYTAINER_CONCURRENT
+// A thread's own free buckets of one bucket list, the next one to hand out last.
+typedef struct {
+    TheEntitytainerBucketList* bucket_list;
+    int                        count;
+    int                        buckets[ENTITYTAINER_BucketCacheSize];
+} TheEntitytainerBucketCache;
+
+static ENTITYTAINER_thread_local TheEntitytainerBucketCache entitytainer__bucket_caches[ENTITYTAINER_MAX_BUCKET_LISTS];
+#endif
+
+static void*          entitytainer__ptr_to_aligned_ptr( void* ptr, int align );
+static bool           entitytainer__child_in_bucket( TheEntitytainerEntity*     bucket,
+                                                     TheEntitytainerBucketList* bucket_list,
+                                                     TheEntitytainerEntity      child );
+static unsigned char* entitytainer__assign_lookups( TheEntitytainer* entitytainer, unsigned char* buffer );
+static int entitytainer__interleaved_stride( const struct TheEntitytainerConfig* config, int* parent_offset );
+static int            entitytainer__num_channels( const struct TheEntitytainerConfig* config );
+static void           entitytainer__assign_channels( TheEntitytainer* entitytainer );
+static TheEntitytainerEntry*  entitytainer__entry( const TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+static TheEntitytainerEntity* entitytainer__parent( const TheEntitytainer* entitytainer, TheEntitytainerEntity entity );
+static TheEntitytainerEntry*  entitytainer__parents_entry( const TheEntitytainer* entitytainer,
+                                                           TheEntitytainerEntity  entity );
+static void                   entitytainer__link_parent( TheEntitytainer*      entitytainer,
+                                                         TheEntitytainerEntity parent,
+                                                         TheEntitytainerEntity child );
+static void                   entitytainer__unlink_parent( TheEntitytainer*      entitytainer,
+                                                           TheEntitytainerEntity parent,
+                                                           TheEntitytainerEntity child );
+static TheEntitytainerEntity* entitytainer__get_bucket( TheEntitytainer*            entitytainer,
+                                                        TheEntitytainerEntry        lookup,
+                                                        TheEntitytainerBucketList** bucket_list_out );
+static TheEntitytainerEntity* entitytainer__get_bucket_for_write( TheEntitytainer*            entitytainer,
+                                                                  TheEntitytainerEntry        lookup,
+                                                                  TheEntitytainerBucketList** bucket_list_out );
+static TheEntitytainerEntity* entitytainer__move_bucket( TheEntitytainer*      entitytainer,
+                                                         TheEntitytainerEntry* lookup,
+                                                         int                   bucket_list_index_new );
+static TheEntitytainerEntry   entitytainer__make_entry( const TheEntitytainer* entitytainer,
+                                                       int                    bucket_list_index,
+                                                       int                    bucket_index );
+static int                    entitytainer__bucket_list_offset( int num_bucket_lists );
+static int                    entitytainer__max_buckets( const struct TheEntitytainerConfig* config );
+static int                    entitytainer__max_pages( const struct TheEntitytainerConfig* config,
+                                                       int                                 bucket_list_index );
+static int                    entitytainer__alloc_bucket( TheEntitytainer*           entitytainer,
+                                                          TheEntitytainerBucketList* bucket_list );
+static void                   entitytainer__grow_bucket_list( TheEntitytainer*           entitytainer,
+                                                              TheEntitytainerBucketList* bucket_list );
+static unsigned char*         entitytainer__assign_bucket_data( TheEntitytainer* entitytainer, unsigned char* buffer );
+static TheEntitytainerEntity* entitytainer__bucket( const TheEntitytainerBucketList* bucket_list, int bucket_index );
+static TheEntitytainerEntity* entitytainer__bucket_for_write( TheEntitytainerBucketList* bucket_list,
+                                                              int                        bucket_index );
+static TheEntitytainerBitWord* entitytainer__bucket_slot_bits( const TheEntitytainerBucketList* bucket_list,
+                                                               int                              bucket_index );
+static void                   entitytainer__append_page( TheEntitytainer*           entitytainer,
+                                                         TheEntitytainerBucketList* bucket_list );
+static void                   entitytainer__assign_pages( TheEntitytainer* entitytainer );
+static unsigned char*         entitytainer__alloc_page( const struct TheEntitytainerConfig* config,
+                                                        const TheEntitytainerBucketList*    bucket_list,
+                                                        TheEntitytainerBucketPage*          page );
+static const TheEntitytainerBucketPage* entitytainer__page( const TheEntitytainerBucketList* bucket_list,
+                                                            int                              bucket_index );
+static void                   entitytainer__own_page( TheEntitytainerBucketList* bucket_list, int bucket_index );
+static TheEntitytainer*       entitytainer__create( struct TheEntitytainerConfig* config, bool arena );
+#if ENTITYTAINER_MMAP
+static void entitytainer__commit_buckets( TheEntitytainer*           entitytainer,
+                                          TheEntitytainerBucketList* bucket_list,
+                                          int                        bucket_index );
+#endif
+static int                    entitytainer__save_grown( TheEntitytainer* entitytainer,
+                                                        unsigned char*   buffer,
+                                                        int              buffer_size );
+static void                   entitytainer__free_bucket( TheEntitytainer*           entitytainer,
+                                                         TheEntitytainerBucketList* bucket_list,
+                                                         int                        bucket_index );
+static void                   entitytainer__clear_bucket( TheEntitytainerBucketList* bucket_list, int bucket_index );
+static TheEntitytainerEntity  entitytainer__load_link( const TheEntitytainerEntity* bucket );
+static void                   entitytainer__store_link( TheEntitytainerEntity* bucket, TheEntitytainerEntity link );
+static void                   entitytainer__store_entry( const TheEntitytainer* entitytainer,
+                                                         TheEntitytainerEntry*  lookup,
+                                                         TheEntitytainerEntry   entry );
+#if ENTITYTAINER_CONCURRENT
+static int  entitytainer__alloc_bucket_concurrent( TheEntitytainer*           entitytainer,
+                                                  TheEntitytainerBucketList* bucket_list );
+static void entitytainer__free_bucket_concurrent( TheEntitytainer*           entitytainer,
+                                                  TheEntitytainerBucketList* bucket_list,
+                                                  int                        bucket_index );
+static int  entitytainer__claim_buckets( TheEntitytainerBucketList* bucket_list, int* buckets, int max_buckets );
+static void entitytainer__release_buckets( TheEntitytainerBucketList* bucket_list,
+                                           const int*                 buckets,
+                                           int                        num_buckets );
+static TheEntitytainerBucketCache* entitytainer__bucket_cache( TheEntitytainer*           entitytainer,
+                                                               TheEntitytainerBucketList* bucket_list );
+#endif
+static int                    entitytainer__free_bit_buckets( const struct TheEntitytainerConfig* config,
+                                                              int                                 bucket_list_index );
+static int                    entitytainer__free_bits_size( int num_buckets );
+static int                    entitytainer__lowest_free_bucket( const TheEntitytainerBucketList* bucket_list );
+static void                   entitytainer__move_free_bits( TheEntitytainerBucketList* bucket_list,
+                                                            TheEntitytainerBitWord*    free_bits,
+                                                            int                        num_buckets );
+static void                   entitytainer__set_free_bit( TheEntitytainerBucketList* bucket_list,
+                                                          int                        bucket_index,
+                                                          bool                       free );
+static void                   entitytainer__insert_child( TheEntitytainer*      entitytainer,
+                                                          TheEntitytainerEntity parent,
+                                                          TheEntitytainerEntity child,
+                                                          const void*           payload );
+static void                   entitytainer__remove_child( TheEntitytainer*      entitytainer,
+                                                          TheEntitytainerEntity parent,
+                                                          TheEntitytainerEntity child );
+static void                   entitytainer__shrink( TheEntitytainer* entitytainer, TheEntitytainerEntity parent );
+static void                   entitytainer__shrink_bucket( TheEntitytainer*      entitytainer,
+                                                           TheEntitytainerEntry* lookup,
+                                                           bool                  with_holes );
+static TheEntitytainerBitWord* entitytainer__slot_bits( const TheEntitytainer*     entitytainer,
+                                                        TheEntitytainerBucketList* bucket_list,
+                                                        TheEntitytainerEntry       lookup );
+static unsigned char*         entitytainer__assign_slot_bits( TheEntitytainer* entitytainer, unsigned char* buffer );
+static unsigned char*         entitytainer__assign_free_bits( TheEntitytainer* entitytainer, unsigned char* buffer );
+static unsigned char*         entitytainer__assign_payloads( TheEntitytainer* entitytainer, unsigned char* buffer );
+static unsigned char*         entitytainer__payload( const TheEntitytainer*           entitytainer,
+                                                     const TheEntitytainerBucketList* bucket_list,
+                                                     TheEntitytainerEntry             lookup,
+                                                     int                              slot );
+static void                   entitytainer__move_payloads( const TheEntitytainer*           entitytainer,
+                                                           const TheEntitytainerBucketList* bucket_list,
+                                                           TheEntitytainerEntry             lookup,
+                                                           int                              slot_dst,
+                                                           int                              slot_src,
+                                                           int                              num_slots );
+static void                   entitytainer__set_payload( const TheEntitytainer*           entitytainer,
+                                                         const TheEntitytainerBucketList* bucket_list,
+                                                         TheEntitytainerEntry             lookup,
+                                                         int                              slot,
+                                                         const void*                      payload );
+static void                   entitytainer__copy_child_payload( TheEntitytainer*      entitytainer,
+                                                                TheEntitytainerEntity parent_src,
+                                                                TheEntitytainerEntity parent_dst,
+                                                                TheEntitytainerEntity child );
+static int                    entitytainer__lower_bound( const TheEntitytainerEntity* children,
+                                                         int                          num_children,
+                                                         TheEntitytainerEntity        entity );
+static void           entitytainer__on_link( TheEntitytainer*      entitytainer,
+                                             TheEntitytainerEntity parent,
+                                             TheEntitytainerEntity child );
+static void           entitytainer__on_unlink( TheEntitytainer* entitytainer, TheEntitytainerEntity child );
+static bool           entitytainer__test_and_set_bit( TheEntitytainerBitWord* bits, int index );
+static void           entitytainer__report( TheEntitytainerValidation* report,
+                                            int*                       problems,
+                                            int                        entity,
+                                            int                        bucket_list_index );
+static void           entitytainer__record( TheEntitytainerJournalRecord* record,
+                                            int                           op,
+                                            int                           channel,
+                                            TheEntitytainerEntity         entity,
+                                            TheEntitytainerEntity         parent,
+                                            TheEntitytainerEntity         old_parent );
+static void           entitytainer__journal( TheEntitytainer*      entitytainer,
+                                             int                   op,
+                                             TheEntitytainerEntity entity,
+                                             TheEntitytainerEntity parent,
+                                             TheEntitytainerEntity old_parent );
+
+#ifndef ENTITYTAINER_ctz64
+#if defined( _MSC_VER ) && defined( _M_X64 )
+#include <intrin.h>
+static int
+entitytainer__ctz64( TheEntitytainerBitWord word ) {
+    unsigned long index;
+    _BitScanForward64( &index, word );
+    return (int)index;
+}
+#define ENTITYTAINER_ctz64 entitytainer__ctz64
+#elif defined( __GNUC__ ) || defined( __clang__ )
+#define ENTITYTAINER_ctz64 __builtin_ctzll
+#else
+static int
+entitytainer__ctz64( TheEntitytainerBitWord word ) {
+    int index = 0;
+    while ( ( word & 1 ) == 0 ) {
+        word >>= 1;
+        ++index;
+    }
+    return index;
+}
+#define ENTITYTAINER_ctz64 entitytainer__ctz64
+#endif
+#endif
+
+#if ENTITYTAINER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if ENTITYTAINER_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#if ENTITYTAINER_MMAP
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if ENTITYTAINER_CONCURRENT && !defined( ENTITYTAINER_atomic_cas64 )
+#if defined( _MSC_VER )
+#include <intrin.h>
+#define ENTITYTAINER_atomic_load64( ptr ) ( (unsigned long long)_InterlockedOr64( (volatile long long*)( ptr ), 0 ) )
+#define ENTITYTAINER_atomic_cas64( ptr, expected, desired )                                                            \
+    ( (unsigned long long)_InterlockedCompareExchange64(                                                               \
+        (volatile long long*)( ptr ), (long long)( desired ), (long long)( expected ) ) == ( expected ) )
+#define ENTITYTAINER_atomic_add32( ptr, value ) _InterlockedExchangeAdd( (volatile long*)( ptr ), ( value ) )
+#define ENTITYTAINER_atomic_store_entry( ptr, value )                                                                  \
+    do {                                                                                                               \
+        _ReadWriteBarrier();                                                                                           \
+        *(volatile TheEntitytainerEntry*)( ptr ) = ( value );                                                          \
+    } while ( 0 )
+#define ENTITYTAINER_atomic_load_link( ptr )                                                                           \
+    ( sizeof( *( ptr ) ) == 2 ? (TheEntitytainerEntity)_InterlockedOr16( (volatile short*)( ptr ), 0 )                 \
+                              : (TheEntitytainerEntity)_InterlockedOr( (volatile long*)( ptr ), 0 ) )
+#define ENTITYTAINER_atomic_store_link( ptr, value ) ( *(volatile TheEntitytainerEntity*)( ptr ) = ( value ) )
+#else
+#define ENTITYTAINER_atomic_load64( ptr ) __atomic_load_n( ( ptr ), __ATOMIC_ACQUIRE )
+#define ENTITYTAINER_atomic_cas64( ptr, expected, desired )                                                            \
+    __atomic_compare_exchange_n( ( ptr ), &( expected ), ( desired ), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE )
+#define ENTITYTAINER_atomic_add32( ptr, value ) __atomic_fetch_add( ( ptr ), ( value ), __ATOMIC_RELAXED )
+#define ENTITYTAINER_atomic_store_entry( ptr, value ) __atomic_store_n( ( ptr ), ( value ), __ATOMIC_RELEASE )
+#define ENTITYTAINER_atomic_load_link( ptr ) __atomic_load_n( ( ptr ), __ATOMIC_RELAXED )
+#define ENTITYTAINER_atomic_store_link( ptr, value ) __atomic_store_n( ( ptr ), ( value ), __ATOMIC_RELAXED )
+#endif
+#endif
+
+// Returns the index of the first non-zero word at or after start, or num_words if there is none.
+static int
+entitytainer__next_nonzero_word( const TheEntitytainerBitWord* words, int start, int num_words ) {
+    int i = start;
+#if ENTITYTAINER_SSE2
+    __m128i zero = _mm_setzero_si128();
+    for ( ; i + 4 <= num_words; i += 4 ) {
+        __m128i a = _mm_loadu_si128( (const __m128i*)( words + i ) );
+        __m128i b = _mm_loadu_si128( (const __m128i*)( words + i + 2 ) );
+        if ( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_or_si128( a, b ), zero ) ) != 0xffff ) {
+            break;
+        }
+    }
+#endif
+    while ( i < num_words && words[i] == 0 ) {
+        ++i;
+    }
+
+    return i;
+}
+
+static unsigned long long
+entitytainer__load_element( const unsigned char* element, int element_size ) {
+    if ( element_size == 1 ) {
+        return *element;
+    }
+
+    if ( element_size == 2 ) {
+        return *(const unsigned short*)element;
+    }
+
+    if ( element_size == 4 ) {
+        return *(const unsigned int*)element;
+    }
+
+    return *(const unsigned long long*)element;
+}
+
+// Returns the index of the first element at or after start that differs between a and b, or num_elements if there is
+// none. With zero_only, two elements only differ when one of them is 0 and the other isn't.
+static int
+entitytainer__next_difference( const void* a,
+                               const void* b,
+                               int         start,
+                               int         num_elements,
+                               int         element_size,
+                               bool        zero_only ) {
+    const unsigned char* bytes_a = (const unsigned char*)a;
+    const unsigned char* bytes_b = (const unsigned char*)b;
+    int                  i       = start;
+#if ENTITYTAINER_SSE2
+    if ( !zero_only || element_size == 2 || element_size == 4 ) {
+        int     block_elements = 16 / element_size;
+        __m128i zero           = _mm_setzero_si128();
+        for ( ; i + block_elements <= num_elements; i += block_elements ) {
+            __m128i block_a = _mm_loadu_si128( (const __m128i*)( bytes_a + i * element_size ) );
+            __m128i block_b = _mm_loadu_si128( (const __m128i*)( bytes_b + i * element_size ) );
+            if ( zero_only ) {
+                block_a = element_size == 2 ? _mm_cmpeq_epi16( block_a, zero ) : _mm_cmpeq_epi32( block_a, zero );
+                block_b = element_size == 2 ? _mm_cmpeq_epi16( block_b, zero ) : _mm_cmpeq_epi32( block_b, zero );
+            }
+
+            if ( _mm_movemask_epi8( _mm_cmpeq_epi8( block_a, block_b ) ) != 0xffff ) {
+                break;
+            }
+        }
+    }
+#endif
+    for ( ; i < num_elements; ++i ) {
+        unsigned long long element_a = entitytainer__load_element( bytes_a + i * element_size, element_size );
+        unsigned long long element_b = entitytainer__load_element( bytes_b + i * element_size, element_size );
+        if ( zero_only ? ( element_a == 0 ) != ( element_b == 0 ) : element_a != element_b ) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#if ENTITYTAINER_SSSE3
+// pshufb controls that move the lanes set in a 4-bit mask to the front, in order, and zero the rest. For 32 and 16 bit
+// entities.
+static const unsigned char entitytainer__compress_shuffles32[16][16] = {
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 4, 5, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 8, 9, 10, 11, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 8, 9, 10, 11, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 4, 5, 6, 7, 8, 9, 10, 11, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0x80, 0x80, 0x80, 0x80 },
+    { 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 4, 5, 6, 7, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80 },
+    { 8, 9, 10, 11, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 8, 9, 10, 11, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80 },
+    { 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+};
+
+static const unsigned char entitytainer__compress_shuffles16[16][8] = {
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 2, 3, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 0x80, 0x80, 0x80, 0x80 },
+    { 4, 5, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 4, 5, 0x80, 0x80, 0x80, 0x80 },
+    { 2, 3, 4, 5, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 4, 5, 0x80, 0x80 },
+    { 6, 7, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 6, 7, 0x80, 0x80, 0x80, 0x80 },
+    { 2, 3, 6, 7, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 2, 3, 6, 7, 0x80, 0x80 },
+    { 4, 5, 6, 7, 0x80, 0x80, 0x80, 0x80 },
+    { 0, 1, 4, 5, 6, 7, 0x80, 0x80 },
+    { 2, 3, 4, 5, 6, 7, 0x80, 0x80 },
+    { 0, 1, 2, 3, 4, 5, 6, 7 },
+};
+
+// Copies the children in the four slots set in mask to out, in order, and returns how many there were. Stores all four
+// slots' worth, so out needs room for four.
+static int
+entitytainer__compress4( const TheEntitytainerEntity* children, unsigned int mask, TheEntitytainerEntity* out ) {
+    if ( sizeof( TheEntitytainerEntity ) == 4 ) {
+        __m128i lanes   = _mm_loadu_si128( (const __m128i*)children );
+        __m128i shuffle = _mm_loadu_si128( (const __m128i*)entitytainer__compress_shuffles32[mask] );
+        _mm_storeu_si128( (__m128i*)out, _mm_shuffle_epi8( lanes, shuffle ) );
+    }
+    else {
+        __m128i lanes   = _mm_loadl_epi64( (const __m128i*)children );
+        __m128i shuffle = _mm_loadl_epi64( (const __m128i*)entitytainer__compress_shuffles16[mask] );
+        _mm_storel_epi64( (__m128i*)out, _mm_shuffle_epi8( lanes, shuffle ) );
+    }
+
+    // The popcount of each 4-bit mask, a nibble each.
+    return (int)( ( 0x4332322132212110ull >> ( mask * 4 ) ) & 0xf );
+}
+#endif
 
 ENTITYTAINER_API int
 entitytainer_needed_size( struct TheEntitytainerConfig* config ) {
-    int size_needed = sizeof( TheEntitytainer );
-    size_needed += config->num_entries * sizeof( TheEntitytainerEntry );           // Lookup
-    size_needed += config->num_entries * sizeof( TheEntitytainerEntity );          // Reverse lookup
-    size_needed += config->num_bucket_lists * sizeof( TheEntitytainerBucketList ); // List structs
+    // In size_t, so a config too big for an int is caught instead of wrapping around.
+    size_t num_channels = (size_t)entitytainer__num_channels( config );
+    size_t num_entries  = (size_t)config->num_entries;
+    size_t size_needed  = sizeof( TheEntitytainer ) * num_channels;
+    if ( config->interleaved_lookups ) {
+        int parent_offset;
+        size_needed += num_entries * entitytainer__interleaved_stride( config, &parent_offset ); // Both lookups
+    }
+    else {
+        size_needed += num_entries * num_channels * sizeof( TheEntitytainerEntry ); // Lookup
+        size_t parent_size = config->multi_parent ? sizeof( TheEntitytainerEntry ) : sizeof( TheEntitytainerEntity );
+        size_needed += num_entries * num_channels * parent_size; // Reverse lookup
+    }
+
+    size_needed += config->num_bucket_lists * sizeof( TheEntitytainerBucketList );       // List structs
+
+    // Ancestry index: depth + jump table
+    if ( config->ancestry_levels > 0 ) {
+        size_needed += num_entries * ( 1 + config->ancestry_levels ) * sizeof( TheEntitytainerEntity );
+    }
+
+    // Pre-order index
+    if ( config->preorder_index ) {
+        size_needed += num_entries * ( sizeof( TheEntitytainerEntity ) + 3 * sizeof( int ) );
+    }
+
+    // Dirty bits
+    if ( config->dirty_tracking ) {
+        size_needed += ( num_entries + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits *
+                       sizeof( TheEntitytainerBitWord );
+    }
 
     // Bucket lists
     for ( int i = 0; i < config->num_bucket_lists; ++i ) {
-        size_needed += config->bucket_list_sizes[i] * config->bucket_sizes[i] * sizeof( TheEntitytainerEntity );
+        size_needed += (size_t)config->bucket_list_sizes[i] * config->bucket_sizes[i] * sizeof( TheEntitytainerEntity );
+    }
+
+    // Slot bits
+    if ( config->remove_with_holes ) {
+        for ( int i = 0; i < config->num_bucket_lists; ++i ) {
+            int slot_words = ( config->bucket_sizes[i] - 1 + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+            size_needed += (size_t)config->bucket_list_sizes[i] * slot_words * sizeof( TheEntitytainerBitWord );
+        }
+    }
+
+    // Free bitmaps
+    if ( config->lowest_free_bucket ) {
+        for ( int i = 0; i < config->num_bucket_lists; ++i ) {
+            size_needed += entitytainer__free_bits_size( entitytainer__free_bit_buckets( config, i ) ) *
+                           sizeof( TheEntitytainerBitWord );
+        }
+    }
+
+    // Payloads
+    for ( int i = 0; i < config->num_bucket_lists; ++i ) {
+        size_needed += (size_t)config->bucket_list_sizes[i] * config->bucket_sizes[i] * config->payload_size;
+    }
+
+    // Page tables, big enough for the pages each list can get
+    if ( config->bucket_page_size > 0 ) {
+        for ( int i = 0; i < config->num_bucket_lists; ++i ) {
+            size_needed += (size_t)entitytainer__max_pages( config, i ) * sizeof( TheEntitytainerBucketPage );
+        }
     }
 
     // Account for struct alignment, with good margins :D
-    int things_to_align = 1 + config->num_bucket_lists;
-    int safe_alignment  = sizeof( void* ) * 16;
+    size_t things_to_align = 6 + 2 * (size_t)config->num_bucket_lists;
+    size_t safe_alignment  = sizeof( void* ) * 16;
     size_needed += things_to_align * safe_alignment;
 
-    return size_needed;
+    ENTITYTAINER_assert( size_needed <= 0x7fffffff, "Entitytainer[%s] The config needs more than 2 GB.", "" );
+    return (int)size_needed;
 }
 
 ENTITYTAINER_API TheEntitytainer*
                  entitytainer_create( struct TheEntitytainerConfig* config ) {
+    return entitytainer__create( config, false );
+}
 
+// An arena's memory is fresh from mmap, so already zeroed, and clearing it would commit all of it.
+static TheEntitytainer*
+entitytainer__create( struct TheEntitytainerConfig* config, bool arena ) {
     unsigned char* buffer_start = (unsigned char*)config->memory;
-    ENTITYTAINER_memset( buffer_start, 0, config->memory_size );
+    if ( !arena ) {
+        ENTITYTAINER_memset( buffer_start, 0, config->memory_size );
+    }
+
     unsigned char* buffer = buffer_start;
     buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer, (int)ENTITYTAINER_alignof( TheEntitytainer ) );
 
@@ -267,6 +1067,9 @@ ENTITYTAINER_API TheEntitytainer*
     entitytainer->remove_with_holes       = config->remove_with_holes;
     entitytainer->keep_capacity_on_remove = config->keep_capacity_on_remove;
     entitytainer->entry_lookup_size       = config->num_entries;
+    entitytainer->arena                   = arena;
+    entitytainer->bucket_list_offset      = entitytainer__bucket_list_offset( config->num_bucket_lists );
+    entitytainer->bucket_mask             = ( 1 << entitytainer->bucket_list_offset ) - 1;
 
     ENTITYTAINER_memcpy( &entitytainer->config, config, sizeof( *config ) );
     // if ( entitytainer->config.name[0] == 0 ) {
@@ -275,19 +1078,30 @@ ENTITYTAINER_API TheEntitytainer*
     //     entitytainer->config.name[12] = 0;
     // }
 
-    buffer += sizeof( TheEntitytainer );
-    entitytainer->entry_lookup = (TheEntitytainerEntry*)buffer;
-    buffer += sizeof( TheEntitytainerEntry ) * config->num_entries;
-    entitytainer->entry_parent_lookup = (TheEntitytainerEntity*)buffer;
-    buffer += sizeof( TheEntitytainerEntity ) * config->num_entries;
+    ENTITYTAINER_assert( config->ancestry_levels >= 0 && config->ancestry_levels < 31 );
+    ENTITYTAINER_assert( !( config->sorted_children && config->remove_with_holes ) );
+    ENTITYTAINER_assert( ( entitytainer__num_channels( config ) == 1 && !config->multi_parent ) ||
+                         ( config->ancestry_levels == 0 && !config->preorder_index && !config->dirty_tracking ) );
+    ENTITYTAINER_assert( !config->concurrent ||
+                         ( ENTITYTAINER_CONCURRENT && !arena && config->allocate == NULL &&
+                           !config->lowest_free_bucket && !config->multi_parent && config->ancestry_levels == 0 &&
+                           !config->preorder_index && !config->dirty_tracking && config->journal == NULL ) );
+    ENTITYTAINER_assert( !config->thread_bucket_caches || config->concurrent );
+    ENTITYTAINER_assert( config->journal == NULL || config->journal_size > 0 );
+    ENTITYTAINER_assert( config->num_bucket_lists >= 1 && config->num_bucket_lists <= ENTITYTAINER_MAX_BUCKET_LISTS );
+
+    buffer += sizeof( TheEntitytainer ) * entitytainer__num_channels( config );
+    buffer = entitytainer__assign_lookups( entitytainer, buffer );
 
     buffer                     = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer,
                                                                (int)ENTITYTAINER_alignof( TheEntitytainerBucketList ) );
     entitytainer->bucket_lists = (TheEntitytainerBucketList*)buffer;
 
-    unsigned char*         bucket_list_end   = buffer + sizeof( TheEntitytainerBucketList ) * config->num_bucket_lists;
-    TheEntitytainerEntity* bucket_data_start = (TheEntitytainerEntity*)bucket_list_end;
-    TheEntitytainerEntity* bucket_data       = bucket_data_start;
+    ENTITYTAINER_assert( config->payload_size >= 0 );
+    ENTITYTAINER_assert( config->bucket_page_size >= 0 && config->bucket_page_size <= entitytainer->bucket_mask + 1 &&
+                         ( config->bucket_page_size & ( config->bucket_page_size - 1 ) ) == 0 );
+    unsigned char* bucket_list_end = buffer + sizeof( TheEntitytainerBucketList ) * config->num_bucket_lists;
+    unsigned char* bucket_data_end = entitytainer__assign_bucket_data( entitytainer, bucket_list_end );
     for ( int i = 0; i < config->num_bucket_lists; ++i ) {
         // Just making sure that we don't go into the bucket data area
         ENTITYTAINER_assert( buffer + sizeof( TheEntitytainerBucketList ) <= bucket_list_end,
@@ -295,836 +1109,3333 @@ ENTITYTAINER_API TheEntitytainer*
 
         // We need to do this because first_free_bucket is stored as an int.
         ENTITYTAINER_assert( config->bucket_sizes[i] * sizeof( TheEntitytainerEntity ) >= sizeof( int ) );
+        ENTITYTAINER_assert( config->bucket_page_size == 0 ||
+                             config->bucket_list_sizes[i] % config->bucket_page_size == 0 );
+        ENTITYTAINER_assert( config->bucket_list_sizes[i] <= entitytainer->bucket_mask + 1,
+                             "Entitytainer[%s] Bucket list %d can't be indexed past %d buckets.",
+                             "",
+                             i,
+                             entitytainer->bucket_mask + 1 );
 
         TheEntitytainerBucketList* list = (TheEntitytainerBucketList*)buffer;
-        list->bucket_data               = bucket_data;
         list->bucket_size               = config->bucket_sizes[i];
         list->total_buckets             = config->bucket_list_sizes[i];
+        list->committed_buckets         = arena ? 0 : list->total_buckets;
         list->first_free_bucket         = ENTITYTAINER_NoFreeBucket;
         list->used_buckets              = 0;
+        list->free_head                 = ENTITYTAINER_NoFreeBucket;
 
         if ( i == 0 ) {
             // We need this in order to ensure that we can use 0 as the default "invalid" entry.
             list->used_buckets = 1;
         }
 
+        list->next_bucket = list->used_buckets;
+
         buffer += sizeof( TheEntitytainerBucketList );
-        bucket_data += list->bucket_size * list->total_buckets;
     }
 
-    ENTITYTAINER_assert( *bucket_data_start == 0 );
-    ENTITYTAINER_assert( (unsigned char*)bucket_data <= buffer_start + config->memory_size );
+    ENTITYTAINER_assert( arena || *entitytainer->bucket_lists[0].bucket_data == 0 );
+    ENTITYTAINER_assert( bucket_data_end <= buffer_start + config->memory_size );
+    entitytainer__assign_pages( entitytainer );
+    entitytainer__assign_channels( entitytainer );
     return entitytainer;
 }
 
+#if ENTITYTAINER_MMAP
 ENTITYTAINER_API TheEntitytainer*
-                 entitytainer_realloc( TheEntitytainer* entitytainer_old, void* memory, int memory_size, float growth ) {
-    ENTITYTAINER_assert( false ); // Not yet implemented
-    (void)memory_size;
-
-    int num_entries = entitytainer_old->entry_lookup_size; // * growth;
-    int size_needed = sizeof( TheEntitytainer );
-    size_needed += (int)( num_entries * sizeof( TheEntitytainerEntry ) );
-    size_needed += (int)( num_entries * sizeof( TheEntitytainerEntity ) );
-    size_needed += entitytainer_old->num_bucket_lists * sizeof( TheEntitytainerBucketList );
-
-    for ( int i = 0; i < entitytainer_old->num_bucket_lists; ++i ) {
-        TheEntitytainerBucketList* bucket_list = &entitytainer_old->bucket_lists[i];
-        int old_bucket_size = bucket_list->total_buckets * bucket_list->bucket_size * sizeof( TheEntitytainerEntity );
-        size_needed += (int)( old_bucket_size * growth );
+entitytainer_create_arena( struct TheEntitytainerConfig* config, bool huge_pages ) {
+    ENTITYTAINER_assert( config->allocate == NULL && config->bucket_page_size == 0 );
+    size_t page_size    = (size_t)sysconf( _SC_PAGESIZE );
+    size_t needed_size  = (size_t)entitytainer_needed_size( config );
+    size_t reserve_size = ( needed_size + page_size - 1 ) & ~( page_size - 1 );
+    void*  memory       = mmap( NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+    ENTITYTAINER_assert( memory != MAP_FAILED );
+#ifdef MADV_HUGEPAGE
+    if ( huge_pages ) {
+        madvise( memory, reserve_size, MADV_HUGEPAGE );
     }
+#endif
 
-    char* buffer = (char*)memory;
-
-    TheEntitytainer* entitytainer   = (TheEntitytainer*)buffer;
-    *entitytainer                   = *entitytainer_old;
-    entitytainer->entry_lookup_size = num_entries;
-    buffer += sizeof( TheEntitytainer );
-    entitytainer->entry_lookup = (TheEntitytainerEntry*)buffer;
-    buffer += sizeof( TheEntitytainerEntry ) * num_entries;
-    entitytainer->entry_parent_lookup = (TheEntitytainerEntity*)buffer;
-    buffer += sizeof( TheEntitytainerEntity ) * num_entries;
-
-    // char* bucket_data = buffer + sizeof( TheEntitytainerBucketList ) * entitytainer_old->num_bucket_lists;
-    // for ( int i = 0; i < entitytainer_old->num_bucket_lists; ++i ) {
-    //     // ENTITYTAINER_assert( bucket_data - buffer > bucket_sizes[i] * bucket_list_sizes[i] ); // >= ?
-    //     TheEntitytainerBucketList* list = (TheEntitytainerBucketList*)buffer;
-    //     list->bucket_data                   = bucket_data;
-    //     list->bucket_size               = entitytainer_old->bucket_lists[i].bucket_size;
-    //     list->total_buckets             = entitytainer_old->bucket_lists[i].total_buckets;
-    //     list->first_free_bucket         = entitytainer_old->bucket_lists[i].first_free_bucket;
-    //     list->used_buckets              = entitytainer_old->bucket_lists[i].used_buckets;
+    // Everything before the buckets. needed_size has margins for alignment, so this reaches at least that far.
+    size_t bucket_data_size = 0;
+    for ( int i = 0; i < config->num_bucket_lists; ++i ) {
+        bucket_data_size += config->bucket_list_sizes[i] * config->bucket_sizes[i] * sizeof( TheEntitytainerEntity );
+    }
 
-    //     int old_buffer_size = entitytainer_old->bucket_lists[i].total_buckets * sizeof( TheEntitytainerEntry );
-    //     ENTITYTAINER_memcpy( list->bucket_data, entitytainer_old->bucket_lists[i].bucket_data, old_buffer_size );
-    //     buffer += sizeof( TheEntitytainerBucketList );
-    //     bucket_data += list->bucket_size * list->total_buckets;
-    // }
+    size_t header_size = ( needed_size - bucket_data_size + page_size - 1 ) & ~( page_size - 1 );
+    int    result      = mprotect( memory, header_size, PROT_READ | PROT_WRITE );
+    ENTITYTAINER_assert( result == 0 );
+    (void)result;
 
-    // ENTITYTAINER_assert( bucket_data == buffer + buffer_size );
+    config->memory                = memory;
+    config->memory_size           = (int)reserve_size;
+    TheEntitytainer* entitytainer = entitytainer__create( config, true );
+    entitytainer->huge_pages      = huge_pages;
     return entitytainer;
 }
+#endif
 
-ENTITYTAINER_API bool
-entitytainer_needs_realloc( TheEntitytainer* entitytainer, float percent_free, int num_free_buckets ) {
+ENTITYTAINER_API void
+entitytainer_destroy( TheEntitytainer* entitytainer ) {
+    ENTITYTAINER_assert( entitytainer->channel == 0 );
+    ENTITYTAINER_assert( !entitytainer->has_snapshot, "Release the snapshot first." );
     for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
-        // ENTITYTAINER_assert( bucket_data - buffer > bucket_sizes[i] * bucket_list_sizes[i] ); // >= ?
         TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
-        if ( percent_free >= 0 ) {
-            num_free_buckets = (int)( list->total_buckets * percent_free );
+        if ( list->grown_memory != NULL ) {
+            entitytainer->config.allocate(
+              entitytainer->config.allocate_user_data, list->grown_memory, list->grown_memory_size, 0 );
+            list->grown_memory      = NULL;
+            list->grown_memory_size = 0;
         }
 
-        if ( list->total_buckets - list->used_buckets <= num_free_buckets ) {
-            return true;
+        // Pages in the main allocation have been copied out if a snapshot shared them.
+        for ( int i_page = 0; i_page < list->num_pages; ++i_page ) {
+            TheEntitytainerBucketPage* page = &list->pages[i_page];
+            if ( page->memory != NULL ) {
+                entitytainer->config.allocate(
+                  entitytainer->config.allocate_user_data, page->memory, page->memory_size, 0 );
+                page->memory = NULL;
+            }
         }
+
+        list->num_pages = list->num_inline_pages;
     }
 
-    return false;
+#if ENTITYTAINER_MMAP
+    if ( entitytainer->arena ) {
+        munmap( entitytainer->config.memory, entitytainer->config.memory_size );
+    }
+#endif
 }
 
-ENTITYTAINER_API void
-entitytainer_add_entity( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
-    ENTITYTAINER_assert( entitytainer->entry_lookup[entity] == 0,
-                         "Entitytainer[%s] Tried to add entity " ENTITYTAINER_EntityFormat " but it was already added.",
-                         "",
-                         entity );
+ENTITYTAINER_API TheEntitytainer*
+entitytainer_snapshot( TheEntitytainer* entitytainer ) {
+    ENTITYTAINER_assert( entitytainer->channel == 0 );
+    ENTITYTAINER_assert( entitytainer->config.bucket_page_size > 0 && entitytainer->config.allocate != NULL );
+    ENTITYTAINER_assert( !entitytainer->has_snapshot, "Release the previous snapshot first." );
 
-    TheEntitytainerBucketList* bucket_list  = &entitytainer->bucket_lists[0];
-    int                        bucket_index = bucket_list->used_buckets;
-    if ( bucket_list->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
-        // There's a freed bucket available
-        bucket_index                   = bucket_list->first_free_bucket;
-        int bucket_offset              = bucket_index * bucket_list->bucket_size;
-        bucket_list->first_free_bucket = bucket_list->bucket_data[bucket_offset];
+    // From here on the pages are shared. Done first so the snapshot's lists have it too, which makes save lay it out.
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        ++entitytainer->bucket_lists[i].snapshot_generation;
     }
 
-    // TODO: Move to larger bucket list if this one is full
-    ENTITYTAINER_assert( bucket_list->used_buckets < bucket_list->total_buckets );
-    ++bucket_list->used_buckets;
-
-    TheEntitytainerEntry* lookup = &entitytainer->entry_lookup[entity];
-    ENTITYTAINER_assert( *lookup == 0 );
-    *lookup = (TheEntitytainerEntry)bucket_index; // bucket list index is 0
-
-    int                    bucket_offset = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity* bucket        = bucket_list->bucket_data + bucket_offset;
-    ENTITYTAINER_memset( bucket, 0, bucket_list->bucket_size * sizeof( TheEntitytainerEntity ) );
-}
+    // The entitytainer up to its bucket lists, then a copy of each list's page table and free bits.
+    unsigned char* begin           = (unsigned char*)entitytainer;
+    unsigned char* bucket_list_end = (unsigned char*)( entitytainer->bucket_lists + entitytainer->num_bucket_lists );
+    unsigned char* pages_begin     = (unsigned char*)entitytainer__ptr_to_aligned_ptr(
+      bucket_list_end, (int)ENTITYTAINER_alignof( TheEntitytainerBucketPage ) );
+    int memory_size = (int)( pages_begin - begin );
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        const TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        memory_size += list->num_pages * (int)sizeof( TheEntitytainerBucketPage );
+        if ( list->free_bits != NULL ) {
+            int free_buckets = entitytainer__free_bit_buckets( &entitytainer->config, i );
+            memory_size += entitytainer__free_bits_size( free_buckets ) * (int)sizeof( TheEntitytainerBitWord );
+        }
+    }
 
-ENTITYTAINER_API void
-entitytainer_remove_entity( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[entity];
+    unsigned char* memory = (unsigned char*)entitytainer->config.allocate(
+      entitytainer->config.allocate_user_data, NULL, 0, memory_size );
+    ENTITYTAINER_assert( memory != NULL );
+    ENTITYTAINER_assert( entitytainer__ptr_to_aligned_ptr( memory, (int)ENTITYTAINER_alignof( TheEntitytainer ) ) ==
+                         memory );
+
+    // All of it but the ancestry and pre-order indices, which sit together after the lookups. They only follow from
+    // the tree, so the snapshot rebuilds its own on its first query instead of copying them.
+    unsigned char* derived_begin = bucket_list_end;
+    unsigned char* derived_end   = bucket_list_end;
+    if ( entitytainer->config.ancestry_levels > 0 ) {
+        derived_begin = (unsigned char*)entitytainer->entry_depth_lookup;
+        derived_end   = (unsigned char*)( entitytainer->entry_ancestor_lookup +
+                                        entitytainer->entry_lookup_size * entitytainer->config.ancestry_levels );
+    }
 
-    if ( entitytainer->entry_parent_lookup[entity] != ENTITYTAINER_InvalidEntity ) {
-        if ( entitytainer->remove_with_holes ) {
-            entitytainer_remove_child_with_holes( entitytainer, entitytainer->entry_parent_lookup[entity], entity );
-        }
-        else {
-            entitytainer_remove_child_no_holes( entitytainer, entitytainer->entry_parent_lookup[entity], entity );
+    if ( entitytainer->config.preorder_index ) {
+        if ( derived_begin == bucket_list_end ) {
+            derived_begin = (unsigned char*)entitytainer->preorder_entities;
         }
 
-        lookup = entitytainer->entry_lookup[entity];
+        derived_end = (unsigned char*)( entitytainer->preorder_parent_indices + entitytainer->entry_lookup_size );
     }
 
-    if ( lookup == 0 ) {
-        // lookup is 0 for entities that don't have children (or haven't been added by _add_entity)
-        return;
+    ENTITYTAINER_memcpy( memory, entitytainer, derived_begin - begin );
+    ENTITYTAINER_memcpy( memory + ( derived_end - begin ), derived_end, bucket_list_end - derived_end );
+
+    // Same offsets as in the entitytainer, as when loading.
+    TheEntitytainer* snapshot = (TheEntitytainer*)memory;
+    unsigned char*   buffer   = memory + sizeof( TheEntitytainer ) * entitytainer__num_channels( &snapshot->config );
+    buffer                    = entitytainer__assign_lookups( snapshot, buffer );
+    buffer                    = (unsigned char*)entitytainer__ptr_to_aligned_ptr(
+      buffer, (int)ENTITYTAINER_alignof( TheEntitytainerBucketList ) );
+    snapshot->bucket_lists = (TheEntitytainerBucketList*)buffer;
+    ENTITYTAINER_assert( buffer - memory == (unsigned char*)entitytainer->bucket_lists - begin );
+
+    buffer = memory + ( pages_begin - begin );
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list          = &entitytainer->bucket_lists[i];
+        TheEntitytainerBucketList* snapshot_list = &snapshot->bucket_lists[i];
+        snapshot_list->pages                     = (TheEntitytainerBucketPage*)buffer;
+        ENTITYTAINER_memcpy( buffer, list->pages, list->num_pages * sizeof( TheEntitytainerBucketPage ) );
+        buffer += list->num_pages * sizeof( TheEntitytainerBucketPage );
+        list->snapshot_config = &entitytainer->config;
     }
 
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = bucket_list->bucket_data + bucket_offset;
-    ENTITYTAINER_assert( bucket[0] == 0,
-                         "Entitytainer[%s] Tried to remove " ENTITYTAINER_EntityFormat
-                         " but it still had children. First child=" ENTITYTAINER_EntityFormat,
-                         "",
-                         entity,
-                         bucket[1] );
-    *bucket                        = (TheEntitytainerEntity)bucket_list->first_free_bucket;
-    bucket_list->first_free_bucket = bucket_index;
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        if ( list->free_bits != NULL ) {
+            int free_size = entitytainer__free_bits_size( entitytainer__free_bit_buckets( &entitytainer->config, i ) );
+            snapshot->bucket_lists[i].free_bits = (TheEntitytainerBitWord*)buffer;
+            ENTITYTAINER_memcpy( buffer, list->free_bits, free_size * sizeof( TheEntitytainerBitWord ) );
+            buffer += free_size * sizeof( TheEntitytainerBitWord );
+        }
+    }
 
-    entitytainer->entry_lookup[entity] = 0;
-    --bucket_list->used_buckets;
+    // Changing the snapshot would need allocate, so it asserts instead.
+    snapshot->config.memory             = memory;
+    snapshot->config.memory_size        = memory_size;
+    snapshot->config.allocate           = NULL;
+    snapshot->config.allocate_user_data = NULL;
+    snapshot->config.journal            = NULL;
+    snapshot->has_snapshot              = false;
+    snapshot->ancestry_dirty            = snapshot->config.ancestry_levels > 0;
+    snapshot->preorder_dirty            = snapshot->config.preorder_index;
+    entitytainer__assign_channels( snapshot );
+    entitytainer->has_snapshot = true;
+    return snapshot;
 }
 
 ENTITYTAINER_API void
-entitytainer_reserve( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, int capacity ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = bucket_list->bucket_data + bucket_offset;
-    if ( bucket_list->bucket_size > capacity ) {
-        return;
+entitytainer_release_snapshot( TheEntitytainer* entitytainer, TheEntitytainer* snapshot ) {
+    ENTITYTAINER_assert( entitytainer->channel == 0 && entitytainer->has_snapshot );
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList*       list          = &entitytainer->bucket_lists[i];
+        const TheEntitytainerBucketList* snapshot_list = &snapshot->bucket_lists[i];
+
+        // The pages that have been copied since are only the snapshot's now.
+        for ( int i_page = 0; i_page < snapshot_list->num_pages; ++i_page ) {
+            const TheEntitytainerBucketPage* page = &snapshot_list->pages[i_page];
+            if ( page->memory != NULL && page->memory != list->pages[i_page].memory ) {
+                entitytainer->config.allocate(
+                  entitytainer->config.allocate_user_data, page->memory, page->memory_size, 0 );
+            }
+        }
+
+        list->snapshot_config = NULL;
     }
 
-    TheEntitytainerBucketList* bucket_list_new       = NULL;
-    int                        bucket_list_index_new = -1;
-    for ( int i_bl = 0; i_bl < entitytainer->num_bucket_lists; ++i_bl ) {
-        bucket_list_new = &entitytainer->bucket_lists[i_bl];
-        if ( bucket_list_new->bucket_size > capacity + 1 ) {
-            bucket_list_index_new = i_bl;
-            break;
-        }
+    entitytainer->config.allocate(
+      entitytainer->config.allocate_user_data, snapshot->config.memory, snapshot->config.memory_size, 0 );
+    entitytainer->has_snapshot = false;
+}
+
+ENTITYTAINER_API int
+entitytainer_drain_journal( TheEntitytainer*              entitytainer,
+                            TheEntitytainerJournalRecord* records,
+                            int                           max_records,
+                            int*                          num_dropped ) {
+    TheEntitytainer* root = entitytainer - entitytainer->channel;
+    ENTITYTAINER_assert( root->config.journal != NULL );
+    int num_records = root->journal_count < max_records ? root->journal_count : max_records;
+
+    // At most two runs, the one up to the end of the ring and the one that wrapped around.
+    int first_run = root->config.journal_size - root->journal_first;
+    first_run     = first_run < num_records ? first_run : num_records;
+    ENTITYTAINER_memcpy( records, root->config.journal + root->journal_first, first_run * sizeof( *records ) );
+    ENTITYTAINER_memcpy(
+      records + first_run, root->config.journal, ( num_records - first_run ) * sizeof( *records ) );
+    root->journal_first += num_records;
+    if ( root->journal_first >= root->config.journal_size ) {
+        root->journal_first -= root->config.journal_size;
     }
 
-    ENTITYTAINER_assert( bucket_list_index_new != -1 );
+    root->journal_count -= num_records;
+    if ( num_dropped != NULL ) {
+        *num_dropped = root->journal_count == 0 ? root->journal_dropped : 0;
+    }
 
-    int bucket_index_new = bucket_list_new->used_buckets;
-    if ( bucket_list_new->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
-        // There's a freed bucket available
-        bucket_index_new                   = bucket_list_new->first_free_bucket;
-        int bucket_offset_new              = bucket_index_new * bucket_list_new->bucket_size;
-        bucket_list_new->first_free_bucket = bucket_list_new->bucket_data[bucket_offset_new];
+    if ( root->journal_count == 0 ) {
+        root->journal_dropped = 0;
     }
 
-    int                    bucket_offset_new = bucket_index_new * bucket_list_new->bucket_size;
-    TheEntitytainerEntity* bucket_new        = bucket_list_new->bucket_data + bucket_offset_new;
-    ENTITYTAINER_memset( bucket_new, 0, bucket_list_new->bucket_size * sizeof( TheEntitytainerEntity ) );
-    ENTITYTAINER_memcpy( bucket_new, bucket, bucket_list->bucket_size * sizeof( TheEntitytainerEntity ) );
+    return num_records;
+}
 
-    *bucket                        = (TheEntitytainerEntity)bucket_list->first_free_bucket;
-    bucket_list->first_free_bucket = bucket_index;
-    bucket                         = bucket_new;
+ENTITYTAINER_API int
+entitytainer_diff( TheEntitytainer*              entitytainer_a,
+                   TheEntitytainer*              entitytainer_b,
+                   TheEntitytainerJournalRecord* ops,
+                   int                           max_ops ) {
+    ENTITYTAINER_assert( !entitytainer_a->config.multi_parent && !entitytainer_b->config.multi_parent );
+    ENTITYTAINER_assert( entitytainer_a->entry_lookup_size == entitytainer_b->entry_lookup_size );
+    ENTITYTAINER_assert( entitytainer_a->entry_stride == entitytainer_b->entry_stride );
+    ENTITYTAINER_assert( entitytainer_a->parent_stride == entitytainer_b->parent_stride );
+    ENTITYTAINER_assert( entitytainer_a->channel == entitytainer_b->channel );
+
+    // The lookups are compared for all channels at once, and differences in the other channels skipped. With
+    // interleaved lookups the parents are in the same array as the entries, and skipped the same way.
+    int                          channel      = entitytainer_a->channel;
+    int                          num_channels = entitytainer__num_channels( &entitytainer_a->config );
+    int                          num_entries  = entitytainer_a->entry_lookup_size;
+    const TheEntitytainerEntry*  entries_a    = entitytainer_a->entry_lookup - channel;
+    const TheEntitytainerEntry*  entries_b    = entitytainer_b->entry_lookup - channel;
+    const TheEntitytainerEntity* parents_a    = entitytainer_a->entry_parent_lookup - channel;
+    const TheEntitytainerEntity* parents_b    = entitytainer_b->entry_parent_lookup - channel;
+    int                          entry_size   = (int)sizeof( TheEntitytainerEntry );
+    int                          parent_size  = (int)sizeof( TheEntitytainerEntity );
+    int                          entry_step   = entitytainer_a->entry_stride / entry_size;
+    int                          parent_step  = entitytainer_a->parent_stride / parent_size;
+    int                          num_ops      = 0;
+
+    // Up to the last entity's own columns, its record can end before the stride does.
+    int num_entry_elements  = ( num_entries - 1 ) * entry_step + num_channels;
+    int num_parent_elements = ( num_entries - 1 ) * parent_step + num_channels;
+
+    // Added entities first, so they can be parents for the links.
+    for ( int i = entitytainer__next_difference( entries_a, entries_b, 0, num_entry_elements, entry_size, true );
+          i < num_entry_elements;
+          i = entitytainer__next_difference( entries_a, entries_b, i + 1, num_entry_elements, entry_size, true ) ) {
+        if ( i % entry_step == channel && entries_b[i] != 0 ) {
+            if ( num_ops < max_ops ) {
+                entitytainer__record( &ops[num_ops],
+                                      ENTITYTAINER_JournalAddEntity,
+                                      channel,
+                                      (TheEntitytainerEntity)( i / entry_step ),
+                                      ENTITYTAINER_InvalidEntity,
+                                      ENTITYTAINER_InvalidEntity );
+            }
+
+            ++num_ops;
+        }
+    }
+
+    // With one parent per child, the parent lookup decides every child list, so the buckets don't need comparing.
+    for ( int i = entitytainer__next_difference( parents_a, parents_b, 0, num_parent_elements, parent_size, false );
+          i < num_parent_elements;
+          i = entitytainer__next_difference( parents_a, parents_b, i + 1, num_parent_elements, parent_size, false ) ) {
+        if ( i % parent_step != channel ) {
+            continue;
+        }
+
+        TheEntitytainerEntity parent_a = parents_a[i];
+        TheEntitytainerEntity parent_b = parents_b[i];
+        int                   op       = parent_a == ENTITYTAINER_InvalidEntity ? ENTITYTAINER_JournalAddChild
+                                         : parent_b == ENTITYTAINER_InvalidEntity ? ENTITYTAINER_JournalRemoveChild
+                                                                                  : ENTITYTAINER_JournalReparent;
+        if ( num_ops < max_ops ) {
+            entitytainer__record( &ops[num_ops],
+                                  op,
+                                  channel,
+                                  (TheEntitytainerEntity)( i / parent_step ),
+                                  op == ENTITYTAINER_JournalRemoveChild ? parent_a : parent_b,
+                                  op == ENTITYTAINER_JournalReparent ? parent_a : ENTITYTAINER_InvalidEntity );
+        }
+
+        ++num_ops;
+    }
+
+    // Removed entities last, when nothing has them as parent anymore.
+    for ( int i = entitytainer__next_difference( entries_a, entries_b, 0, num_entry_elements, entry_size, true );
+          i < num_entry_elements;
+          i = entitytainer__next_difference( entries_a, entries_b, i + 1, num_entry_elements, entry_size, true ) ) {
+        if ( i % entry_step == channel && entries_a[i] != 0 ) {
+            if ( num_ops < max_ops ) {
+                entitytainer__record( &ops[num_ops],
+                                      ENTITYTAINER_JournalRemoveEntity,
+                                      channel,
+                                      (TheEntitytainerEntity)( i / entry_step ),
+                                      ENTITYTAINER_InvalidEntity,
+                                      ENTITYTAINER_InvalidEntity );
+            }
+
+            ++num_ops;
+        }
+    }
+
+    return num_ops;
+}
+
+ENTITYTAINER_API void
+entitytainer_apply_records( TheEntitytainer*                    entitytainer,
+                            const TheEntitytainerJournalRecord* records,
+                            int                                 num_records ) {
+    TheEntitytainer* root = entitytainer - entitytainer->channel;
+    for ( int i = 0; i < num_records; ++i ) {
+        const TheEntitytainerJournalRecord* record = &records[i];
+        TheEntitytainer*                    target = entitytainer_get_channel( root, record->channel );
+        if ( record->op == ENTITYTAINER_JournalAddEntity ) {
+            entitytainer_add_entity( target, record->entity );
+        }
+        else if ( record->op == ENTITYTAINER_JournalRemoveEntity ) {
+            entitytainer_remove_entity( target, record->entity );
+        }
+        else if ( record->op == ENTITYTAINER_JournalAddChild ) {
+            entitytainer_add_child( target, record->parent, record->entity );
+        }
+        else if ( record->op == ENTITYTAINER_JournalRemoveChild && target->remove_with_holes ) {
+            entitytainer_remove_child_with_holes( target, record->parent, record->entity );
+        }
+        else if ( record->op == ENTITYTAINER_JournalRemoveChild ) {
+            entitytainer_remove_child_no_holes( target, record->parent, record->entity );
+        }
+        else {
+            ENTITYTAINER_assert( record->op == ENTITYTAINER_JournalReparent,
+                                 "Entitytainer[%s] Unknown record op %d.",
+                                 "",
+                                 record->op );
+            entitytainer_reparent( target, record->entity, record->parent );
+        }
+    }
+}
+
+ENTITYTAINER_API int
+entitytainer_validate_scratch_size( TheEntitytainer* entitytainer ) {
+    TheEntitytainer* root      = entitytainer - entitytainer->channel;
+    int              num_words = ( root->entry_lookup_size + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    for ( int i = 0; i < root->num_bucket_lists; ++i ) {
+        num_words += ( root->bucket_lists[i].total_buckets + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    }
+
+    return num_words * (int)sizeof( TheEntitytainerBitWord );
+}
+
+ENTITYTAINER_API bool
+entitytainer_validate( TheEntitytainer*           entitytainer,
+                       TheEntitytainerValidation* report,
+                       void*                      scratch,
+                       int                        scratch_size ) {
+    TheEntitytainer* root = entitytainer - entitytainer->channel;
+    int              size = entitytainer_validate_scratch_size( root );
+    ENTITYTAINER_assert( scratch_size >= size );
+    ENTITYTAINER_assert( entitytainer__ptr_to_aligned_ptr( scratch, (int)ENTITYTAINER_alignof( void* ) ) == scratch );
+    ENTITYTAINER_memset( scratch, 0, size );
+    ENTITYTAINER_memset( report, 0, sizeof( *report ) );
+    report->first_bucket_list = -1;
+
+    // A bit per entity for the children seen, then a bit per bucket for the ones that are free or someone's.
+    int entity_words = ( root->entry_lookup_size + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    TheEntitytainerBitWord* seen_children = (TheEntitytainerBitWord*)scratch;
+    TheEntitytainerBitWord* seen_buckets[ENTITYTAINER_MAX_BUCKET_LISTS];
+    int                     num_free[ENTITYTAINER_MAX_BUCKET_LISTS];
+    int                     num_owned[ENTITYTAINER_MAX_BUCKET_LISTS];
+    int                     end_buckets[ENTITYTAINER_MAX_BUCKET_LISTS];
+    TheEntitytainerBitWord* words = seen_children + entity_words;
+    for ( int i = 0; i < root->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &root->bucket_lists[i];
+        seen_buckets[i]                 = words;
+        words += ( list->total_buckets + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+        num_free[i]  = 0;
+        num_owned[i] = 0;
+        if ( i == 0 ) {
+            // Never handed out, so entry 0 can mean none.
+            entitytainer__test_and_set_bit( seen_buckets[i], 0 );
+            num_owned[i] = 1;
+        }
+
+        if ( list->free_bits != NULL ) {
+            for ( int i_word = 0; i_word < list->free_words; ++i_word ) {
+                TheEntitytainerBitWord word = list->free_bits[i_word];
+                while ( word != 0 ) {
+                    int bucket_index = i_word * ENTITYTAINER_BitWordBits + ENTITYTAINER_ctz64( word );
+                    word &= word - 1;
+                    if ( bucket_index >= list->committed_buckets ||
+                         entitytainer__test_and_set_bit( seen_buckets[i], bucket_index ) ) {
+                        entitytainer__report( report, &report->bad_free_lists, ENTITYTAINER_InvalidEntity, i );
+                        continue;
+                    }
+
+                    ++num_free[i];
+                }
+            }
+        }
+        else {
+            int bucket_index =
+              root->config.concurrent ? (int)( list->free_head & 0xffffffffu ) : list->first_free_bucket;
+            while ( bucket_index != (int)ENTITYTAINER_NoFreeBucket ) {
+                if ( bucket_index < 0 || bucket_index >= list->committed_buckets ||
+                     entitytainer__test_and_set_bit( seen_buckets[i], bucket_index ) ) {
+                    entitytainer__report( report, &report->bad_free_lists, ENTITYTAINER_InvalidEntity, i );
+                    break;
+                }
+
+                ++num_free[i];
+                bucket_index = *entitytainer__bucket( list, bucket_index );
+            }
+        }
+
+        // Buckets are taken from the free buckets first and then in order, so the ones in use or free are all below
+        // this. In concurrent mode it's the bump index.
+        end_buckets[i] = root->config.concurrent ? list->next_bucket : list->used_buckets + num_free[i];
+        end_buckets[i] = end_buckets[i] < list->committed_buckets ? end_buckets[i] : list->committed_buckets;
+    }
+
+    int num_lookups = root->config.multi_parent ? 2 : 1;
+    for ( int channel = 0; channel < entitytainer__num_channels( &root->config ); ++channel ) {
+        TheEntitytainer* channel_root = root + channel;
+        ENTITYTAINER_memset( seen_children, 0, entity_words * sizeof( TheEntitytainerBitWord ) );
+        for ( int entity = 0; entity < root->entry_lookup_size; ++entity ) {
+            // The children, and with multi_parent the parents, which are never left with holes.
+            for ( int i_lookup = 0; i_lookup < num_lookups; ++i_lookup ) {
+                TheEntitytainerEntry lookup = i_lookup == 0 ? *entitytainer__entry( channel_root, entity )
+                                                            : *entitytainer__parents_entry( channel_root, entity );
+                if ( lookup == 0 ) {
+                    continue;
+                }
+
+                int bucket_list_index = lookup >> root->bucket_list_offset;
+                int bucket_index      = lookup & root->bucket_mask;
+                if ( bucket_list_index >= root->num_bucket_lists || bucket_index >= end_buckets[bucket_list_index] ||
+                     entitytainer__test_and_set_bit( seen_buckets[bucket_list_index], bucket_index ) ) {
+                    entitytainer__report( report, &report->bad_entries, entity, bucket_list_index );
+                    continue;
+                }
+
+                ++num_owned[bucket_list_index];
+                TheEntitytainerBucketList* list      = &root->bucket_lists[bucket_list_index];
+                TheEntitytainerEntity*     bucket    = entitytainer__bucket( list, bucket_index );
+                bool                       holes     = channel_root->remove_with_holes && i_lookup == 0;
+                int                        num_slots = holes ? list->bucket_size - 1 : bucket[0];
+                if ( num_slots >= list->bucket_size ) {
+                    entitytainer__report( report, &report->wrong_counts, entity, bucket_list_index );
+                    continue;
+                }
+
+                int num_children = 0;
+                for ( int i_slot = 1; i_slot <= num_slots; ++i_slot ) {
+                    TheEntitytainerEntity child = bucket[i_slot];
+                    if ( child == ENTITYTAINER_InvalidEntity ) {
+                        continue;
+                    }
+
+                    ++num_children;
+                    if ( root->config.multi_parent ) {
+                        continue;
+                    }
+
+                    if ( child >= root->entry_lookup_size || entitytainer__test_and_set_bit( seen_children, child ) ) {
+                        entitytainer__report( report, &report->duplicate_children, entity, bucket_list_index );
+                    }
+                    else if ( *entitytainer__parent( channel_root, child ) != entity ) {
+                        entitytainer__report( report, &report->wrong_parents, entity, bucket_list_index );
+                    }
+                }
+
+                if ( num_children != bucket[0] ) {
+                    entitytainer__report( report, &report->wrong_counts, entity, bucket_list_index );
+                }
+            }
+        }
+
+        // Every child with a parent has to have been in it.
+        for ( int entity = 0; entity < root->entry_lookup_size && !root->config.multi_parent; ++entity ) {
+            TheEntitytainerBitWord word = seen_children[entity / ENTITYTAINER_BitWordBits];
+            bool                   seen = ( word >> ( entity % ENTITYTAINER_BitWordBits ) ) & 1;
+            if ( !seen && *entitytainer__parent( channel_root, entity ) != ENTITYTAINER_InvalidEntity ) {
+                entitytainer__report( report, &report->wrong_parents, entity, -1 );
+            }
+        }
+    }
+
+    // Buckets in threads' caches are neither free nor someone's, so they can't be told apart from lost ones.
+    for ( int i = 0; i < root->num_bucket_lists && !root->config.thread_bucket_caches; ++i ) {
+        if ( num_owned[i] != root->bucket_lists[i].used_buckets || num_owned[i] + num_free[i] != end_buckets[i] ) {
+            entitytainer__report( report, &report->wrong_used_buckets, ENTITYTAINER_InvalidEntity, i );
+        }
+    }
+
+    return report->num_problems == 0;
+}
+
+ENTITYTAINER_API TheEntitytainer*
+entitytainer_get_channel( TheEntitytainer* entitytainer, int channel ) {
+    ENTITYTAINER_assert( entitytainer->channel == 0 );
+    ENTITYTAINER_assert( channel >= 0 && channel < entitytainer__num_channels( &entitytainer->config ) );
+    return entitytainer + channel;
+}
+
+ENTITYTAINER_API TheEntitytainer*
+                 entitytainer_realloc( TheEntitytainer* entitytainer_old, void* memory, int memory_size, float growth ) {
+    ENTITYTAINER_assert( false ); // Not yet implemented
+    (void)memory_size;
+
+    int num_entries = entitytainer_old->entry_lookup_size; // * growth;
+    int size_needed = sizeof( TheEntitytainer );
+    size_needed += (int)( num_entries * sizeof( TheEntitytainerEntry ) );
+    size_needed += (int)( num_entries * sizeof( TheEntitytainerEntity ) );
+    size_needed += entitytainer_old->num_bucket_lists * sizeof( TheEntitytainerBucketList );
+
+    for ( int i = 0; i < entitytainer_old->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* bucket_list = &entitytainer_old->bucket_lists[i];
+        int old_bucket_size = bucket_list->total_buckets * bucket_list->bucket_size * sizeof( TheEntitytainerEntity );
+        size_needed += (int)( old_bucket_size * growth );
+    }
+
+    char* buffer = (char*)memory;
+
+    TheEntitytainer* entitytainer   = (TheEntitytainer*)buffer;
+    *entitytainer                   = *entitytainer_old;
+    entitytainer->entry_lookup_size = num_entries;
+    buffer += sizeof( TheEntitytainer );
+    entitytainer->entry_lookup = (TheEntitytainerEntry*)buffer;
+    buffer += sizeof( TheEntitytainerEntry ) * num_entries;
+    entitytainer->entry_parent_lookup = (TheEntitytainerEntity*)buffer;
+    buffer += sizeof( TheEntitytainerEntity ) * num_entries;
+
+    // char* bucket_data = buffer + sizeof( TheEntitytainerBucketList ) * entitytainer_old->num_bucket_lists;
+    // for ( int i = 0; i < entitytainer_old->num_bucket_lists; ++i ) {
+    //     // ENTITYTAINER_assert( bucket_data - buffer > bucket_sizes[i] * bucket_list_sizes[i] ); // >= ?
+    //     TheEntitytainerBucketList* list = (TheEntitytainerBucketList*)buffer;
+    //     list->bucket_data                   = bucket_data;
+    //     list->bucket_size               = entitytainer_old->bucket_lists[i].bucket_size;
+    //     list->total_buckets             = entitytainer_old->bucket_lists[i].total_buckets;
+    //     list->first_free_bucket         = entitytainer_old->bucket_lists[i].first_free_bucket;
+    //     list->used_buckets              = entitytainer_old->bucket_lists[i].used_buckets;
+
+    //     int old_buffer_size = entitytainer_old->bucket_lists[i].total_buckets * sizeof( TheEntitytainerEntry );
+    //     ENTITYTAINER_memcpy( list->bucket_data, entitytainer_old->bucket_lists[i].bucket_data, old_buffer_size );
+    //     buffer += sizeof( TheEntitytainerBucketList );
+    //     bucket_data += list->bucket_size * list->total_buckets;
+    // }
+
+    // ENTITYTAINER_assert( bucket_data == buffer + buffer_size );
+    return entitytainer;
+}
+
+ENTITYTAINER_API bool
+entitytainer_needs_realloc( TheEntitytainer* entitytainer, float percent_free, int num_free_buckets ) {
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        // ENTITYTAINER_assert( bucket_data - buffer > bucket_sizes[i] * bucket_list_sizes[i] ); // >= ?
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        if ( percent_free >= 0 ) {
+            num_free_buckets = (int)( list->total_buckets * percent_free );
+        }
+
+        if ( list->total_buckets - list->used_buckets <= num_free_buckets ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ENTITYTAINER_API void
+entitytainer_add_entity( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    ENTITYTAINER_assert( *entitytainer__entry( entitytainer, entity ) == 0,
+                         "Entitytainer[%s] Tried to add entity " ENTITYTAINER_EntityFormat " but it was already added.",
+                         "",
+                         entity );
+
+    // A full first list grows through config.allocate. Without an allocator, running out of buckets is an assert.
+    int bucket_index = entitytainer__alloc_bucket( entitytainer, &entitytainer->bucket_lists[0] );
+
+    TheEntitytainerEntry* lookup = entitytainer__entry( entitytainer, entity );
+    ENTITYTAINER_assert( *lookup == 0 );
+    entitytainer__store_entry( entitytainer, lookup, entitytainer__make_entry( entitytainer, 0, bucket_index ) );
+    if ( entitytainer->config.preorder_index ) {
+        entitytainer->preorder_dirty = true;
+    }
+
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalAddEntity, entity, 0, 0 );
+}
+
+ENTITYTAINER_API void
+entitytainer_remove_entity( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, entity );
+
+    // With multi_parent the child is removed from all its parents.
+    TheEntitytainerEntity parent;
+    while ( ( parent = entitytainer_get_parent( entitytainer, entity ) ) != ENTITYTAINER_InvalidEntity ) {
+        if ( entitytainer->remove_with_holes ) {
+            entitytainer_remove_child_with_holes( entitytainer, parent, entity );
+        }
+        else {
+            entitytainer_remove_child_no_holes( entitytainer, parent, entity );
+        }
+
+        lookup = *entitytainer__entry( entitytainer, entity );
+    }
+
+    if ( entitytainer->config.dirty_tracking ) {
+        entitytainer->dirty_bits[entity / ENTITYTAINER_BitWordBits] &=
+          ~( (TheEntitytainerBitWord)1 << ( entity % ENTITYTAINER_BitWordBits ) );
+    }
+
+    if ( lookup == 0 ) {
+        // lookup is 0 for entities that don't have children (or haven't been added by _add_entity)
+        return;
+    }
+
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    ENTITYTAINER_assert( bucket[0] == 0,
+                         "Entitytainer[%s] Tried to remove " ENTITYTAINER_EntityFormat
+                         " but it still had children. First child=" ENTITYTAINER_EntityFormat,
+                         "",
+                         entity,
+                         bucket[1] );
+    entitytainer__free_bucket( entitytainer, bucket_list, lookup & entitytainer->bucket_mask );
+
+    entitytainer__store_entry( entitytainer, entitytainer__entry( entitytainer, entity ), 0 );
+    if ( entitytainer->config.preorder_index ) {
+        entitytainer->preorder_dirty = true;
+    }
+
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalRemoveEntity, entity, 0, 0 );
+}
+
+ENTITYTAINER_API void
+entitytainer_reserve( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, int capacity ) {
+    TheEntitytainerEntry* lookup = entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( *lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    entitytainer__get_bucket( entitytainer, *lookup, &bucket_list );
+    if ( bucket_list->bucket_size > capacity ) {
+        return;
+    }
+
+    int bucket_list_index_new = -1;
+    for ( int i_bl = 0; i_bl < entitytainer->num_bucket_lists; ++i_bl ) {
+        if ( entitytainer->bucket_lists[i_bl].bucket_size > capacity ) {
+            bucket_list_index_new = i_bl;
+            break;
+        }
+    }
+
+    ENTITYTAINER_assert( bucket_list_index_new != -1 );
+    entitytainer__move_bucket( entitytainer, lookup, bucket_list_index_new );
+}
+
+ENTITYTAINER_API void
+entitytainer_add_child( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, TheEntitytainerEntity child ) {
+    entitytainer_add_child_with_payload( entitytainer, parent, child, NULL );
+}
+
+ENTITYTAINER_API void
+entitytainer_add_child_with_payload( TheEntitytainer*      entitytainer,
+                                     TheEntitytainerEntity parent,
+                                     TheEntitytainerEntity child,
+                                     const void*           payload ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0,
+                         "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
+                         " as child to " ENTITYTAINER_EntityFormat " who was not added.",
+                         "",
+                         child,
+                         parent );
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS || ENTITYTAINER_DEFENSIVE_CHECKS
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS
+    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ),
+                         "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
+                         " as child to " ENTITYTAINER_EntityFormat " but it was already its child.",
+                         "",
+                         child,
+                         parent );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_CHECKS
+    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
+        ENTITYTAINER_assert( entitytainer_get_parent( entitytainer, child ) == parent );
+        return;
+    }
+#endif
+
+    entitytainer__insert_child( entitytainer, parent, child, payload );
+
+    entitytainer__link_parent( entitytainer, parent, child );
+    entitytainer__on_link( entitytainer, parent, child );
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalAddChild, child, parent, 0 );
+}
+
+ENTITYTAINER_API void
+entitytainer_add_child_at_index( TheEntitytainer*      entitytainer,
+                                 TheEntitytainerEntity parent,
+                                 TheEntitytainerEntity child,
+                                 int                   index ) {
+    ENTITYTAINER_assert( !entitytainer->config.sorted_children );
+    TheEntitytainerEntry* lookup = entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( *lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket_for_write( entitytainer, *lookup, &bucket_list );
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS
+    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_CHECKS
+    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
+        ENTITYTAINER_assert( entitytainer_get_parent( entitytainer, child ) == parent );
+        return;
+    }
+#endif
+
+    if ( index + 1 >= bucket_list->bucket_size ) {
+        // Skip past any bucket lists that are still too small
+        int bucket_list_index_new = (int)( bucket_list - entitytainer->bucket_lists );
+        while ( bucket_list_index_new + 1 < entitytainer->num_bucket_lists &&
+                index + 1 >= entitytainer->bucket_lists[bucket_list_index_new].bucket_size ) {
+            ++bucket_list_index_new;
+        }
+
+        // No bucket lists with buckets of this size
+        ENTITYTAINER_assert( index + 1 < entitytainer->bucket_lists[bucket_list_index_new].bucket_size );
+        bucket      = entitytainer__move_bucket( entitytainer, lookup, bucket_list_index_new );
+        bucket_list = entitytainer->bucket_lists + bucket_list_index_new;
+    }
+
+    // Update count and insert child into bucket
+    ENTITYTAINER_assert( bucket[index + 1] == ENTITYTAINER_InvalidEntity );
+    TheEntitytainerEntity count = bucket[0] + (TheEntitytainerEntity)1;
+    entitytainer__store_link( bucket, count );
+    bucket[index + 1]           = child;
+    entitytainer__set_payload( entitytainer, bucket_list, *lookup, index + 1, NULL );
+    if ( entitytainer->remove_with_holes ) {
+        TheEntitytainerBitWord* slot_bits = entitytainer__slot_bits( entitytainer, bucket_list, *lookup );
+        slot_bits[index / ENTITYTAINER_BitWordBits] |=
+          (TheEntitytainerBitWord)1 << ( index % ENTITYTAINER_BitWordBits );
+    }
+
+    entitytainer__link_parent( entitytainer, parent, child );
+    entitytainer__on_link( entitytainer, parent, child );
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalAddChild, child, parent, 0 );
+}
+
+ENTITYTAINER_API void
+entitytainer_remove_child_no_holes( TheEntitytainer*      entitytainer,
+                                    TheEntitytainerEntity parent,
+                                    TheEntitytainerEntity child ) {
+    ENTITYTAINER_assert( !entitytainer->remove_with_holes );
+    entitytainer__remove_child( entitytainer, parent, child );
+
+    // Clear entry
+    entitytainer__unlink_parent( entitytainer, parent, child );
+    entitytainer__on_unlink( entitytainer, child );
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalRemoveChild, child, parent, 0 );
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS || ENTITYTAINER_DEFENSIVE_CHECKS
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket =
+      entitytainer__get_bucket( entitytainer, *entitytainer__entry( entitytainer, parent ), &bucket_list );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS
+    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_CHECKS
+    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
+        entitytainer_remove_child_no_holes( entitytainer, parent, child );
+    }
+#endif
+
+    if ( !entitytainer->keep_capacity_on_remove ) {
+        entitytainer__shrink( entitytainer, parent );
+    }
+}
+
+ENTITYTAINER_API void
+entitytainer_remove_child_with_holes( TheEntitytainer*      entitytainer,
+                                      TheEntitytainerEntity parent,
+                                      TheEntitytainerEntity child ) {
+    ENTITYTAINER_assert( entitytainer->remove_with_holes );
+    entitytainer__remove_child( entitytainer, parent, child );
+
+    // Clear entry
+    entitytainer__unlink_parent( entitytainer, parent, child );
+    entitytainer__on_unlink( entitytainer, child );
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalRemoveChild, child, parent, 0 );
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS || ENTITYTAINER_DEFENSIVE_CHECKS
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket =
+      entitytainer__get_bucket( entitytainer, *entitytainer__entry( entitytainer, parent ), &bucket_list );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_ASSERTS
+    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ),
+                         "Entitytainer[%s] Removed child " ENTITYTAINER_EntityFormat
+                         " from parent " ENTITYTAINER_EntityFormat ", but it was still its child.",
+                         "",
+                         child,
+                         parent );
+#endif
+
+#if ENTITYTAINER_DEFENSIVE_CHECKS
+    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
+        entitytainer_remove_child_with_holes( entitytainer, parent, child );
+    }
+#endif
+
+    if ( !entitytainer->keep_capacity_on_remove ) {
+        entitytainer__shrink( entitytainer, parent );
+    }
+}
+
+ENTITYTAINER_API void
+entitytainer_reparent( TheEntitytainer* entitytainer, TheEntitytainerEntity child, TheEntitytainerEntity new_parent ) {
+    ENTITYTAINER_assert( !entitytainer->config.multi_parent );
+    TheEntitytainerEntity old_parent = *entitytainer__parent( entitytainer, child );
+    if ( old_parent == new_parent ) {
+        return;
+    }
+
+    // Inserted before it's removed, so the payload can be copied straight from the old slot.
+    if ( new_parent != ENTITYTAINER_InvalidEntity ) {
+        ENTITYTAINER_assert( *entitytainer__entry( entitytainer, new_parent ) != 0,
+                             "Entitytainer[%s] Tried to move " ENTITYTAINER_EntityFormat
+                             " to " ENTITYTAINER_EntityFormat " who was not added.",
+                             "",
+                             child,
+                             new_parent );
+        entitytainer__insert_child( entitytainer, new_parent, child, NULL );
+        entitytainer__copy_child_payload( entitytainer, old_parent, new_parent, child );
+    }
+
+    if ( old_parent != ENTITYTAINER_InvalidEntity ) {
+        entitytainer__remove_child( entitytainer, old_parent, child );
+        if ( !entitytainer->keep_capacity_on_remove ) {
+            entitytainer__shrink( entitytainer, old_parent );
+        }
+
+        entitytainer__on_unlink( entitytainer, child );
+    }
+
+    // Written once, so the child never appears parentless to a reader in the middle of the move.
+    *entitytainer__parent( entitytainer, child ) = new_parent;
+    if ( new_parent != ENTITYTAINER_InvalidEntity ) {
+        entitytainer__on_link( entitytainer, new_parent, child );
+    }
+
+    entitytainer__journal( entitytainer, ENTITYTAINER_JournalReparent, child, new_parent, old_parent );
+}
+
+ENTITYTAINER_API void
+entitytainer_reparent_batch( TheEntitytainer*             entitytainer,
+                             TheEntitytainerEntity        old_parent,
+                             TheEntitytainerEntity        new_parent,
+                             const TheEntitytainerEntity* children,
+                             int                          num_children ) {
+    ENTITYTAINER_assert( !entitytainer->config.multi_parent );
+    if ( old_parent == new_parent || num_children == 0 ) {
+        return;
+    }
+
+    // Grow the new parent once up front, and shrink the old one once at the end.
+    if ( new_parent != ENTITYTAINER_InvalidEntity ) {
+        int capacity = entitytainer_num_children( entitytainer, new_parent ) + num_children;
+        entitytainer_reserve( entitytainer, new_parent, capacity );
+    }
+
+    for ( int i = 0; i < num_children; ++i ) {
+        TheEntitytainerEntity child = children[i];
+        ENTITYTAINER_assert( *entitytainer__parent( entitytainer, child ) == old_parent );
+        if ( new_parent != ENTITYTAINER_InvalidEntity ) {
+            entitytainer__insert_child( entitytainer, new_parent, child, NULL );
+            entitytainer__copy_child_payload( entitytainer, old_parent, new_parent, child );
+        }
+
+        if ( old_parent != ENTITYTAINER_InvalidEntity ) {
+            entitytainer__remove_child( entitytainer, old_parent, child );
+            entitytainer__on_unlink( entitytainer, child );
+        }
+
+        *entitytainer__parent( entitytainer, child ) = new_parent;
+        if ( new_parent != ENTITYTAINER_InvalidEntity ) {
+            entitytainer__on_link( entitytainer, new_parent, child );
+        }
+
+        entitytainer__journal( entitytainer, ENTITYTAINER_JournalReparent, child, new_parent, old_parent );
+    }
+
+    if ( old_parent != ENTITYTAINER_InvalidEntity && !entitytainer->keep_capacity_on_remove ) {
+        entitytainer__shrink( entitytainer, old_parent );
+    }
+}
+
+ENTITYTAINER_API int
+entitytainer_remove_subtree( TheEntitytainer*       entitytainer,
+                             TheEntitytainerEntity  root,
+                             TheEntitytainerEntity* removed_out,
+                             int                    capacity ) {
+    ENTITYTAINER_assert( !entitytainer->config.multi_parent );
+    TheEntitytainerEntity root_parent = *entitytainer__parent( entitytainer, root );
+    if ( root_parent != ENTITYTAINER_InvalidEntity ) {
+        entitytainer__remove_child( entitytainer, root_parent, root );
+        if ( !entitytainer->keep_capacity_on_remove ) {
+            entitytainer__shrink( entitytainer, root_parent );
+        }
+
+        entitytainer__journal( entitytainer, ENTITYTAINER_JournalRemoveChild, root, root_parent, 0 );
+    }
+
+    // Post-order walk that uses the parent lookup as its stack. Children are popped off the back of buckets that are
+    // about to be freed anyway, so nothing is shifted or demoted on the way.
+    int                   num_removed = 0;
+    TheEntitytainerEntity entity      = root;
+    for ( ;; ) {
+        TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, entity );
+        if ( lookup != 0 ) {
+            TheEntitytainerBucketList* bucket_list;
+            TheEntitytainerEntity*     bucket =
+              entitytainer__get_bucket_for_write( entitytainer, lookup, &bucket_list );
+            if ( bucket[0] > 0 ) {
+                int i = entitytainer->remove_with_holes ? bucket_list->bucket_size - 1 : bucket[0];
+                while ( bucket[i] == ENTITYTAINER_InvalidEntity ) {
+                    --i;
+                }
+
+                TheEntitytainerEntity child = bucket[i];
+                bucket[i]                   = ENTITYTAINER_InvalidEntity;
+                entitytainer__store_link( bucket, bucket[0] - (TheEntitytainerEntity)1 );
+                entitytainer__journal( entitytainer, ENTITYTAINER_JournalRemoveChild, child, entity, 0 );
+                entity = child;
+                continue;
+            }
+
+            entitytainer__free_bucket( entitytainer, bucket_list, lookup & entitytainer->bucket_mask );
+            entitytainer__store_entry( entitytainer, entitytainer__entry( entitytainer, entity ), 0 );
+            entitytainer__journal( entitytainer, ENTITYTAINER_JournalRemoveEntity, entity, 0, 0 );
+        }
+
+        if ( entitytainer->config.dirty_tracking ) {
+            entitytainer->dirty_bits[entity / ENTITYTAINER_BitWordBits] &=
+              ~( (TheEntitytainerBitWord)1 << ( entity % ENTITYTAINER_BitWordBits ) );
+        }
+
+        if ( num_removed < capacity ) {
+            removed_out[num_removed] = entity;
+        }
+
+        ++num_removed;
+        if ( entity == root ) {
+            break;
+        }
+
+        TheEntitytainerEntity parent                  = *entitytainer__parent( entitytainer, entity );
+        *entitytainer__parent( entitytainer, entity ) = ENTITYTAINER_InvalidEntity;
+        entity                                        = parent;
+    }
+
+    *entitytainer__parent( entitytainer, root ) = ENTITYTAINER_InvalidEntity;
+    if ( entitytainer->config.preorder_index ) {
+        entitytainer->preorder_dirty = true;
+    }
+
+    if ( entitytainer->config.ancestry_levels > 0 ) {
+        entitytainer->ancestry_dirty = true;
+    }
+
+    return num_removed;
+}
+
+ENTITYTAINER_API void
+entitytainer_get_children( TheEntitytainer*        entitytainer,
+                           TheEntitytainerEntity   parent,
+                           TheEntitytainerEntity** children,
+                           int*                    num_children,
+                           int*                    capacity ) {
+
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    *num_children                     = (int)bucket[0];
+    *children                         = bucket + 1;
+    *capacity                         = bucket_list->bucket_size - 1;
+}
+
+ENTITYTAINER_API void
+entitytainer_get_children_with_payload( TheEntitytainer*        entitytainer,
+                                        TheEntitytainerEntity   parent,
+                                        TheEntitytainerEntity** children,
+                                        void**                  payloads,
+                                        int*                    num_children,
+                                        int*                    capacity ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket_for_write( entitytainer, lookup, &bucket_list );
+    *num_children                     = (int)bucket[0];
+    *children                         = bucket + 1;
+    *payloads                         = entitytainer__payload( entitytainer, bucket_list, lookup, 1 );
+    *capacity                         = bucket_list->bucket_size - 1;
+}
+
+ENTITYTAINER_API void*
+entitytainer_get_child_payload( TheEntitytainer*      entitytainer,
+                                TheEntitytainerEntity parent,
+                                TheEntitytainerEntity child ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket_for_write( entitytainer, lookup, &bucket_list );
+    if ( bucket_list->payload_data == NULL ) {
+        return NULL;
+    }
+
+    int slot = 1;
+    if ( entitytainer->config.sorted_children ) {
+        slot += entitytainer__lower_bound( bucket + 1, bucket[0], child );
+    }
+    else {
+        // With holes the children can be anywhere in the bucket.
+        int num_slots = entitytainer->remove_with_holes ? bucket_list->bucket_size : bucket[0] + 1;
+        while ( slot < num_slots && bucket[slot] != child ) {
+            ++slot;
+        }
+    }
+
+    ENTITYTAINER_assert( slot < bucket_list->bucket_size && bucket[slot] == child );
+    return entitytainer__payload( entitytainer, bucket_list, lookup, slot );
+}
+
+ENTITYTAINER_API int
+entitytainer_num_children( TheEntitytainer* entitytainer, TheEntitytainerEntity parent ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    return (int)bucket[0];
+}
+
+ENTITYTAINER_API int
+entitytainer_get_child_index( TheEntitytainer*      entitytainer,
+                              TheEntitytainerEntity parent,
+                              TheEntitytainerEntity child ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket       = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    int                        num_children = (int)bucket[0];
+    if ( entitytainer->config.sorted_children ) {
+        int index = entitytainer__lower_bound( bucket + 1, num_children, child );
+        return index < num_children && bucket[1 + index] == child ? index : -1;
+    }
+
+    for ( int i = 0; i < num_children; ++i ) {
+        if ( bucket[1 + i] == child ) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+ENTITYTAINER_API int
+entitytainer_intersect_children( TheEntitytainer*       entitytainer,
+                                 TheEntitytainerEntity  parent_a,
+                                 TheEntitytainerEntity  parent_b,
+                                 TheEntitytainerEntity* out,
+                                 int                    capacity ) {
+    ENTITYTAINER_assert( entitytainer->config.sorted_children );
+    TheEntitytainerEntry lookup_a = *entitytainer__entry( entitytainer, parent_a );
+    TheEntitytainerEntry lookup_b = *entitytainer__entry( entitytainer, parent_b );
+    ENTITYTAINER_assert( lookup_a != 0 && lookup_b != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     a     = entitytainer__get_bucket( entitytainer, lookup_a, &bucket_list );
+    TheEntitytainerEntity*     b     = entitytainer__get_bucket( entitytainer, lookup_b, &bucket_list );
+    int                        i_a   = 1;
+    int                        i_b   = 1;
+    int                        count = 0;
+    while ( i_a <= a[0] && i_b <= b[0] && count < capacity ) {
+        if ( a[i_a] < b[i_b] ) {
+            ++i_a;
+        }
+        else if ( b[i_b] < a[i_a] ) {
+            ++i_b;
+        }
+        else {
+            out[count++] = a[i_a];
+            ++i_a;
+            ++i_b;
+        }
+    }
+
+    return count;
+}
+
+ENTITYTAINER_API int
+entitytainer_difference_children( TheEntitytainer*       entitytainer,
+                                  TheEntitytainerEntity  parent_a,
+                                  TheEntitytainerEntity  parent_b,
+                                  TheEntitytainerEntity* out,
+                                  int                    capacity ) {
+    ENTITYTAINER_assert( entitytainer->config.sorted_children );
+    TheEntitytainerEntry lookup_a = *entitytainer__entry( entitytainer, parent_a );
+    TheEntitytainerEntry lookup_b = *entitytainer__entry( entitytainer, parent_b );
+    ENTITYTAINER_assert( lookup_a != 0 && lookup_b != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     a     = entitytainer__get_bucket( entitytainer, lookup_a, &bucket_list );
+    TheEntitytainerEntity*     b     = entitytainer__get_bucket( entitytainer, lookup_b, &bucket_list );
+    int                        i_a   = 1;
+    int                        i_b   = 1;
+    int                        count = 0;
+    while ( i_a <= a[0] && count < capacity ) {
+        if ( i_b > b[0] || a[i_a] < b[i_b] ) {
+            out[count++] = a[i_a];
+            ++i_a;
+        }
+        else if ( b[i_b] < a[i_a] ) {
+            ++i_b;
+        }
+        else {
+            ++i_a;
+            ++i_b;
+        }
+    }
+
+    return count;
+}
+
+ENTITYTAINER_API TheEntitytainerEntity
+entitytainer_get_parent( TheEntitytainer* entitytainer, TheEntitytainerEntity child ) {
+    if ( entitytainer->config.multi_parent ) {
+        TheEntitytainerEntry lookup = *entitytainer__parents_entry( entitytainer, child );
+        if ( lookup == 0 ) {
+            return ENTITYTAINER_InvalidEntity;
+        }
+
+        TheEntitytainerBucketList* bucket_list;
+        return entitytainer__get_bucket( entitytainer, lookup, &bucket_list )[1];
+    }
+
+    TheEntitytainerEntity parent = *entitytainer__parent( entitytainer, child );
+    return parent;
+}
+
+ENTITYTAINER_API void
+entitytainer_get_parents( TheEntitytainer*        entitytainer,
+                          TheEntitytainerEntity   child,
+                          TheEntitytainerEntity** parents,
+                          int*                    num_parents ) {
+    ENTITYTAINER_assert( entitytainer->config.multi_parent );
+    TheEntitytainerEntry lookup = *entitytainer__parents_entry( entitytainer, child );
+    if ( lookup == 0 ) {
+        *parents     = NULL;
+        *num_parents = 0;
+        return;
+    }
+
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    *parents                          = bucket + 1;
+    *num_parents                      = (int)bucket[0];
+}
+
+ENTITYTAINER_API int
+entitytainer_num_parents( TheEntitytainer* entitytainer, TheEntitytainerEntity child ) {
+    TheEntitytainerEntity* parents;
+    int                    num_parents;
+    entitytainer_get_parents( entitytainer, child, &parents, &num_parents );
+    return num_parents;
+}
+
+ENTITYTAINER_API bool
+entitytainer_is_added( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, entity );
+    return lookup != 0;
+}
+
+ENTITYTAINER_API void
+entitytainer_get_child_slots( TheEntitytainer*               entitytainer,
+                              TheEntitytainerEntity          parent,
+                              const TheEntitytainerBitWord** slot_bits,
+                              int*                           num_words ) {
+    ENTITYTAINER_assert( entitytainer->remove_with_holes );
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    *slot_bits = entitytainer__slot_bits( entitytainer, bucket_list, lookup );
+    *num_words = bucket_list->slot_words;
+}
+
+ENTITYTAINER_API int
+entitytainer_copy_children_dense( TheEntitytainer*       entitytainer,
+                                  TheEntitytainerEntity  parent,
+                                  TheEntitytainerEntity* out ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket       = entitytainer__get_bucket( entitytainer, lookup, &bucket_list );
+    int                        num_children = (int)bucket[0];
+    if ( !entitytainer->remove_with_holes ) {
+        ENTITYTAINER_memcpy( out, bucket + 1, num_children * sizeof( TheEntitytainerEntity ) );
+        return num_children;
+    }
+
+    // The slot bits are the compress mask. Full words are copied in one go, others four slots at a time with pshufb
+    // while whole blocks can be loaded from the bucket and stored to out, and one set bit at a time after that.
+    const TheEntitytainerBitWord* slot_bits = entitytainer__slot_bits( entitytainer, bucket_list, lookup );
+    const TheEntitytainerEntity*  children  = bucket + 1;
+    int                           count     = 0;
+    for ( int i_word = 0; i_word < bucket_list->slot_words && count < num_children; ++i_word ) {
+        TheEntitytainerBitWord word = slot_bits[i_word];
+        int                    base = i_word * ENTITYTAINER_BitWordBits;
+        if ( ~word == 0 ) {
+            ENTITYTAINER_memcpy(
+              out + count, children + base, ENTITYTAINER_BitWordBits * sizeof( TheEntitytainerEntity ) );
+            count += ENTITYTAINER_BitWordBits;
+            continue;
+        }
+
+#if ENTITYTAINER_SSSE3
+        if ( sizeof( TheEntitytainerEntity ) == 4 || sizeof( TheEntitytainerEntity ) == 2 ) {
+            int i_slot    = 0;
+            int num_slots = bucket_list->bucket_size - 1;
+            while ( i_slot < ENTITYTAINER_BitWordBits && ( word >> i_slot ) != 0 && base + i_slot + 4 <= num_slots &&
+                    count + 4 <= num_children ) {
+                unsigned int mask = (unsigned int)( word >> i_slot ) & 0xf;
+                count += entitytainer__compress4( children + base + i_slot, mask, out + count );
+                i_slot += 4;
+            }
+
+            word = i_slot < ENTITYTAINER_BitWordBits ? word & ( ~(TheEntitytainerBitWord)0 << i_slot ) : 0;
+        }
+#endif
+
+        while ( word != 0 ) {
+            out[count++] = children[base + ENTITYTAINER_ctz64( word )];
+            word &= word - 1;
+        }
+    }
+
+    ENTITYTAINER_assert( count == num_children );
+    return count;
+}
+
+ENTITYTAINER_API void
+entitytainer_remove_holes( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    // TODO
+    ENTITYTAINER_assert( false );
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, entity );
+    ENTITYTAINER_assert( lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket =
+      entitytainer__get_bucket_for_write( entitytainer, lookup, &bucket_list );
+    int                        first_free_index = 1;
+    for ( int i = 1; i < bucket_list->bucket_size; ++i ) {
+        TheEntitytainerEntity child = bucket[i];
+        if ( child != ENTITYTAINER_InvalidEntity ) {
+            for ( int i_free = first_free_index; i_free < i; ++i_free ) {
+                if ( bucket[i_free] == ENTITYTAINER_InvalidEntity ) {
+                    first_free_index = i_free + 1;
+                    bucket[i_free]   = child;
+                    bucket[i]        = ENTITYTAINER_InvalidEntity;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void
+entitytainer__ancestry_rebuild( TheEntitytainer* entitytainer ) {
+    // Depths first. Walk up from each entity until we hit one whose depth is known (or fall off the root), then walk
+    // the same path again and fill it in. Every entity is filled in exactly once so this is linear.
+    const TheEntitytainerEntity unknown = (TheEntitytainerEntity)-1;
+    TheEntitytainerEntity*      depths  = entitytainer->entry_depth_lookup;
+    int                         levels  = entitytainer->config.ancestry_levels;
+    int                         count   = entitytainer->entry_lookup_size;
+    for ( int i = 0; i < count; ++i ) {
+        depths[i] = unknown;
+    }
+
+    depths[ENTITYTAINER_InvalidEntity] = 0;
+    for ( int i = 1; i < count; ++i ) {
+        int                   steps    = 0;
+        TheEntitytainerEntity ancestor = (TheEntitytainerEntity)i;
+        while ( ancestor != ENTITYTAINER_InvalidEntity && depths[ancestor] == unknown ) {
+            ancestor = *entitytainer__parent( entitytainer, ancestor );
+            ++steps;
+        }
+
+        int depth = ancestor == ENTITYTAINER_InvalidEntity ? steps - 1 : depths[ancestor] + steps;
+        ancestor  = (TheEntitytainerEntity)i;
+        while ( ancestor != ENTITYTAINER_InvalidEntity && depths[ancestor] == unknown ) {
+            depths[ancestor] = (TheEntitytainerEntity)depth--;
+            ancestor         = *entitytainer__parent( entitytainer, ancestor );
+        }
+    }
+
+    // Then the jump tables, one level at a time since each level is built from the one below it.
+    TheEntitytainerEntity* ancestors = entitytainer->entry_ancestor_lookup;
+    for ( int i = 0; i < count; ++i ) {
+        ancestors[i * levels] = *entitytainer__parent( entitytainer, i );
+    }
+
+    for ( int level = 1; level < levels; ++level ) {
+        for ( int i = 0; i < count; ++i ) {
+            TheEntitytainerEntity halfway = ancestors[i * levels + level - 1];
+            ancestors[i * levels + level] = ancestors[halfway * levels + level - 1];
+        }
+    }
+
+    entitytainer->ancestry_dirty = false;
+}
+
+static TheEntitytainerEntity
+entitytainer__ancestry_lift( TheEntitytainer* entitytainer, TheEntitytainerEntity entity, int distance ) {
+    TheEntitytainerEntity* ancestors = entitytainer->entry_ancestor_lookup;
+    int                    levels    = entitytainer->config.ancestry_levels;
+    int                    top       = levels - 1;
+    while ( distance >= ( 1 << top ) ) {
+        entity = ancestors[entity * levels + top];
+        distance -= 1 << top;
+    }
+
+    for ( int level = 0; distance != 0; ++level, distance >>= 1 ) {
+        if ( distance & 1 ) {
+            entity = ancestors[entity * levels + level];
+        }
+    }
+
+    return entity;
+}
+
+ENTITYTAINER_API int
+entitytainer_get_depth( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    ENTITYTAINER_assert( entitytainer->config.ancestry_levels > 0 );
+    if ( entitytainer->ancestry_dirty ) {
+        entitytainer__ancestry_rebuild( entitytainer );
+    }
+
+    return entitytainer->entry_depth_lookup[entity];
+}
+
+ENTITYTAINER_API TheEntitytainerEntity
+entitytainer_get_root( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    int depth = entitytainer_get_depth( entitytainer, entity );
+    return entitytainer__ancestry_lift( entitytainer, entity, depth );
+}
+
+ENTITYTAINER_API bool
+entitytainer_is_ancestor( TheEntitytainer*      entitytainer,
+                          TheEntitytainerEntity ancestor,
+                          TheEntitytainerEntity entity ) {
+    int depth_ancestor = entitytainer_get_depth( entitytainer, ancestor );
+    int depth_entity   = entitytainer_get_depth( entitytainer, entity );
+    if ( depth_entity <= depth_ancestor ) {
+        return false;
+    }
+
+    return entitytainer__ancestry_lift( entitytainer, entity, depth_entity - depth_ancestor ) == ancestor;
+}
+
+ENTITYTAINER_API TheEntitytainerEntity
+entitytainer_lowest_common_ancestor( TheEntitytainer*      entitytainer,
+                                     TheEntitytainerEntity entity_a,
+                                     TheEntitytainerEntity entity_b ) {
+    int depth_a = entitytainer_get_depth( entitytainer, entity_a );
+    int depth_b = entitytainer_get_depth( entitytainer, entity_b );
+    if ( depth_a > depth_b ) {
+        entity_a = entitytainer__ancestry_lift( entitytainer, entity_a, depth_a - depth_b );
+    }
+    else {
+        entity_b = entitytainer__ancestry_lift( entitytainer, entity_b, depth_b - depth_a );
+    }
+
+    if ( entity_a == entity_b ) {
+        return entity_a;
+    }
+
+    // Same depth now, so jump both as long as the jump lands on different entities. If they're in different trees
+    // we end up at two different roots whose parent is the invalid entity.
+    TheEntitytainerEntity* ancestors = entitytainer->entry_ancestor_lookup;
+    int                    levels    = entitytainer->config.ancestry_levels;
+    while ( ancestors[entity_a * levels + levels - 1] != ancestors[entity_b * levels + levels - 1] ) {
+        entity_a = ancestors[entity_a * levels + levels - 1];
+        entity_b = ancestors[entity_b * levels + levels - 1];
+    }
+
+    for ( int level = levels - 1; level >= 0; --level ) {
+        if ( ancestors[entity_a * levels + level] != ancestors[entity_b * levels + level] ) {
+            entity_a = ancestors[entity_a * levels + level];
+            entity_b = ancestors[entity_b * levels + level];
+        }
+    }
+
+    return ancestors[entity_a * levels];
+}
+
+static void
+entitytainer__preorder_rebuild( TheEntitytainer* entitytainer ) {
+    // No scratch memory needed, the output arrays double as work space:
+    // 1. Breadth first traversal into parent_indices, used as a queue of entities.
+    // 2. Subtree sizes per entity into the entity lookup, accumulated backwards through the queue.
+    // 3. Place every entity, in queue order. A parent is placed before its children and knows where each child's
+    //    subtree starts from the sizes of its earlier siblings. The entity lookup turns into entity -> index.
+    // 4. Finally overwrite the queue with the parent indices.
+    TheEntitytainerEntity* order  = entitytainer->preorder_entities;
+    int*                   lookup = entitytainer->entry_preorder_lookup;
+    int*                   sizes  = entitytainer->preorder_subtree_sizes;
+    int*                   queue  = entitytainer->preorder_parent_indices;
+    int                    count  = entitytainer->entry_lookup_size;
+    int                    end    = 0;
+    for ( int i = 0; i < count; ++i ) {
+        lookup[i] = -1;
+        if ( *entitytainer__entry( entitytainer, i ) != 0 &&
+             *entitytainer__parent( entitytainer, i ) == ENTITYTAINER_InvalidEntity ) {
+            queue[end++] = i;
+        }
+    }
+
+    for ( int head = 0; head < end; ++head ) {
+        TheEntitytainerEntity entity = (TheEntitytainerEntity)queue[head];
+        lookup[entity]               = 1;
+        if ( *entitytainer__entry( entitytainer, entity ) == 0 ) {
+            continue;
+        }
+
+        int                    num_children;
+        int                    capacity;
+        TheEntitytainerEntity* children;
+        entitytainer_get_children( entitytainer, entity, &children, &num_children, &capacity );
+        for ( int i = 0, found = 0; found < num_children && i < capacity; ++i ) {
+            if ( children[i] != ENTITYTAINER_InvalidEntity ) {
+                queue[end++] = children[i];
+                ++found;
+            }
+        }
+    }
+
+    for ( int i = end - 1; i >= 0; --i ) {
+        TheEntitytainerEntity parent = *entitytainer__parent( entitytainer, queue[i] );
+        if ( parent != ENTITYTAINER_InvalidEntity ) {
+            lookup[parent] += lookup[queue[i]];
+        }
+    }
+
+    int cursor = 0;
+    for ( int i = 0; i < end; ++i ) {
+        TheEntitytainerEntity entity = (TheEntitytainerEntity)queue[i];
+        if ( *entitytainer__parent( entitytainer, entity ) == ENTITYTAINER_InvalidEntity ) {
+            order[cursor]  = entity;
+            sizes[cursor]  = lookup[entity];
+            lookup[entity] = cursor;
+            cursor += sizes[cursor];
+        }
+
+        if ( *entitytainer__entry( entitytainer, entity ) == 0 ) {
+            continue;
+        }
+
+        int                    next = lookup[entity] + 1;
+        int                    num_children;
+        int                    capacity;
+        TheEntitytainerEntity* children;
+        entitytainer_get_children( entitytainer, entity, &children, &num_children, &capacity );
+        for ( int i_child = 0, found = 0; found < num_children && i_child < capacity; ++i_child ) {
+            TheEntitytainerEntity child = children[i_child];
+            if ( child != ENTITYTAINER_InvalidEntity ) {
+                order[next]   = child;
+                sizes[next]   = lookup[child];
+                lookup[child] = next;
+                next += sizes[next];
+                ++found;
+            }
+        }
+    }
+
+    ENTITYTAINER_assert( cursor == end );
+    for ( int i = 0; i < end; ++i ) {
+        TheEntitytainerEntity parent = *entitytainer__parent( entitytainer, order[i] );
+        queue[i]                     = parent == ENTITYTAINER_InvalidEntity ? -1 : lookup[parent];
+    }
+
+    entitytainer->preorder_count = end;
+    entitytainer->preorder_dirty = false;
+}
+
+ENTITYTAINER_API void
+entitytainer_get_preorder( TheEntitytainer*              entitytainer,
+                           const TheEntitytainerEntity** entities,
+                           const int**                   subtree_sizes,
+                           const int**                   parent_indices,
+                           int*                          count ) {
+    ENTITYTAINER_assert( entitytainer->config.preorder_index );
+    if ( entitytainer->preorder_dirty ) {
+        entitytainer__preorder_rebuild( entitytainer );
+    }
+
+    *entities       = entitytainer->preorder_entities;
+    *subtree_sizes  = entitytainer->preorder_subtree_sizes;
+    *parent_indices = entitytainer->preorder_parent_indices;
+    *count          = entitytainer->preorder_count;
+}
+
+ENTITYTAINER_API int
+entitytainer_get_preorder_index( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    ENTITYTAINER_assert( entitytainer->config.preorder_index );
+    if ( entitytainer->preorder_dirty ) {
+        entitytainer__preorder_rebuild( entitytainer );
+    }
+
+    return entitytainer->entry_preorder_lookup[entity];
+}
+
+ENTITYTAINER_API bool
+entitytainer_is_dirty( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    ENTITYTAINER_assert( entitytainer->config.dirty_tracking );
+    TheEntitytainerBitWord word = entitytainer->dirty_bits[entity / ENTITYTAINER_BitWordBits];
+    return ( word >> ( entity % ENTITYTAINER_BitWordBits ) ) & 1;
+}
+
+ENTITYTAINER_API void
+entitytainer_mark_dirty_subtree( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    ENTITYTAINER_assert( entitytainer->config.dirty_tracking );
+    TheEntitytainerBitWord* word = &entitytainer->dirty_bits[entity / ENTITYTAINER_BitWordBits];
+    TheEntitytainerBitWord  bit  = (TheEntitytainerBitWord)1 << ( entity % ENTITYTAINER_BitWordBits );
+    if ( *word & bit ) {
+        return;
+    }
+
+    *word |= bit;
+    if ( *entitytainer__entry( entitytainer, entity ) == 0 ) {
+        return;
+    }
+
+    int                    num_children;
+    int                    capacity;
+    TheEntitytainerEntity* children;
+    entitytainer_get_children( entitytainer, entity, &children, &num_children, &capacity );
+    for ( int i = 0, found = 0; found < num_children && i < capacity; ++i ) {
+        if ( children[i] != ENTITYTAINER_InvalidEntity ) {
+            entitytainer_mark_dirty_subtree( entitytainer, children[i] );
+            ++found;
+        }
+    }
+}
+
+static void
+entitytainer__consume_dirty_subtree( TheEntitytainer*       entitytainer,
+                                     TheEntitytainerEntity  entity,
+                                     TheEntitytainerEntity* dirty_out,
+                                     int*                   count,
+                                     int                    capacity ) {
+    if ( *count == capacity ) {
+        return;
+    }
+
+    dirty_out[( *count )++] = entity;
+    entitytainer->dirty_bits[entity / ENTITYTAINER_BitWordBits] &=
+      ~( (TheEntitytainerBitWord)1 << ( entity % ENTITYTAINER_BitWordBits ) );
+    if ( *entitytainer__entry( entitytainer, entity ) == 0 ) {
+        return;
+    }
+
+    int                    num_children;
+    int                    bucket_capacity;
+    TheEntitytainerEntity* children;
+    entitytainer_get_children( entitytainer, entity, &children, &num_children, &bucket_capacity );
+    for ( int i = 0, found = 0; found < num_children && i < bucket_capacity; ++i ) {
+        if ( children[i] != ENTITYTAINER_InvalidEntity ) {
+            if ( entitytainer_is_dirty( entitytainer, children[i] ) ) {
+                entitytainer__consume_dirty_subtree( entitytainer, children[i], dirty_out, count, capacity );
+            }
+            ++found;
+        }
+    }
+}
+
+ENTITYTAINER_API int
+entitytainer_consume_dirty( TheEntitytainer* entitytainer, TheEntitytainerEntity* dirty_out, int capacity ) {
+    ENTITYTAINER_assert( entitytainer->config.dirty_tracking );
+    TheEntitytainerBitWord* words = entitytainer->dirty_bits;
+    int num_words = ( entitytainer->entry_lookup_size + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    int count     = 0;
+    int i_word    = entitytainer__next_nonzero_word( words, 0, num_words );
+    while ( i_word < num_words && count < capacity ) {
+        // Entities whose parent is dirty are skipped, they're consumed when we get to the topmost dirty ancestor.
+        // Consuming a subtree can clear bits in this word too, so keep masking with the current value.
+        TheEntitytainerBitWord pending = words[i_word];
+        while ( ( pending &= words[i_word] ) != 0 && count < capacity ) {
+            int                   bit    = ENTITYTAINER_ctz64( pending );
+            TheEntitytainerEntity entity = (TheEntitytainerEntity)( i_word * ENTITYTAINER_BitWordBits + bit );
+            TheEntitytainerEntity parent = *entitytainer__parent( entitytainer, entity );
+            pending &= pending - 1;
+            if ( parent == ENTITYTAINER_InvalidEntity || !entitytainer_is_dirty( entitytainer, parent ) ) {
+                entitytainer__consume_dirty_subtree( entitytainer, entity, dirty_out, &count, capacity );
+            }
+        }
+
+        i_word = entitytainer__next_nonzero_word( words, i_word + 1, num_words );
+    }
+
+    return count;
+}
+
+ENTITYTAINER_API int
+entitytainer_save( TheEntitytainer* entitytainer, unsigned char* buffer, int buffer_size ) {
+    ENTITYTAINER_assert( entitytainer->channel == 0 );
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        if ( list->grown_memory != NULL || list->num_pages > list->num_inline_pages || list->snapshot_generation > 0 ||
+             entitytainer->arena ) {
+            return entitytainer__save_grown( entitytainer, buffer, buffer_size );
+        }
+    }
+
+    TheEntitytainerBucketList* last       = &entitytainer->bucket_lists[entitytainer->num_bucket_lists - 1];
+    TheEntitytainerEntity*     entity_end = last->bucket_data + last->bucket_size * last->total_buckets;
+    unsigned char*             begin      = (unsigned char*)entitytainer;
+    unsigned char*             end        = (unsigned char*)entity_end;
+    int                        size       = (int)( end - begin );
+    if ( size > buffer_size ) {
+        return size;
+    }
+
+    ENTITYTAINER_memcpy( buffer, entitytainer, size );
+    return size;
+}
+
+// Grown bucket lists aren't in the main allocation, so the image is put together the way load will lay it out, as if
+// the lists had been created with their current sizes.
+static int
+entitytainer__save_grown( TheEntitytainer* entitytainer, unsigned char* buffer, int buffer_size ) {
+    unsigned char* begin           = (unsigned char*)entitytainer;
+    unsigned char* bucket_list_end = (unsigned char*)( entitytainer->bucket_lists + entitytainer->num_bucket_lists );
+    int            header_size     = (int)( bucket_list_end - begin );
+
+    // Lay it out relative to the entitytainer itself first, the offsets are the same in any buffer aligned like it.
+    TheEntitytainer           image = *entitytainer;
+    TheEntitytainerBucketList image_bucket_lists[ENTITYTAINER_MAX_BUCKET_LISTS];
+    image.bucket_lists   = image_bucket_lists;
+    unsigned char* end   = entitytainer__assign_bucket_data( &image, bucket_list_end );
+    int            size  = (int)( end - begin );
+    if ( size > buffer_size ) {
+        return size;
+    }
+
+    ENTITYTAINER_memset( buffer, 0, size );
+    ENTITYTAINER_memcpy( buffer, entitytainer, header_size );
+    entitytainer__assign_bucket_data( &image, buffer + header_size );
+    // Bucket by bucket, since they may be spread over pages. In an arena the rest haven't been committed.
+    int payload_size = entitytainer->config.payload_size;
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        const TheEntitytainerBucketList* list       = &entitytainer->bucket_lists[i];
+        const TheEntitytainerBucketList* list_image = &image_bucket_lists[i];
+        if ( list->free_bits != NULL ) {
+            int free_buckets = entitytainer__free_bit_buckets( &entitytainer->config, i );
+            ENTITYTAINER_assert( list_image->free_words == list->free_words );
+            ENTITYTAINER_memcpy( list_image->free_bits,
+                                 list->free_bits,
+                                 entitytainer__free_bits_size( free_buckets ) * sizeof( TheEntitytainerBitWord ) );
+        }
+
+        for ( int i_bucket = 0; i_bucket < list->committed_buckets; ++i_bucket ) {
+            int bucket_offset = i_bucket * list->bucket_size;
+            ENTITYTAINER_memcpy( list_image->bucket_data + bucket_offset,
+                                 entitytainer__bucket( list, i_bucket ),
+                                 list->bucket_size * sizeof( TheEntitytainerEntity ) );
+            if ( list->slot_bits != NULL ) {
+                ENTITYTAINER_memcpy( list_image->slot_bits + i_bucket * list->slot_words,
+                                     entitytainer__bucket_slot_bits( list, i_bucket ),
+                                     list->slot_words * sizeof( TheEntitytainerBitWord ) );
+            }
+
+            if ( list->payload_data != NULL ) {
+                TheEntitytainerEntry lookup = entitytainer__make_entry( entitytainer, i, i_bucket );
+                ENTITYTAINER_memcpy( list_image->payload_data + bucket_offset * payload_size,
+                                     entitytainer__payload( entitytainer, list, lookup, 0 ),
+                                     list->bucket_size * payload_size );
+            }
+        }
+    }
+
+    return size;
+}
+
+ENTITYTAINER_API TheEntitytainer*
+                 entitytainer_load( unsigned char* buffer, int buffer_size ) {
+    ENTITYTAINER_assert( entitytainer__ptr_to_aligned_ptr( buffer, (int)ENTITYTAINER_alignof( TheEntitytainer ) ) ==
+                         buffer );
+
+    // Fix pointers
+    TheEntitytainer* entitytainer = (TheEntitytainer*)buffer;
+    buffer += sizeof( TheEntitytainer ) * entitytainer__num_channels( &entitytainer->config );
+    buffer = entitytainer__assign_lookups( entitytainer, buffer );
+
+    buffer                     = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer,
+                                                               (int)ENTITYTAINER_alignof( TheEntitytainerBucketList ) );
+    entitytainer->bucket_lists = (TheEntitytainerBucketList*)buffer;
+
+    unsigned char* bucket_list_end = buffer + sizeof( TheEntitytainerBucketList ) * entitytainer->num_bucket_lists;
+    unsigned char* bucket_data_end = entitytainer__assign_bucket_data( entitytainer, bucket_list_end );
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        entitytainer->bucket_lists[i].grown_memory      = NULL;
+        entitytainer->bucket_lists[i].grown_memory_size = 0;
+        entitytainer->bucket_lists[i].committed_buckets   = entitytainer->bucket_lists[i].total_buckets;
+        entitytainer->bucket_lists[i].snapshot_generation = 0;
+        entitytainer->bucket_lists[i].snapshot_config     = NULL;
+    }
+
+    entitytainer->arena        = false;
+    entitytainer->has_snapshot = false;
+
+    // Like the allocator, the journal belongs to the instance that saved.
+    entitytainer->config.journal      = NULL;
+    entitytainer->config.journal_size = 0;
+    entitytainer->journal_first       = 0;
+    entitytainer->journal_count       = 0;
+    entitytainer->journal_dropped     = 0;
+
+    // The allocator is only valid in the process that saved.
+    entitytainer->config.allocate           = NULL;
+    entitytainer->config.allocate_user_data = NULL;
+
+    (void)buffer_size;
+    (void)bucket_data_end;
+    ENTITYTAINER_assert( bucket_data_end <= (unsigned char*)entitytainer + buffer_size );
+    entitytainer__assign_pages( entitytainer );
+    entitytainer__assign_channels( entitytainer );
+    return entitytainer;
+}
+
+ENTITYTAINER_API void
+entitytainer_load_into( TheEntitytainer* entitytainer_dst, const TheEntitytainer* entitytainer_src ) {
+    // if ( ENTITYTAINER_memcmp( &entitytainer_dst->config, &entitytainer_src->config, sizeof( TheEntitytainerConfig
+    // ) )
+    // ==
+    //      0 ) {
+    //     ENTITYTAINER_memcpy( entitytainer_dst, entitytainer_src, sizeof( TheEntitytainerConfig ) );
+    //     return;
+    // }
+
+    // Only allow grow for now
+    ENTITYTAINER_assert( entitytainer_src->config.num_bucket_lists == entitytainer_dst->config.num_bucket_lists );
+    ENTITYTAINER_assert( entitytainer_src->config.payload_size == entitytainer_dst->config.payload_size );
+    ENTITYTAINER_assert( entitytainer_src->config.lowest_free_bucket == entitytainer_dst->config.lowest_free_bucket );
+    for ( int i_bl = 0; i_bl < entitytainer_src->config.num_bucket_lists; ++i_bl ) {
+        ENTITYTAINER_assert( entitytainer_src->config.bucket_sizes[i_bl] <=
+                             entitytainer_dst->config.bucket_sizes[i_bl] );
+        ENTITYTAINER_assert( entitytainer_src->config.bucket_list_sizes[i_bl] <=
+                             entitytainer_dst->config.bucket_list_sizes[i_bl] );
+
+        bool same_layout =
+          entitytainer_src->bucket_lists[i_bl].pages == NULL && entitytainer_dst->bucket_lists[i_bl].pages == NULL &&
+          entitytainer_src->config.bucket_sizes[i_bl] == entitytainer_dst->config.bucket_sizes[i_bl] &&
+          !entitytainer_src->arena && !entitytainer_dst->arena;
+        if ( same_layout ) {
+            int bucket_list_size = sizeof( TheEntitytainerEntity ) * entitytainer_src->config.bucket_list_sizes[i_bl] *
+                                   entitytainer_src->config.bucket_sizes[i_bl];
+            ENTITYTAINER_memcpy( entitytainer_dst->bucket_lists[i_bl].bucket_data,
+                                 entitytainer_src->bucket_lists[i_bl].bucket_data,
+                                 bucket_list_size );
+        }
+        else {
+            TheEntitytainerBucketList* bucket_list_src = &entitytainer_src->bucket_lists[i_bl];
+            int                        bucket_size_src = entitytainer_src->config.bucket_sizes[i_bl];
+            TheEntitytainerBucketList* bucket_list_dst = &entitytainer_dst->bucket_lists[i_bl];
+            int                        bucket_size_dst = entitytainer_dst->config.bucket_sizes[i_bl];
+            for ( int i_bucket = 0; i_bucket < bucket_list_src->committed_buckets; ++i_bucket ) {
+#if ENTITYTAINER_MMAP
+                if ( i_bucket >= bucket_list_dst->committed_buckets ) {
+                    entitytainer__commit_buckets( entitytainer_dst, bucket_list_dst, i_bucket );
+                }
+#endif
+                TheEntitytainerEntity* bucket_src = entitytainer__bucket( bucket_list_src, i_bucket );
+                TheEntitytainerEntity* bucket_dst = entitytainer__bucket_for_write( bucket_list_dst, i_bucket );
+                ENTITYTAINER_memcpy( bucket_dst, bucket_src, bucket_size_src * sizeof( TheEntitytainerEntity ) );
+                (void)bucket_size_dst;
+            }
+        }
+
+        if ( entitytainer_src->config.payload_size > 0 ) {
+            const TheEntitytainerBucketList* bucket_list_src = &entitytainer_src->bucket_lists[i_bl];
+            TheEntitytainerBucketList*       bucket_list_dst = &entitytainer_dst->bucket_lists[i_bl];
+            int payload_bytes_src = bucket_list_src->bucket_size * entitytainer_src->config.payload_size;
+            // Like the buckets, only as far as the source has touched, so an arena isn't faulted in past that.
+            for ( int i_bucket = 0; i_bucket < bucket_list_src->committed_buckets; ++i_bucket ) {
+                TheEntitytainerEntry lookup = entitytainer__make_entry( entitytainer_dst, i_bl, i_bucket );
+                ENTITYTAINER_memcpy( entitytainer__payload( entitytainer_dst, bucket_list_dst, lookup, 0 ),
+                                     entitytainer__payload( entitytainer_src, bucket_list_src, lookup, 0 ),
+                                     payload_bytes_src );
+            }
+        }
+
+        if ( entitytainer_src->remove_with_holes && entitytainer_dst->remove_with_holes ) {
+            const TheEntitytainerBucketList* bucket_list_src = &entitytainer_src->bucket_lists[i_bl];
+            TheEntitytainerBucketList*       bucket_list_dst = &entitytainer_dst->bucket_lists[i_bl];
+            for ( int i_bucket = 0; i_bucket < bucket_list_src->committed_buckets; ++i_bucket ) {
+                ENTITYTAINER_memcpy( entitytainer__bucket_slot_bits( bucket_list_dst, i_bucket ),
+                                     entitytainer__bucket_slot_bits( bucket_list_src, i_bucket ),
+                                     bucket_list_src->slot_words * sizeof( TheEntitytainerBitWord ) );
+            }
+        }
+        if ( entitytainer_src->config.lowest_free_bucket ) {
+            // Same word indices in both, only the number of words differs.
+            const TheEntitytainerBucketList* bucket_list_src = &entitytainer_src->bucket_lists[i_bl];
+            TheEntitytainerBucketList*       bucket_list_dst = &entitytainer_dst->bucket_lists[i_bl];
+            int free_words    = bucket_list_src->free_words;
+            int summary_words = ( free_words + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+            ENTITYTAINER_memcpy(
+              bucket_list_dst->free_bits, bucket_list_src->free_bits, free_words * sizeof( TheEntitytainerBitWord ) );
+            ENTITYTAINER_memcpy( bucket_list_dst->free_bits + bucket_list_dst->free_words,
+                                 bucket_list_src->free_bits + free_words,
+                                 summary_words * sizeof( TheEntitytainerBitWord ) );
+        }
+
+        entitytainer_dst->bucket_lists[i_bl].first_free_bucket = entitytainer_src->bucket_lists[i_bl].first_free_bucket;
+        entitytainer_dst->bucket_lists[i_bl].used_buckets      = entitytainer_src->bucket_lists[i_bl].used_buckets;
+        entitytainer_dst->bucket_lists[i_bl].free_head         = entitytainer_src->bucket_lists[i_bl].free_head;
+        entitytainer_dst->bucket_lists[i_bl].next_bucket       = entitytainer_src->bucket_lists[i_bl].next_bucket;
+    }
+
+    int num_channels = entitytainer__num_channels( &entitytainer_src->config );
+    ENTITYTAINER_assert( num_channels == entitytainer__num_channels( &entitytainer_dst->config ) );
+    ENTITYTAINER_assert( entitytainer_src->config.multi_parent == entitytainer_dst->config.multi_parent );
+    ENTITYTAINER_assert( entitytainer_src->entry_lookup_size <= entitytainer_dst->entry_lookup_size );
+    for ( int channel = 0; channel < num_channels; ++channel ) {
+        const TheEntitytainer* channel_src = entitytainer_src + channel;
+        TheEntitytainer*       channel_dst = entitytainer_dst + channel;
+        for ( int entity = 0; entity < entitytainer_src->entry_lookup_size; ++entity ) {
+            *entitytainer__entry( channel_dst, entity ) = *entitytainer__entry( channel_src, entity );
+            if ( entitytainer_src->config.multi_parent ) {
+                TheEntitytainerEntry parents_entry = *entitytainer__parents_entry( channel_src, entity );
+                *entitytainer__parents_entry( channel_dst, entity ) = parents_entry;
+            }
+            else {
+                *entitytainer__parent( channel_dst, entity ) = *entitytainer__parent( channel_src, entity );
+            }
+        }
+    }
+    entitytainer_dst->ancestry_dirty = true;
+    entitytainer_dst->preorder_dirty = true;
+
+#if ENTITYTAINER_DEFENSIVE_CHECKS
+    for ( TheEntitytainerEntity entity = 0; entity < entitytainer_dst->config.num_entries; ++entity ) {
+        TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer_dst, entity );
+        if ( lookup == 0 ) {
+            continue;
+        }
+
+        TheEntitytainerBucketList* bucket_list;
+        TheEntitytainerEntity*     bucket =
+          entitytainer__get_bucket_for_write( entitytainer_dst, lookup, &bucket_list );
+
+        // Without holes, the slots after the children may still have removed ones in them.
+        TheEntitytainerEntity count       = bucket[0];
+        TheEntitytainerEntity found_count = 0;
+        int                   slot_end    = entitytainer_dst->remove_with_holes ? bucket_list->bucket_size : count + 1;
+        for ( int i_child1 = 1; i_child1 < slot_end; ++i_child1 ) {
+            if ( found_count == count ) {
+                break;
+            }
+
+            if ( bucket[i_child1] == ENTITYTAINER_InvalidEntity ) {
+                continue;
+            }
+
+            ++found_count;
+            for ( int i_child2 = i_child1 + 1; i_child2 < slot_end; ++i_child2 ) {
+                if ( bucket[i_child1] == bucket[i_child2] ) {
+                    if ( entitytainer_dst->remove_with_holes ) {
+                        ENTITYTAINER_assert( entitytainer_dst->keep_capacity_on_remove, "untested" );
+                        TheEntitytainerBitWord* slot_bits =
+                          entitytainer__slot_bits( entitytainer_dst, bucket_list, lookup );
+                        int                     slot      = i_child2 - 1;
+                        slot_bits[slot / ENTITYTAINER_BitWordBits] &=
+                          ~( (TheEntitytainerBitWord)1 << ( slot % ENTITYTAINER_BitWordBits ) );
+                        bucket[0]--;
+                        bucket[i_child2] = 0;
+                        // entitytainer_remove_child_with_holes( entitytainer_dst, entity, bucket[i_child1] );
+                    }
+                    else {
+                        ENTITYTAINER_assert( false, "untested" );
+                    }
+                }
+            }
+        }
+    }
+#endif
+}
+
+static void*
+entitytainer__ptr_to_aligned_ptr( void* ptr, int align ) {
+    if ( align == 0 ) {
+        return ptr;
+    }
+
+    long long int ptr_address = (long long int)ptr;
+    int           offset      = ( ~(int)ptr_address + 1 ) & ( align - 1 );
+    void*         aligned_ptr = (char*)ptr + offset;
+    return aligned_ptr;
+}
+
+static bool
+entitytainer__child_in_bucket( TheEntitytainerEntity*     bucket,
+                               TheEntitytainerBucketList* bucket_list,
+                               TheEntitytainerEntity      child ) {
+
+    TheEntitytainerEntity count = bucket[0];
+    int                   found = 0;
+    for ( int i = 1; i < bucket_list->bucket_size; ++i ) {
+        if ( found == count ) {
+            break;
+        }
+
+        if ( bucket[i] == ENTITYTAINER_InvalidEntity ) {
+            continue;
+        }
+
+        if ( bucket[i] == child ) {
+            return true;
+        }
+
+        ++found;
+    }
+
+    return false;
+}
+
+static TheEntitytainerEntry
+entitytainer__make_entry( const TheEntitytainer* entitytainer, int bucket_list_index, int bucket_index ) {
+    return ( (TheEntitytainerEntry)bucket_list_index << entitytainer->bucket_list_offset ) |
+           (TheEntitytainerEntry)bucket_index;
+}
+
+// Just enough bits for the bucket list index, the rest is for the bucket index. That's capped so bucket counts fit in
+// an int, which leaves the top bits of wide entries unused.
+static int
+entitytainer__bucket_list_offset( int num_bucket_lists ) {
+    int bucket_list_bits = 1;
+    while ( ( 1 << bucket_list_bits ) < num_bucket_lists ) {
+        ++bucket_list_bits;
+    }
+
+    return ENTITYTAINER_EntryBits - bucket_list_bits < 30 ? ENTITYTAINER_EntryBits - bucket_list_bits : 30;
+}
+
+// The most buckets an entry can index in each of the config's bucket lists.
+static int
+entitytainer__max_buckets( const struct TheEntitytainerConfig* config ) {
+    return 1 << entitytainer__bucket_list_offset( config->num_bucket_lists );
+}
+
+// The pages a paged list's page table has room for, enough for its max_bucket_list_sizes, or its bucket_list_sizes if
+// that's more.
+static int
+entitytainer__max_pages( const struct TheEntitytainerConfig* config, int bucket_list_index ) {
+    int max_list_size = config->max_bucket_list_sizes[bucket_list_index];
+    int list_size     = config->bucket_list_sizes[bucket_list_index];
+    int max_buckets   = entitytainer__max_buckets( config );
+    max_list_size     = max_list_size > list_size ? max_list_size : list_size;
+    max_list_size     = max_list_size < max_buckets ? max_list_size : max_buckets;
+    return max_list_size / config->bucket_page_size;
+}
+
+static TheEntitytainerEntity*
+entitytainer__get_bucket( TheEntitytainer*            entitytainer,
+                          TheEntitytainerEntry        lookup,
+                          TheEntitytainerBucketList** bucket_list_out ) {
+    int                        bucket_list_index = lookup >> entitytainer->bucket_list_offset;
+    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
+    *bucket_list_out                             = bucket_list;
+    return entitytainer__bucket( bucket_list, lookup & entitytainer->bucket_mask );
+}
+
+static TheEntitytainerEntity*
+entitytainer__bucket( const TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+    if ( bucket_list->pages == NULL ) {
+        return bucket_list->bucket_data + bucket_index * bucket_list->bucket_size;
+    }
+
+    const TheEntitytainerBucketPage* page = entitytainer__page( bucket_list, bucket_index );
+    return page->bucket_data + ( bucket_index & ( ( 1 << bucket_list->page_shift ) - 1 ) ) * bucket_list->bucket_size;
+}
+
+// Same as entitytainer__get_bucket, for callers about to change the bucket, its slot bits or its payloads.
+static TheEntitytainerEntity*
+entitytainer__get_bucket_for_write( TheEntitytainer*            entitytainer,
+                                    TheEntitytainerEntry        lookup,
+                                    TheEntitytainerBucketList** bucket_list_out ) {
+    entitytainer__get_bucket( entitytainer, lookup, bucket_list_out );
+    return entitytainer__bucket_for_write( *bucket_list_out, lookup & entitytainer->bucket_mask );
+}
+
+static TheEntitytainerEntity*
+entitytainer__bucket_for_write( TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+    entitytainer__own_page( bucket_list, bucket_index );
+    return entitytainer__bucket( bucket_list, bucket_index );
+}
+
+static TheEntitytainerBitWord*
+entitytainer__bucket_slot_bits( const TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+    if ( bucket_list->pages == NULL ) {
+        return bucket_list->slot_bits + bucket_index * bucket_list->slot_words;
+    }
+
+    const TheEntitytainerBucketPage* page = entitytainer__page( bucket_list, bucket_index );
+    return page->slot_bits + ( bucket_index & ( ( 1 << bucket_list->page_shift ) - 1 ) ) * bucket_list->slot_words;
+}
+
+static TheEntitytainerBitWord*
+entitytainer__slot_bits( const TheEntitytainer*     entitytainer,
+                         TheEntitytainerBucketList* bucket_list,
+                         TheEntitytainerEntry       lookup ) {
+    return entitytainer__bucket_slot_bits( bucket_list, lookup & entitytainer->bucket_mask );
+}
+
+static int
+entitytainer__alloc_bucket( TheEntitytainer* entitytainer, TheEntitytainerBucketList* bucket_list ) {
+#if ENTITYTAINER_CONCURRENT
+    if ( entitytainer->config.concurrent ) {
+        return entitytainer__alloc_bucket_concurrent( entitytainer, bucket_list );
+    }
+#endif
+
+    int bucket_index = bucket_list->used_buckets;
+    int lowest_free  = bucket_list->free_bits != NULL ? entitytainer__lowest_free_bucket( bucket_list ) : -1;
+    if ( lowest_free >= 0 ) {
+        bucket_index = lowest_free;
+        entitytainer__set_free_bit( bucket_list, bucket_index, false );
+    }
+    else if ( bucket_list->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
+        // There's a freed bucket available
+        bucket_index                   = bucket_list->first_free_bucket;
+        bucket_list->first_free_bucket = *entitytainer__bucket( bucket_list, bucket_index );
+    }
+    else if ( bucket_index == bucket_list->total_buckets &&
+              ( entitytainer - entitytainer->channel )->config.allocate != NULL ) {
+        if ( bucket_list->pages != NULL ) {
+            entitytainer__append_page( entitytainer, bucket_list );
+        }
+        else {
+            entitytainer__grow_bucket_list( entitytainer, bucket_list );
+        }
+    }
 
-    bucket_list_new->used_buckets++;
-    bucket_list->used_buckets--;
+    ENTITYTAINER_assert( bucket_index < bucket_list->total_buckets ); // No free buckets at all
+#if ENTITYTAINER_MMAP
+    if ( bucket_index >= bucket_list->committed_buckets ) {
+        entitytainer__commit_buckets( entitytainer, bucket_list, bucket_index );
+    }
+#endif
 
-    // Update lookup
-    TheEntitytainerEntry lookup_new =
-      ( TheEntitytainerEntry )( bucket_list_index_new << ENTITYTAINER_BucketListOffset );
-    lookup_new                         = lookup_new | (TheEntitytainerEntry)bucket_index_new;
-    entitytainer->entry_lookup[parent] = lookup_new;
+    ++bucket_list->used_buckets;
+    entitytainer__clear_bucket( bucket_list, bucket_index );
+    return bucket_index;
 }
 
-ENTITYTAINER_API void
-entitytainer_add_child( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, TheEntitytainerEntity child ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0,
-                         "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
-                         " as child to " ENTITYTAINER_EntityFormat " who was not added.",
-                         "",
-                         child,
-                         parent );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = bucket_list->bucket_data + bucket_offset;
+static void
+entitytainer__clear_bucket( TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+    TheEntitytainerEntity* bucket = entitytainer__bucket_for_write( bucket_list, bucket_index );
+    entitytainer__store_link( bucket, 0 );
+    ENTITYTAINER_memset( bucket + 1, 0, ( bucket_list->bucket_size - 1 ) * sizeof( TheEntitytainerEntity ) );
+    if ( bucket_list->slot_bits != NULL ) {
+        ENTITYTAINER_memset( entitytainer__bucket_slot_bits( bucket_list, bucket_index ),
+                             0,
+                             bucket_list->slot_words * sizeof( TheEntitytainerBitWord ) );
+    }
+}
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ),
-                         "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
-                         " as child to " ENTITYTAINER_EntityFormat " but it was already its child.",
-                         "",
-                         child,
-                         parent );
+static void
+entitytainer__free_bucket( TheEntitytainer* entitytainer, TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+#if ENTITYTAINER_CONCURRENT
+    if ( entitytainer->config.concurrent ) {
+        entitytainer__free_bucket_concurrent( entitytainer, bucket_list, bucket_index );
+        return;
+    }
 #endif
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
-        ENTITYTAINER_assert( entitytainer_get_parent( entitytainer, child ) == parent );
+    (void)entitytainer;
+    --bucket_list->used_buckets;
+    if ( bucket_list->free_bits != NULL ) {
+        entitytainer__set_free_bit( bucket_list, bucket_index, true );
         return;
     }
-#endif
 
-    if ( bucket[0] + 1 == bucket_list->bucket_size ) {
-        ENTITYTAINER_assert( bucket_list_index != 3 );
-        TheEntitytainerBucketList* bucket_list_new  = bucket_list + 1;
-        int                        bucket_index_new = bucket_list_new->used_buckets;
-        if ( bucket_list_new->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
-            // There's a freed bucket available
-            bucket_index_new                   = bucket_list_new->first_free_bucket;
-            int bucket_offset_new              = bucket_index_new * bucket_list_new->bucket_size;
-            bucket_list_new->first_free_bucket = bucket_list_new->bucket_data[bucket_offset_new];
+    TheEntitytainerEntity* bucket  = entitytainer__bucket_for_write( bucket_list, bucket_index );
+    *bucket                        = (TheEntitytainerEntity)bucket_list->first_free_bucket;
+    bucket_list->first_free_bucket = bucket_index;
+}
+
+#if ENTITYTAINER_CONCURRENT
+static int
+entitytainer__alloc_bucket_concurrent( TheEntitytainer* entitytainer, TheEntitytainerBucketList* bucket_list ) {
+    int bucket_index;
+    if ( entitytainer->config.thread_bucket_caches ) {
+        TheEntitytainerBucketCache* cache = entitytainer__bucket_cache( entitytainer, bucket_list );
+        if ( cache->count == 0 ) {
+            // Lowest index on top.
+            int buckets[ENTITYTAINER_BucketCacheBatch];
+            int num_buckets = entitytainer__claim_buckets( bucket_list, buckets, ENTITYTAINER_BucketCacheBatch );
+            for ( int i = 0; i < num_buckets; ++i ) {
+                cache->buckets[i] = buckets[num_buckets - 1 - i];
+            }
+
+            cache->count = num_buckets;
         }
 
-        int                    bucket_offset_new = bucket_index_new * bucket_list_new->bucket_size;
-        TheEntitytainerEntity* bucket_new        = bucket_list_new->bucket_data + bucket_offset_new;
-        ENTITYTAINER_memset( bucket_new, 0, bucket_list_new->bucket_size * sizeof( TheEntitytainerEntity ) );
-        ENTITYTAINER_memcpy( bucket_new, bucket, bucket_list->bucket_size * sizeof( TheEntitytainerEntity ) );
+        ENTITYTAINER_assert( cache->count > 0 ); // No free buckets at all
+        bucket_index = cache->buckets[--cache->count];
+    }
+    else {
+        int num_buckets = entitytainer__claim_buckets( bucket_list, &bucket_index, 1 );
+        ENTITYTAINER_assert( num_buckets == 1 ); // No free buckets at all
+        (void)num_buckets;
+    }
 
-        *bucket                        = (TheEntitytainerEntity)bucket_list->first_free_bucket;
-        bucket_list->first_free_bucket = bucket_index;
-        bucket                         = bucket_new;
+    entitytainer__clear_bucket( bucket_list, bucket_index );
+    return bucket_index;
+}
 
-        bucket_list_new->used_buckets++;
-        bucket_list->used_buckets--;
+static void
+entitytainer__free_bucket_concurrent( TheEntitytainer*           entitytainer,
+                                      TheEntitytainerBucketList* bucket_list,
+                                      int                        bucket_index ) {
+    if ( !entitytainer->config.thread_bucket_caches ) {
+        entitytainer__release_buckets( bucket_list, &bucket_index, 1 );
+        return;
+    }
 
-        // Update lookup
-        int                  bucket_list_index_new = ( bucket_list_index + 1 ) << ENTITYTAINER_BucketListOffset;
-        TheEntitytainerEntry lookup_new            = (TheEntitytainerEntry)bucket_list_index_new;
-        lookup_new                                 = lookup_new | (TheEntitytainerEntry)bucket_index_new;
-        entitytainer->entry_lookup[parent]         = lookup_new;
+    // Full, give back the ones at the bottom, the top ones were freed last and are more likely to be in the cache.
+    TheEntitytainerBucketCache* cache = entitytainer__bucket_cache( entitytainer, bucket_list );
+    if ( cache->count == ENTITYTAINER_BucketCacheSize ) {
+        entitytainer__release_buckets( bucket_list, cache->buckets, ENTITYTAINER_BucketCacheBatch );
+        cache->count -= ENTITYTAINER_BucketCacheBatch;
+        ENTITYTAINER_memmove( cache->buckets,
+                              cache->buckets + ENTITYTAINER_BucketCacheBatch,
+                              cache->count * sizeof( cache->buckets[0] ) );
     }
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
-#endif
+    cache->buckets[cache->count++] = bucket_index;
+}
 
-    // Update count and insert child into bucket
-    TheEntitytainerEntity count = bucket[0] + (TheEntitytainerEntity)1;
-    bucket[0]                   = count;
-    if ( entitytainer->remove_with_holes ) {
-        int i = 1;
-        for ( ; i < count; ++i ) {
-            if ( bucket[i] == ENTITYTAINER_InvalidEntity ) {
-                bucket[i] = child;
+// Takes up to max_buckets buckets off the free list with a single exchange, then bumps next_bucket for the rest. The
+// change count in free_head makes the exchange fail if the head was popped and pushed back by other threads in
+// between, even though the index is the same (the ABA problem).
+static int
+entitytainer__claim_buckets( TheEntitytainerBucketList* bucket_list, int* buckets, int max_buckets ) {
+    int                num_buckets = 0;
+    unsigned long long head        = ENTITYTAINER_atomic_load64( &bucket_list->free_head );
+    for ( ;; ) {
+        // The links may be read from buckets other threads just took, then the exchange fails and they're read again.
+        int bucket_index = (int)( head & 0xffffffffu );
+        num_buckets      = 0;
+        while ( bucket_index != (int)ENTITYTAINER_NoFreeBucket && num_buckets < max_buckets ) {
+            if ( bucket_index < 0 || bucket_index >= bucket_list->total_buckets ) {
                 break;
             }
+
+            buckets[num_buckets++] = bucket_index;
+            bucket_index           = entitytainer__load_link( entitytainer__bucket( bucket_list, bucket_index ) );
+        }
+
+        if ( bucket_index != (int)ENTITYTAINER_NoFreeBucket &&
+             ( bucket_index < 0 || bucket_index >= bucket_list->total_buckets ) ) {
+            // A link read from a bucket that was just taken, unless the head hasn't moved, then the list is broken.
+            unsigned long long head_now = ENTITYTAINER_atomic_load64( &bucket_list->free_head );
+            ENTITYTAINER_assert( head_now != head,
+                                 "Entitytainer[%s] Free list links to bucket %d, past the end of the list.",
+                                 "",
+                                 bucket_index );
+            head = head_now;
+            continue;
         }
-        if ( i == count ) {
-            // Didn't find a "holed" slot, add child to the end.
-            bucket[i] = child;
+
+        unsigned long long head_new = ( ( head >> 32 ) + 1 ) << 32 | (unsigned int)bucket_index;
+        if ( num_buckets == 0 || ENTITYTAINER_atomic_cas64( &bucket_list->free_head, head, head_new ) ) {
+            break;
         }
+
+        head = ENTITYTAINER_atomic_load64( &bucket_list->free_head );
     }
-    else {
-        bucket[count] = child;
+
+    if ( num_buckets < max_buckets ) {
+        int num_bumped = max_buckets - num_buckets;
+        int first      = ENTITYTAINER_atomic_add32( &bucket_list->next_bucket, num_bumped );
+        for ( int i = first; i < first + num_bumped && i < bucket_list->total_buckets; ++i ) {
+            buckets[num_buckets++] = i;
+        }
     }
 
-    ENTITYTAINER_assert( entitytainer->entry_parent_lookup[child] == ENTITYTAINER_InvalidEntity );
-    ENTITYTAINER_assert( entitytainer->entry_parent_lookup[child] == ENTITYTAINER_InvalidEntity,
-                         "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
-                         " as child to " ENTITYTAINER_EntityFormat
-                         " but it was already parented to " ENTITYTAINER_EntityFormat,
-                         "",
-                         child,
-                         parent,
-                         entitytainer->entry_parent_lookup[child] );
-    entitytainer->entry_parent_lookup[child] = parent;
+    ENTITYTAINER_atomic_add32( &bucket_list->used_buckets, num_buckets );
+    return num_buckets;
+}
+
+// Pushes the buckets onto the free list with a single exchange, linked up in order first.
+static void
+entitytainer__release_buckets( TheEntitytainerBucketList* bucket_list, const int* buckets, int num_buckets ) {
+    for ( int i = 0; i + 1 < num_buckets; ++i ) {
+        entitytainer__store_link( entitytainer__bucket_for_write( bucket_list, buckets[i] ),
+                                  (TheEntitytainerEntity)buckets[i + 1] );
+    }
+
+    TheEntitytainerEntity* last = entitytainer__bucket_for_write( bucket_list, buckets[num_buckets - 1] );
+    unsigned long long     head = ENTITYTAINER_atomic_load64( &bucket_list->free_head );
+    for ( ;; ) {
+        entitytainer__store_link( last, (TheEntitytainerEntity)( head & 0xffffffffu ) );
+        unsigned long long head_new = ( ( head >> 32 ) + 1 ) << 32 | (unsigned long long)buckets[0];
+        if ( ENTITYTAINER_atomic_cas64( &bucket_list->free_head, head, head_new ) ) {
+            break;
+        }
+
+        head = ENTITYTAINER_atomic_load64( &bucket_list->free_head );
+    }
+
+    ENTITYTAINER_atomic_add32( &bucket_list->used_buckets, -num_buckets );
+}
+
+static TheEntitytainerBucketCache*
+entitytainer__bucket_cache( TheEntitytainer* entitytainer, TheEntitytainerBucketList* bucket_list ) {
+    TheEntitytainer*            root  = entitytainer - entitytainer->channel;
+    TheEntitytainerBucketCache* cache = &entitytainer__bucket_caches[bucket_list - root->bucket_lists];
+    if ( cache->bucket_list != bucket_list ) {
+        ENTITYTAINER_assert( cache->count == 0,
+                             "Entitytainer[%s] Flush the thread's caches before using another entitytainer.",
+                             "" );
+        cache->bucket_list = bucket_list;
+    }
+
+    return cache;
 }
 
 ENTITYTAINER_API void
-entitytainer_add_child_at_index( TheEntitytainer*      entitytainer,
-                                 TheEntitytainerEntity parent,
-                                 TheEntitytainerEntity child,
-                                 int                   index ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = bucket_list->bucket_data + bucket_offset;
+entitytainer_flush_thread_caches( TheEntitytainer* entitytainer ) {
+    TheEntitytainer* root = entitytainer - entitytainer->channel;
+    for ( int i = 0; i < root->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketCache* cache = &entitytainer__bucket_caches[i];
+        if ( cache->bucket_list != &root->bucket_lists[i] ) {
+            continue;
+        }
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
+        if ( cache->count > 0 ) {
+            entitytainer__release_buckets( cache->bucket_list, cache->buckets, cache->count );
+        }
+
+        cache->bucket_list = NULL;
+        cache->count       = 0;
+    }
+}
 #endif
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
-        ENTITYTAINER_assert( entitytainer_get_parent( entitytainer, child ) == parent );
+// Entries are published with a release store in concurrent mode, so a thread that sees the new entry also sees the
+// bucket it points to.
+static void
+entitytainer__store_entry( const TheEntitytainer* entitytainer,
+                           TheEntitytainerEntry*  lookup,
+                           TheEntitytainerEntry   entry ) {
+#if ENTITYTAINER_CONCURRENT
+    if ( entitytainer->config.concurrent ) {
+        ENTITYTAINER_atomic_store_entry( lookup, entry );
         return;
     }
 #endif
 
-    while ( index + 1 >= bucket_list->bucket_size ) {
-        ENTITYTAINER_assert( bucket_list_index != 3 ); // No bucket lists with buckets of this size
-        TheEntitytainerBucketList* bucket_list_new  = bucket_list + 1;
-        int                        bucket_index_new = bucket_list_new->used_buckets;
-        if ( index + 1 >= bucket_list_new->bucket_size ) {
-            bucket_list_index += 1;
-            bucket_list = bucket_list_new;
-            continue;
+    (void)entitytainer;
+    *lookup = entry;
+}
+
+// A bucket's first slot holds its count, or its link while it's free. Threads taking buckets off the free list can read
+// the link of one another thread just took and is counting children in, so with concurrent compiled in the slot is
+// only read and written atomically. Relaxed is enough, the exchanges on free_head order the rest.
+static TheEntitytainerEntity
+entitytainer__load_link( const TheEntitytainerEntity* bucket ) {
+#if ENTITYTAINER_CONCURRENT
+    return ENTITYTAINER_atomic_load_link( bucket );
+#else
+    return *bucket;
+#endif
+}
+
+static void
+entitytainer__store_link( TheEntitytainerEntity* bucket, TheEntitytainerEntity link ) {
+#if ENTITYTAINER_CONCURRENT
+    ENTITYTAINER_atomic_store_link( bucket, link );
+#else
+    *bucket = link;
+#endif
+}
+
+// Buckets covered by a list's free bitmap. A paged list's grows with its pages, doubling so it isn't moved for every
+// page, up to what the list's page table has room for.
+static int
+entitytainer__free_bit_buckets( const struct TheEntitytainerConfig* config, int bucket_list_index ) {
+    int num_buckets = config->bucket_list_sizes[bucket_list_index];
+    if ( config->bucket_page_size == 0 ) {
+        return num_buckets;
+    }
+
+    int max_buckets = entitytainer__max_pages( config, bucket_list_index ) * config->bucket_page_size;
+    int capacity    = config->bucket_page_size;
+    while ( capacity < num_buckets ) {
+        capacity *= 2;
+    }
+
+    return capacity < max_buckets ? capacity : max_buckets;
+}
+
+// Words of a free bitmap: a bit per bucket, then a summary bit per word of those.
+static int
+entitytainer__free_bits_size( int num_buckets ) {
+    int free_words = ( num_buckets + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    return free_words + ( free_words + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+}
+
+// The lowest freed bucket, or -1. Scans the summary words, so a full list of 16k buckets takes at most 4 loads.
+static int
+entitytainer__lowest_free_bucket( const TheEntitytainerBucketList* bucket_list ) {
+    const TheEntitytainerBitWord* summary = bucket_list->free_bits + bucket_list->free_words;
+    int num_summary_words = ( bucket_list->free_words + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    for ( int i_summary = 0; i_summary < num_summary_words; ++i_summary ) {
+        if ( summary[i_summary] != 0 ) {
+            int i_word = i_summary * ENTITYTAINER_BitWordBits + ENTITYTAINER_ctz64( summary[i_summary] );
+            return i_word * ENTITYTAINER_BitWordBits + ENTITYTAINER_ctz64( bucket_list->free_bits[i_word] );
         }
+    }
+
+    return -1;
+}
 
-        if ( bucket_list_new->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
-            // There's a freed bucket available
-            bucket_index_new                   = bucket_list_new->first_free_bucket;
-            int bucket_offset_new              = bucket_index_new * bucket_list_new->bucket_size;
-            bucket_list_new->first_free_bucket = bucket_list_new->bucket_data[bucket_offset_new];
+static void
+entitytainer__set_free_bit( TheEntitytainerBucketList* bucket_list, int bucket_index, bool free ) {
+    TheEntitytainerBitWord* summary     = bucket_list->free_bits + bucket_list->free_words;
+    int                     i_word      = bucket_index / ENTITYTAINER_BitWordBits;
+    TheEntitytainerBitWord  bit         = (TheEntitytainerBitWord)1 << ( bucket_index % ENTITYTAINER_BitWordBits );
+    TheEntitytainerBitWord  summary_bit = (TheEntitytainerBitWord)1 << ( i_word % ENTITYTAINER_BitWordBits );
+    if ( free ) {
+        bucket_list->free_bits[i_word] |= bit;
+        summary[i_word / ENTITYTAINER_BitWordBits] |= summary_bit;
+    }
+    else {
+        bucket_list->free_bits[i_word] &= ~bit;
+        if ( bucket_list->free_bits[i_word] == 0 ) {
+            summary[i_word / ENTITYTAINER_BitWordBits] &= ~summary_bit;
         }
+    }
+}
+
+// Doubles the number of buckets in the list, in memory from config.allocate. The list's data all moves there, nothing
+// else does.
+static void
+entitytainer__grow_bucket_list( TheEntitytainer* entitytainer, TheEntitytainerBucketList* bucket_list ) {
+    TheEntitytainer* root              = entitytainer - entitytainer->channel;
+    int              bucket_list_index = (int)( bucket_list - root->bucket_lists );
+    int              total_old         = bucket_list->total_buckets;
+    int              max_buckets       = root->bucket_mask + 1;
+    int              total_new         = total_old * 2 < max_buckets ? total_old * 2 : max_buckets;
+    ENTITYTAINER_assert( total_new > total_old,
+                         "Entitytainer[%s] Bucket list %d can't be indexed past %d buckets.",
+                         "",
+                         bucket_list_index,
+                         total_old );
+
+    // Bit words first since they need the strictest alignment, the payloads are padded up to it.
+    int slot_bits_size_old = total_old * bucket_list->slot_words * (int)sizeof( TheEntitytainerBitWord );
+    int payload_size_old   = total_old * bucket_list->bucket_size * root->config.payload_size;
+    int data_size_old      = total_old * bucket_list->bucket_size * (int)sizeof( TheEntitytainerEntity );
+    int slot_bits_size     = total_new * bucket_list->slot_words * (int)sizeof( TheEntitytainerBitWord );
+    int free_bits_size =
+      bucket_list->free_bits != NULL ? entitytainer__free_bits_size( total_new ) * (int)sizeof( TheEntitytainerBitWord )
+                                     : 0;
+    int payload_offset = slot_bits_size + free_bits_size;
+    int payload_size   = total_new * bucket_list->bucket_size * root->config.payload_size;
+    int data_offset    = payload_offset + ( payload_size + (int)sizeof( TheEntitytainerBitWord ) - 1 ) /
+                                         (int)sizeof( TheEntitytainerBitWord ) *
+                                         (int)sizeof( TheEntitytainerBitWord );
+    int memory_size = data_offset + total_new * bucket_list->bucket_size * (int)sizeof( TheEntitytainerEntity );
+    unsigned char* memory =
+      (unsigned char*)root->config.allocate( root->config.allocate_user_data, NULL, 0, memory_size );
+    ENTITYTAINER_assert( memory != NULL );
+    ENTITYTAINER_memset( memory, 0, memory_size );
+
+    if ( bucket_list->slot_bits != NULL ) {
+        ENTITYTAINER_memcpy( memory, bucket_list->slot_bits, slot_bits_size_old );
+        bucket_list->slot_bits = (TheEntitytainerBitWord*)memory;
+    }
+
+    if ( bucket_list->free_bits != NULL ) {
+        entitytainer__move_free_bits( bucket_list, (TheEntitytainerBitWord*)( memory + slot_bits_size ), total_new );
+    }
 
-        ENTITYTAINER_assert( bucket_index_new < bucket_list_new->total_buckets ); // No free buckets at all
-        int                    bucket_offset_new = bucket_index_new * bucket_list_new->bucket_size;
-        TheEntitytainerEntity* bucket_new        = bucket_list_new->bucket_data + bucket_offset_new;
-        ENTITYTAINER_memset( bucket_new, 0, bucket_list_new->bucket_size * sizeof( TheEntitytainerEntity ) );
-        ENTITYTAINER_memcpy( bucket_new, bucket, bucket_list->bucket_size * sizeof( TheEntitytainerEntity ) );
+    if ( bucket_list->payload_data != NULL ) {
+        ENTITYTAINER_memcpy( memory + payload_offset, bucket_list->payload_data, payload_size_old );
+        bucket_list->payload_data = memory + payload_offset;
+    }
 
-        *bucket                        = (TheEntitytainerEntity)bucket_list->first_free_bucket;
-        bucket_list->first_free_bucket = bucket_index;
+    ENTITYTAINER_memcpy( memory + data_offset, bucket_list->bucket_data, data_size_old );
+    bucket_list->bucket_data = (TheEntitytainerEntity*)( memory + data_offset );
 
-        bucket_list_new->used_buckets++;
-        bucket_list->used_buckets--;
+    if ( bucket_list->grown_memory != NULL ) {
+        root->config.allocate(
+          root->config.allocate_user_data, bucket_list->grown_memory, bucket_list->grown_memory_size, 0 );
+    }
 
-        bucket       = bucket_new;
-        bucket_list  = bucket_list_new;
-        bucket_index = bucket_index_new;
-        bucket_list_index += 1;
+    bucket_list->grown_memory      = memory;
+    bucket_list->grown_memory_size = memory_size;
+    bucket_list->total_buckets     = total_new;
+    bucket_list->committed_buckets = total_new;
+    bucket_list->generation++;
 
-        // Update lookup
-        int                  bucket_list_index_new = ( bucket_list_index ) << ENTITYTAINER_BucketListOffset;
-        TheEntitytainerEntry lookup_new            = (TheEntitytainerEntry)bucket_list_index_new;
-        lookup_new                                 = lookup_new | (TheEntitytainerEntry)bucket_index_new;
-        entitytainer->entry_lookup[parent]         = lookup_new;
+    // The config is what save and load lay the lists out from.
+    for ( int channel = 0; channel < entitytainer__num_channels( &root->config ); ++channel ) {
+        root[channel].config.bucket_list_sizes[bucket_list_index] = total_new;
     }
+}
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
-#endif
+// Copies the list's free bitmap to free_bits, cleared and big enough for num_buckets, and points the list at it. The
+// words keep their indices, so both levels copy over as they are.
+static void
+entitytainer__move_free_bits( TheEntitytainerBucketList* bucket_list,
+                              TheEntitytainerBitWord*    free_bits,
+                              int                        num_buckets ) {
+    int free_words    = ( num_buckets + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    int summary_words = ( bucket_list->free_words + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+    ENTITYTAINER_memcpy(
+      free_bits, bucket_list->free_bits, bucket_list->free_words * sizeof( TheEntitytainerBitWord ) );
+    ENTITYTAINER_memcpy( free_bits + free_words,
+                         bucket_list->free_bits + bucket_list->free_words,
+                         summary_words * sizeof( TheEntitytainerBitWord ) );
+    bucket_list->free_bits  = free_bits;
+    bucket_list->free_words = free_words;
+}
+
+// Moves the bucket behind *lookup to another bucket list, keeping as many slots as fit, and frees the old one.
+static TheEntitytainerEntity*
+entitytainer__move_bucket( TheEntitytainer* entitytainer, TheEntitytainerEntry* lookup, int bucket_list_index_new ) {
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket           = entitytainer__get_bucket( entitytainer, *lookup, &bucket_list );
+    TheEntitytainerBucketList* bucket_list_new  = entitytainer->bucket_lists + bucket_list_index_new;
+    int                        bucket_index_new = entitytainer__alloc_bucket( entitytainer, bucket_list_new );
+    TheEntitytainerEntity*     bucket_new       = entitytainer__bucket( bucket_list_new, bucket_index_new );
+    TheEntitytainerEntry       lookup_new =
+      entitytainer__make_entry( entitytainer, bucket_list_index_new, bucket_index_new );
+
+    int slots_to_copy = bucket_list->bucket_size < bucket_list_new->bucket_size ? bucket_list->bucket_size
+                                                                                  : bucket_list_new->bucket_size;
+    entitytainer__store_link( bucket_new, bucket[0] );
+    ENTITYTAINER_memcpy( bucket_new + 1, bucket + 1, ( slots_to_copy - 1 ) * sizeof( TheEntitytainerEntity ) );
+    if ( bucket_list->payload_data != NULL ) {
+        ENTITYTAINER_memcpy( entitytainer__payload( entitytainer, bucket_list_new, lookup_new, 0 ),
+                             entitytainer__payload( entitytainer, bucket_list, *lookup, 0 ),
+                             slots_to_copy * entitytainer->config.payload_size );
+    }
+
+    if ( bucket_list->slot_bits != NULL ) {
+        int words_to_copy = bucket_list->slot_words < bucket_list_new->slot_words ? bucket_list->slot_words
+                                                                                    : bucket_list_new->slot_words;
+        ENTITYTAINER_memcpy( entitytainer__bucket_slot_bits( bucket_list_new, bucket_index_new ),
+                             entitytainer__slot_bits( entitytainer, bucket_list, *lookup ),
+                             words_to_copy * sizeof( TheEntitytainerBitWord ) );
+    }
+
+    entitytainer__free_bucket( entitytainer, bucket_list, *lookup & entitytainer->bucket_mask );
+
+    entitytainer__store_entry( entitytainer, lookup, lookup_new );
+    return bucket_new;
+}
+
+// Puts child in the parent's bucket, growing it if needed. Doesn't touch the parent lookup.
+static void
+entitytainer__insert_child( TheEntitytainer*      entitytainer,
+                            TheEntitytainerEntity parent,
+                            TheEntitytainerEntity child,
+                            const void*           payload ) {
+    TheEntitytainerEntry*      lookup = entitytainer__entry( entitytainer, parent );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket_for_write( entitytainer, *lookup, &bucket_list );
+    if ( bucket[0] + 1 == bucket_list->bucket_size ) {
+        int bucket_list_index = (int)( bucket_list - entitytainer->bucket_lists );
+        ENTITYTAINER_assert( bucket_list_index + 1 < entitytainer->num_bucket_lists,
+                             "Entitytainer[%s] " ENTITYTAINER_EntityFormat " has no room for more children.",
+                             "",
+                             parent );
+        bucket      = entitytainer__move_bucket( entitytainer, lookup, bucket_list_index + 1 );
+        bucket_list = entitytainer->bucket_lists + bucket_list_index + 1;
+    }
 
     // Update count and insert child into bucket
-    ENTITYTAINER_assert( bucket[index + 1] == ENTITYTAINER_InvalidEntity );
     TheEntitytainerEntity count = bucket[0] + (TheEntitytainerEntity)1;
-    bucket[0]                   = count;
-    bucket[index + 1]           = child;
+    entitytainer__store_link( bucket, count );
+    if ( entitytainer->remove_with_holes ) {
+        // The lowest clear bit is the first hole, or the slot after the last child if there are no holes.
+        TheEntitytainerBitWord* slot_bits = entitytainer__slot_bits( entitytainer, bucket_list, *lookup );
+        int                     i_word    = 0;
+        while ( ~slot_bits[i_word] == 0 ) {
+            ++i_word;
+        }
 
-    ENTITYTAINER_assert( entitytainer->entry_parent_lookup[child] == ENTITYTAINER_InvalidEntity,
-                         "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
-                         " as child to " ENTITYTAINER_EntityFormat
-                         " but it was already parented to " ENTITYTAINER_EntityFormat,
-                         "",
-                         child,
-                         parent,
-                         entitytainer->entry_parent_lookup[child] );
-    entitytainer->entry_parent_lookup[child] = parent;
+        int slot = i_word * ENTITYTAINER_BitWordBits + ENTITYTAINER_ctz64( ~slot_bits[i_word] );
+        slot_bits[i_word] |= (TheEntitytainerBitWord)1 << ( slot % ENTITYTAINER_BitWordBits );
+        bucket[1 + slot] = child;
+        entitytainer__set_payload( entitytainer, bucket_list, *lookup, 1 + slot, payload );
+    }
+    else if ( entitytainer->config.sorted_children ) {
+        int index = entitytainer__lower_bound( bucket + 1, count - 1, child );
+        ENTITYTAINER_memmove( bucket + 2 + index, bucket + 1 + index, ( count - 1 - index ) * sizeof( *bucket ) );
+        entitytainer__move_payloads( entitytainer, bucket_list, *lookup, 2 + index, 1 + index, count - 1 - index );
+        bucket[1 + index] = child;
+        entitytainer__set_payload( entitytainer, bucket_list, *lookup, 1 + index, payload );
+    }
+    else {
+        bucket[count] = child;
+        entitytainer__set_payload( entitytainer, bucket_list, *lookup, count, payload );
+    }
 }
 
-ENTITYTAINER_API void
-entitytainer_remove_child_no_holes( TheEntitytainer*      entitytainer,
-                                    TheEntitytainerEntity parent,
-                                    TheEntitytainerEntity child ) {
-    ASSERT( !entitytainer->config.remove_with_holes );
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
+// Takes child out of the parent's bucket without shrinking it. Doesn't touch the parent lookup.
+static void
+entitytainer__remove_child( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, TheEntitytainerEntity child ) {
+    TheEntitytainerEntry lookup = *entitytainer__entry( entitytainer, parent );
     ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = (TheEntitytainerEntity*)( bucket_list->bucket_data + bucket_offset );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket_for_write( entitytainer, lookup, &bucket_list );
+    if ( entitytainer->remove_with_holes ) {
+        // Only look at live slots.
+        TheEntitytainerBitWord* slot_bits = entitytainer__slot_bits( entitytainer, bucket_list, lookup );
+        int                     slot      = -1;
+        for ( int i_word = 0; i_word < bucket_list->slot_words && slot == -1; ++i_word ) {
+            TheEntitytainerBitWord word = slot_bits[i_word];
+            while ( word != 0 ) {
+                int i = i_word * ENTITYTAINER_BitWordBits + ENTITYTAINER_ctz64( word );
+                if ( bucket[1 + i] == child ) {
+                    slot = i;
+                    break;
+                }
+
+                word &= word - 1;
+            }
+        }
 
-    // Remove child from bucket, move children after forward one step.
-    int                    num_children  = bucket[0];
-    TheEntitytainerEntity* child_to_move = &bucket[1];
-    int                    count         = 0;
-    while ( *child_to_move != child && count < num_children ) {
-        ++count;
-        ++child_to_move;
+        ENTITYTAINER_assert( slot != -1 );
+        slot_bits[slot / ENTITYTAINER_BitWordBits] &=
+          ~( (TheEntitytainerBitWord)1 << ( slot % ENTITYTAINER_BitWordBits ) );
+        bucket[1 + slot] = ENTITYTAINER_InvalidEntity;
+    }
+    else if ( entitytainer->config.sorted_children ) {
+        int num_children = bucket[0];
+        int index        = entitytainer__lower_bound( bucket + 1, num_children, child );
+        ENTITYTAINER_assert( index < num_children && bucket[1 + index] == child );
+        ENTITYTAINER_memmove(
+          bucket + 1 + index, bucket + 2 + index, ( num_children - 1 - index ) * sizeof( *bucket ) );
+        entitytainer__move_payloads(
+          entitytainer, bucket_list, lookup, 1 + index, 2 + index, num_children - 1 - index );
     }
+    else {
+        // Remove child from bucket, move children after forward one step.
+        int                    num_children  = bucket[0];
+        TheEntitytainerEntity* child_to_move = &bucket[1];
+        int                    count         = 0;
+        while ( *child_to_move != child && count < num_children ) {
+            ++count;
+            ++child_to_move;
+        }
 
-    ENTITYTAINER_assert( count < num_children );
+        ENTITYTAINER_assert( count < num_children );
+        entitytainer__move_payloads(
+          entitytainer, bucket_list, lookup, 1 + count, 2 + count, num_children - 1 - count );
 
-    for ( ; count < num_children - 1; ++count ) {
-        *child_to_move = *( child_to_move + 1 );
-        ++child_to_move;
+        for ( ; count < num_children - 1; ++count ) {
+            *child_to_move = *( child_to_move + 1 );
+            ++child_to_move;
+        }
     }
 
-    // Lower child count, clear entry
-    bucket[0]--;
-    entitytainer->entry_parent_lookup[child] = 0;
+    // Lower child count
+    entitytainer__store_link( bucket, bucket[0] - (TheEntitytainerEntity)1 );
+}
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
-#endif
+// Moves the parent's bucket down to smaller bucket lists for as long as its children fit.
+static void
+entitytainer__shrink( TheEntitytainer* entitytainer, TheEntitytainerEntity parent ) {
+    TheEntitytainerEntry* lookup = entitytainer__entry( entitytainer, parent );
+    entitytainer__shrink_bucket( entitytainer, lookup, entitytainer->remove_with_holes );
+}
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
-        entitytainer_remove_child_no_holes( entitytainer, parent, child );
+static void
+entitytainer__shrink_bucket( TheEntitytainer* entitytainer, TheEntitytainerEntry* lookup, bool with_holes ) {
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket( entitytainer, *lookup, &bucket_list );
+
+    // In holes mode the last used slot decides the size, not the count.
+    int slots_needed = bucket[0] + 1;
+    if ( with_holes ) {
+        int last_child_index = 0;
+        for ( int i = bucket_list->bucket_size - 1; i > 0; --i ) {
+            if ( bucket[i] != ENTITYTAINER_InvalidEntity ) {
+                last_child_index = i;
+                break;
+            }
+        }
+
+        slots_needed = last_child_index + ENTITYTAINER_ShrinkMargin + 1;
     }
-#endif
 
-    if ( entitytainer->keep_capacity_on_remove ) {
+    int bucket_list_index     = (int)( bucket_list - entitytainer->bucket_lists );
+    int bucket_list_index_new = bucket_list_index;
+    while ( bucket_list_index_new > 0 &&
+            slots_needed <= entitytainer->bucket_lists[bucket_list_index_new - 1].bucket_size ) {
+        --bucket_list_index_new;
+    }
+
+    if ( bucket_list_index_new != bucket_list_index ) {
+        entitytainer__move_bucket( entitytainer, lookup, bucket_list_index_new );
+    }
+}
+
+// Records parent as the child's parent. With multi_parent it's appended to the child's parent bucket, which is
+// allocated on the first parent.
+static void
+entitytainer__link_parent( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, TheEntitytainerEntity child ) {
+    if ( !entitytainer->config.multi_parent ) {
+        ENTITYTAINER_assert( *entitytainer__parent( entitytainer, child ) == ENTITYTAINER_InvalidEntity,
+                             "Entitytainer[%s] Tried to add " ENTITYTAINER_EntityFormat
+                             " as child to " ENTITYTAINER_EntityFormat
+                             " but it was already parented to " ENTITYTAINER_EntityFormat,
+                             "",
+                             child,
+                             parent,
+                             *entitytainer__parent( entitytainer, child ) );
+        *entitytainer__parent( entitytainer, child ) = parent;
         return;
     }
 
-    TheEntitytainerBucketList* bucket_list_prev =
-      bucket_list_index > 0 ? ( entitytainer->bucket_lists + bucket_list_index - 1 ) : NULL;
-    if ( bucket_list_prev != NULL && bucket[0] + 1 == bucket_list_prev->bucket_size ) {
-        TheEntitytainerBucketList* bucket_list_new  = bucket_list_prev;
-        int                        bucket_index_new = bucket_list_new->used_buckets;
-        if ( bucket_list_new->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
-            // There's a freed bucket available
-            bucket_index_new                   = bucket_list_new->first_free_bucket;
-            int bucket_offset_new              = bucket_index_new * bucket_list_new->bucket_size;
-            bucket_list_new->first_free_bucket = bucket_list_new->bucket_data[bucket_offset_new];
+    TheEntitytainerEntry* lookup = entitytainer__parents_entry( entitytainer, child );
+    if ( *lookup == 0 ) {
+        int bucket_index = entitytainer__alloc_bucket( entitytainer, &entitytainer->bucket_lists[0] );
+        *lookup          = entitytainer__make_entry( entitytainer, 0, bucket_index );
+    }
+
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket = entitytainer__get_bucket_for_write( entitytainer, *lookup, &bucket_list );
+    if ( bucket[0] + 1 == bucket_list->bucket_size ) {
+        int bucket_list_index = (int)( bucket_list - entitytainer->bucket_lists );
+        ENTITYTAINER_assert( bucket_list_index + 1 < entitytainer->num_bucket_lists,
+                             "Entitytainer[%s] " ENTITYTAINER_EntityFormat " has no room for more parents.",
+                             "",
+                             child );
+        bucket = entitytainer__move_bucket( entitytainer, lookup, bucket_list_index + 1 );
+    }
+
+    bucket[0]++;
+    bucket[bucket[0]] = parent;
+}
+
+static void
+entitytainer__unlink_parent( TheEntitytainer*      entitytainer,
+                             TheEntitytainerEntity parent,
+                             TheEntitytainerEntity child ) {
+    if ( !entitytainer->config.multi_parent ) {
+        *entitytainer__parent( entitytainer, child ) = ENTITYTAINER_InvalidEntity;
+        return;
+    }
+
+    TheEntitytainerEntry* lookup = entitytainer__parents_entry( entitytainer, child );
+    ENTITYTAINER_assert( *lookup != 0 );
+    TheEntitytainerBucketList* bucket_list;
+    TheEntitytainerEntity*     bucket      = entitytainer__get_bucket_for_write( entitytainer, *lookup, &bucket_list );
+    int                        num_parents = bucket[0];
+    int                        index       = 1;
+    while ( index <= num_parents && bucket[index] != parent ) {
+        ++index;
+    }
+
+    ENTITYTAINER_assert( index <= num_parents );
+    ENTITYTAINER_memmove( bucket + index, bucket + index + 1, ( num_parents - index ) * sizeof( *bucket ) );
+    bucket[0]--;
+    if ( bucket[0] == 0 ) {
+        entitytainer__free_bucket( entitytainer, bucket_list, *lookup & entitytainer->bucket_mask );
+        *lookup = 0;
+    }
+    else if ( !entitytainer->keep_capacity_on_remove ) {
+        entitytainer__shrink_bucket( entitytainer, lookup, false );
+    }
+}
+
+// Index of the first child that isn't less than entity.
+static int
+entitytainer__lower_bound( const TheEntitytainerEntity* children, int num_children, TheEntitytainerEntity entity ) {
+    int low  = 0;
+    int high = num_children;
+    while ( low < high ) {
+        int middle = ( low + high ) / 2;
+        if ( children[middle] < entity ) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// Puts the slot bits of all bucket lists at buffer, returns where the bucket data can start.
+static unsigned char*
+entitytainer__assign_slot_bits( TheEntitytainer* entitytainer, unsigned char* buffer ) {
+    if ( entitytainer->remove_with_holes ) {
+        buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer,
+                                                                   (int)ENTITYTAINER_alignof( TheEntitytainerBitWord ) );
+    }
+
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        list->slot_bits                 = NULL;
+        list->slot_words                = 0;
+        if ( entitytainer->remove_with_holes ) {
+            int bucket_size  = entitytainer->config.bucket_sizes[i];
+            list->slot_bits  = (TheEntitytainerBitWord*)buffer;
+            list->slot_words = ( bucket_size - 1 + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+            buffer += entitytainer->config.bucket_list_sizes[i] * list->slot_words * sizeof( TheEntitytainerBitWord );
+        }
+    }
+
+    return buffer;
+}
+
+static unsigned char*
+entitytainer__assign_free_bits( TheEntitytainer* entitytainer, unsigned char* buffer ) {
+    if ( entitytainer->config.lowest_free_bucket ) {
+        buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer,
+                                                                   (int)ENTITYTAINER_alignof( TheEntitytainerBitWord ) );
+    }
+
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        list->free_bits                 = NULL;
+        list->free_words                = 0;
+        if ( entitytainer->config.lowest_free_bucket ) {
+            int num_buckets  = entitytainer__free_bit_buckets( &entitytainer->config, i );
+            list->free_bits  = (TheEntitytainerBitWord*)buffer;
+            list->free_words = ( num_buckets + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits;
+            buffer += entitytainer__free_bits_size( num_buckets ) * sizeof( TheEntitytainerBitWord );
+        }
+    }
+
+    return buffer;
+}
+
+// Everything of the bucket lists that comes after the list structs: slot bits, free bits, payloads and the buckets
+// themselves.
+static unsigned char*
+entitytainer__assign_bucket_data( TheEntitytainer* entitytainer, unsigned char* buffer ) {
+    int bucket_page_size = entitytainer->config.bucket_page_size;
+    if ( bucket_page_size > 0 ) {
+        buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr(
+          buffer, (int)ENTITYTAINER_alignof( TheEntitytainerBucketPage ) );
+    }
+
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        entitytainer->bucket_lists[i].pages = NULL;
+        if ( bucket_page_size > 0 ) {
+            entitytainer->bucket_lists[i].pages = (TheEntitytainerBucketPage*)buffer;
+            buffer += entitytainer__max_pages( &entitytainer->config, i ) * sizeof( TheEntitytainerBucketPage );
         }
+    }
 
-        int                    bucket_offset_new = bucket_index_new * bucket_list_new->bucket_size;
-        TheEntitytainerEntity* bucket_new        = bucket_list_new->bucket_data + bucket_offset_new;
-        ENTITYTAINER_memcpy( bucket_new, bucket, bucket_list_new->bucket_size * sizeof( TheEntitytainerEntity ) );
+    buffer = entitytainer__assign_slot_bits( entitytainer, buffer );
+    buffer = entitytainer__assign_free_bits( entitytainer, buffer );
+    buffer = entitytainer__assign_payloads( entitytainer, buffer );
+    TheEntitytainerEntity* bucket_data = (TheEntitytainerEntity*)entitytainer__ptr_to_aligned_ptr(
+      buffer, (int)ENTITYTAINER_alignof( TheEntitytainerEntity ) );
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        entitytainer->bucket_lists[i].bucket_data = bucket_data;
+        bucket_data += entitytainer->config.bucket_sizes[i] * entitytainer->config.bucket_list_sizes[i];
+    }
+
+    return (unsigned char*)bucket_data;
+}
+
+// Splits the bucket lists in the main allocation into pages.
+static void
+entitytainer__assign_pages( TheEntitytainer* entitytainer ) {
+    int bucket_page_size = entitytainer->config.bucket_page_size;
+    if ( bucket_page_size == 0 ) {
+        return;
+    }
+
+    int page_shift = 0;
+    while ( ( 1 << page_shift ) < bucket_page_size ) {
+        ++page_shift;
+    }
+
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        list->page_shift                = page_shift;
+        list->num_pages                 = list->total_buckets / bucket_page_size;
+        list->num_inline_pages          = list->num_pages;
+        for ( int i_page = 0; i_page < list->num_pages; ++i_page ) {
+            int                        first_bucket = i_page * bucket_page_size;
+            TheEntitytainerBucketPage* page         = &list->pages[i_page];
+            page->bucket_data                       = list->bucket_data + first_bucket * list->bucket_size;
+            page->slot_bits    = list->slot_bits != NULL ? list->slot_bits + first_bucket * list->slot_words : NULL;
+            page->payload_data = list->payload_data != NULL
+                                   ? list->payload_data +
+                                       first_bucket * list->bucket_size * entitytainer->config.payload_size
+                                   : NULL;
+            page->memory       = NULL;
+            page->memory_size  = 0;
+            page->generation   = list->snapshot_generation;
+        }
+    }
+}
 
-        bucket_list_new->used_buckets++;
-        bucket_list->used_buckets--;
+// Adds a page from config.allocate to the end of the bucket list. Nothing moves.
+static void
+entitytainer__append_page( TheEntitytainer* entitytainer, TheEntitytainerBucketList* bucket_list ) {
+    TheEntitytainer* root              = entitytainer - entitytainer->channel;
+    int              bucket_list_index = (int)( bucket_list - root->bucket_lists );
+    int              bucket_page_size  = 1 << bucket_list->page_shift;
+    ENTITYTAINER_assert( bucket_list->num_pages < entitytainer__max_pages( &root->config, bucket_list_index ),
+                         "Entitytainer[%s] Bucket list %d has no room for pages past %d buckets, see "
+                         "max_bucket_list_sizes.",
+                         "",
+                         bucket_list_index,
+                         bucket_list->total_buckets );
 
-        // Update lookup
-        int                  bucket_list_index_new = ( bucket_list_index - 1 ) << ENTITYTAINER_BucketListOffset;
-        TheEntitytainerEntry lookup_new            = (TheEntitytainerEntry)bucket_list_index_new;
-        lookup_new                                 = lookup_new | (TheEntitytainerEntry)bucket_index_new;
-        entitytainer->entry_lookup[parent]         = lookup_new;
+    TheEntitytainerBucketPage* page   = &bucket_list->pages[bucket_list->num_pages];
+    unsigned char*             memory = entitytainer__alloc_page( &root->config, bucket_list, page );
+    ENTITYTAINER_memset( memory, 0, page->memory_size );
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-        ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
-#endif
+    ++bucket_list->num_pages;
+    bucket_list->total_buckets += bucket_page_size;
+    bucket_list->committed_buckets = bucket_list->total_buckets;
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-        if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
-            entitytainer_remove_child_no_holes( entitytainer, parent, child );
-        }
-#endif
+    int free_buckets_old = entitytainer__free_bit_buckets( &root->config, bucket_list_index );
+    for ( int channel = 0; channel < entitytainer__num_channels( &root->config ); ++channel ) {
+        root[channel].config.bucket_list_sizes[bucket_list_index] = bucket_list->total_buckets;
     }
-}
 
-ENTITYTAINER_API void
-entitytainer_remove_child_with_holes( TheEntitytainer*      entitytainer,
-                                      TheEntitytainerEntity parent,
-                                      TheEntitytainerEntity child ) {
-    ENTITYTAINER_assert( entitytainer->remove_with_holes );
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = (TheEntitytainerEntity*)( bucket_list->bucket_data + bucket_offset );
-
-    // Remove child from bucket, move children after forward one step.
-    int capacity            = bucket_list->bucket_size;
-    int last_child_index    = 0;
-    int child_to_move_index = 0;
-    for ( int i = 1; i < capacity; i++ ) {
-        if ( bucket[i] == child ) {
-            child_to_move_index = i;
+    // The free bitmap moves to memory from allocate when the new page doesn't fit in it, and keeps that until the
+    // list is destroyed. Paged lists don't grow otherwise, so it's the list's grown memory.
+    int free_buckets = entitytainer__free_bit_buckets( &root->config, bucket_list_index );
+    if ( bucket_list->free_bits != NULL && free_buckets != free_buckets_old ) {
+        int free_bits_size = entitytainer__free_bits_size( free_buckets ) * (int)sizeof( TheEntitytainerBitWord );
+        TheEntitytainerBitWord* free_bits = (TheEntitytainerBitWord*)root->config.allocate(
+          root->config.allocate_user_data, NULL, 0, free_bits_size );
+        ENTITYTAINER_assert( free_bits != NULL );
+        ENTITYTAINER_memset( free_bits, 0, free_bits_size );
+        entitytainer__move_free_bits( bucket_list, free_bits, free_buckets );
+        if ( bucket_list->grown_memory != NULL ) {
+            root->config.allocate(
+              root->config.allocate_user_data, bucket_list->grown_memory, bucket_list->grown_memory_size, 0 );
         }
-        else if ( bucket[i] != ENTITYTAINER_InvalidEntity ) {
-            last_child_index = i;
-        }
-    }
 
-    ENTITYTAINER_assert( child_to_move_index != 0 );
-    bucket[child_to_move_index] = ENTITYTAINER_InvalidEntity;
+        bucket_list->grown_memory      = (unsigned char*)free_bits;
+        bucket_list->grown_memory_size = free_bits_size;
+    }
+}
 
-    // Lower child count, clear entry
-    bucket[0]--;
-    entitytainer->entry_parent_lookup[child] = 0;
+// Points the page at new memory from config.allocate, laid out the same as when growing a whole list: bit words,
+// payloads padded to bit words, buckets. Nothing is cleared.
+static unsigned char*
+entitytainer__alloc_page( const struct TheEntitytainerConfig* config,
+                          const TheEntitytainerBucketList*    bucket_list,
+                          TheEntitytainerBucketPage*          page ) {
+    int bucket_page_size = 1 << bucket_list->page_shift;
+    int slot_bits_size   = bucket_page_size * bucket_list->slot_words * (int)sizeof( TheEntitytainerBitWord );
+    int payload_size     = bucket_page_size * bucket_list->bucket_size * config->payload_size;
+    int data_offset      = slot_bits_size + ( payload_size + (int)sizeof( TheEntitytainerBitWord ) - 1 ) /
+                                         (int)sizeof( TheEntitytainerBitWord ) *
+                                         (int)sizeof( TheEntitytainerBitWord );
+    int memory_size = data_offset + bucket_page_size * bucket_list->bucket_size * (int)sizeof( TheEntitytainerEntity );
+    unsigned char* memory = (unsigned char*)config->allocate( config->allocate_user_data, NULL, 0, memory_size );
+    ENTITYTAINER_assert( memory != NULL );
+
+    page->memory       = memory;
+    page->memory_size  = memory_size;
+    page->slot_bits    = bucket_list->slot_bits != NULL ? (TheEntitytainerBitWord*)memory : NULL;
+    page->payload_data = bucket_list->payload_data != NULL ? memory + slot_bits_size : NULL;
+    page->bucket_data  = (TheEntitytainerEntity*)( memory + data_offset );
+    page->generation   = bucket_list->snapshot_generation;
+    return memory;
+}
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-    ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ),
-                         "Entitytainer[%s] Removed child " ENTITYTAINER_EntityFormat
-                         " from parent " ENTITYTAINER_EntityFormat ", but it was still its child.",
-                         "",
-                         child,
-                         parent );
-#endif
+// The page with the bucket, as it is. Reading doesn't copy it, even while a snapshot shares it.
+static const TheEntitytainerBucketPage*
+entitytainer__page( const TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+    return &bucket_list->pages[bucket_index >> bucket_list->page_shift];
+}
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-    if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
-        entitytainer_remove_child_with_holes( entitytainer, parent, child );
+// Makes the page with the bucket the list's own before it's changed. While a snapshot is held, a page it shares is
+// copied first, and the copy is the list's from then on. The snapshot keeps the old one.
+static void
+entitytainer__own_page( TheEntitytainerBucketList* bucket_list, int bucket_index ) {
+    if ( bucket_list->pages == NULL || bucket_list->snapshot_config == NULL ) {
+        return;
     }
-#endif
 
-    if ( entitytainer->keep_capacity_on_remove ) {
+    TheEntitytainerBucketPage* page = &bucket_list->pages[bucket_index >> bucket_list->page_shift];
+    if ( page->generation == bucket_list->snapshot_generation ) {
         return;
     }
 
-    TheEntitytainerBucketList* bucket_list_prev =
-      bucket_list_index > 0 ? ( entitytainer->bucket_lists + bucket_list_index - 1 ) : NULL;
-    if ( bucket_list_prev != NULL && last_child_index + ENTITYTAINER_ShrinkMargin < bucket_list_prev->bucket_size ) {
-        // We've shrunk enough to fit in the previous bucket, move.
-        TheEntitytainerBucketList* bucket_list_new   = bucket_list_prev;
-        int                        bucket_index_new  = bucket_list_new->used_buckets;
-        int                        bucket_offset_new = bucket_index_new * bucket_list_new->bucket_size;
-        if ( bucket_list_new->first_free_bucket != ENTITYTAINER_NoFreeBucket ) {
-            // There's a freed bucket available
-            bucket_index_new                   = bucket_list_new->first_free_bucket;
-            bucket_offset_new                  = bucket_index_new * bucket_list_new->bucket_size;
-            bucket_list_new->first_free_bucket = bucket_list_new->bucket_data[bucket_offset_new];
-        }
-
-        TheEntitytainerEntity* bucket_new = bucket_list_new->bucket_data + bucket_offset_new;
-        ENTITYTAINER_memcpy( bucket_new, bucket, bucket_list_new->bucket_size * sizeof( TheEntitytainerEntity ) );
+    // Pages in the main allocation aren't in one piece, so the parts are copied one by one.
+    int                       bucket_page_size = 1 << bucket_list->page_shift;
+    int                       num_slots        = bucket_page_size * bucket_list->bucket_size;
+    TheEntitytainerBucketPage shared           = *page;
+    entitytainer__alloc_page( bucket_list->snapshot_config, bucket_list, page );
+    ENTITYTAINER_memcpy( page->bucket_data, shared.bucket_data, num_slots * sizeof( TheEntitytainerEntity ) );
+    if ( page->slot_bits != NULL ) {
+        ENTITYTAINER_memcpy( page->slot_bits,
+                             shared.slot_bits,
+                             bucket_page_size * bucket_list->slot_words * sizeof( TheEntitytainerBitWord ) );
+    }
 
-        bucket_list_new->used_buckets++;
-        bucket_list->used_buckets--;
+    if ( page->payload_data != NULL ) {
+        ENTITYTAINER_memcpy(
+          page->payload_data, shared.payload_data, num_slots * bucket_list->snapshot_config->payload_size );
+    }
 
-        // Update lookup
-        int                  bucket_list_index_new = ( bucket_list_index - 1 ) << ENTITYTAINER_BucketListOffset;
-        TheEntitytainerEntry lookup_new            = (TheEntitytainerEntry)bucket_list_index_new;
-        lookup_new                                 = lookup_new | (TheEntitytainerEntry)bucket_index_new;
-        entitytainer->entry_lookup[parent]         = lookup_new;
+    // Pointers into the page from before are the snapshot's now, so callers keeping them have to refetch.
+    ++bucket_list->generation;
+}
 
-#if ENTITYTAINER_DEFENSIVE_ASSERTS
-        ENTITYTAINER_assert( !entitytainer__child_in_bucket( bucket, bucket_list, child ) );
+#if ENTITYTAINER_MMAP
+// Makes the buckets up to bucket_index usable. Done a chunk at a time, so most allocations don't need a system call.
+static void
+entitytainer__commit_buckets( TheEntitytainer*           entitytainer,
+                              TheEntitytainerBucketList* bucket_list,
+                              int                        bucket_index ) {
+    TheEntitytainer* root         = entitytainer - entitytainer->channel;
+    uintptr_t        page_size    = (uintptr_t)sysconf( _SC_PAGESIZE );
+    uintptr_t        chunk_size   = root->huge_pages ? ENTITYTAINER_HugePageSize : ENTITYTAINER_CommitChunkSize;
+    uintptr_t        bucket_bytes = bucket_list->bucket_size * sizeof( TheEntitytainerEntity );
+    uintptr_t        data         = (uintptr_t)bucket_list->bucket_data;
+    uintptr_t        limit        = (uintptr_t)root->config.memory + root->config.memory_size;
+    uintptr_t        begin        = ( data + bucket_list->committed_buckets * bucket_bytes ) & ~( page_size - 1 );
+    uintptr_t        end          = data + ( bucket_index + 1 ) * bucket_bytes;
+    end                           = ( end + chunk_size - 1 ) & ~( chunk_size - 1 );
+    end                           = end < limit ? end : limit;
+    int result                    = mprotect( (void*)begin, end - begin, PROT_READ | PROT_WRITE );
+    ENTITYTAINER_assert( result == 0 );
+    (void)result;
+
+    int committed                  = (int)( ( end - data ) / bucket_bytes );
+    bucket_list->committed_buckets = committed < bucket_list->total_buckets ? committed : bucket_list->total_buckets;
+}
 #endif
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-        if ( entitytainer__child_in_bucket( bucket, bucket_list, child ) ) {
-            entitytainer_remove_child_with_holes( entitytainer, parent, child );
+// The payloads of a bucket list have the same layout as its bucket data, payload_size bytes per slot.
+static unsigned char*
+entitytainer__assign_payloads( TheEntitytainer* entitytainer, unsigned char* buffer ) {
+    int payload_size = entitytainer->config.payload_size;
+    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
+        TheEntitytainerBucketList* list = &entitytainer->bucket_lists[i];
+        list->payload_data              = NULL;
+        if ( payload_size > 0 ) {
+            buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr(
+              buffer, (int)ENTITYTAINER_alignof( TheEntitytainerBitWord ) );
+            list->payload_data = buffer;
+            buffer += entitytainer->config.bucket_list_sizes[i] * entitytainer->config.bucket_sizes[i] * payload_size;
         }
-#endif
     }
+
+    return buffer;
 }
 
-ENTITYTAINER_API void
-entitytainer_get_children( TheEntitytainer*        entitytainer,
-                           TheEntitytainerEntity   parent,
-                           TheEntitytainerEntity** children,
-                           int*                    num_children,
-                           int*                    capacity ) {
+static unsigned char*
+entitytainer__payload( const TheEntitytainer*           entitytainer,
+                       const TheEntitytainerBucketList* bucket_list,
+                       TheEntitytainerEntry             lookup,
+                       int                              slot ) {
+    if ( bucket_list->payload_data == NULL ) {
+        return NULL;
+    }
 
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = (TheEntitytainerEntity*)( bucket_list->bucket_data + bucket_offset );
-    *num_children                                = (int)bucket[0];
-    *children                                    = bucket + 1;
-    *capacity                                    = bucket_list->bucket_size - 1;
+    int bucket_index = lookup & entitytainer->bucket_mask;
+    if ( bucket_list->pages == NULL ) {
+        int bucket_offset = bucket_index * bucket_list->bucket_size;
+        return bucket_list->payload_data + ( bucket_offset + slot ) * entitytainer->config.payload_size;
+    }
+
+    const TheEntitytainerBucketPage* page = entitytainer__page( bucket_list, bucket_index );
+    int bucket_offset = ( bucket_index & ( ( 1 << bucket_list->page_shift ) - 1 ) ) * bucket_list->bucket_size;
+    return page->payload_data + ( bucket_offset + slot ) * entitytainer->config.payload_size;
 }
 
-ENTITYTAINER_API int
-entitytainer_num_children( TheEntitytainer* entitytainer, TheEntitytainerEntity parent ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = (TheEntitytainerEntity*)( bucket_list->bucket_data + bucket_offset );
-    return (int)bucket[0];
+static void
+entitytainer__move_payloads( const TheEntitytainer*           entitytainer,
+                             const TheEntitytainerBucketList* bucket_list,
+                             TheEntitytainerEntry             lookup,
+                             int                              slot_dst,
+                             int                              slot_src,
+                             int                              num_slots ) {
+    if ( bucket_list->payload_data != NULL ) {
+        ENTITYTAINER_memmove( entitytainer__payload( entitytainer, bucket_list, lookup, slot_dst ),
+                              entitytainer__payload( entitytainer, bucket_list, lookup, slot_src ),
+                              num_slots * entitytainer->config.payload_size );
+    }
 }
 
-ENTITYTAINER_API int
-entitytainer_get_child_index( TheEntitytainer*      entitytainer,
-                              TheEntitytainerEntity parent,
-                              TheEntitytainerEntity child ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[parent];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = (TheEntitytainerEntity*)( bucket_list->bucket_data + bucket_offset );
-    int                        num_children      = (int)bucket[0];
-    for ( int i = 0; i < num_children; ++i ) {
-        if ( bucket[1 + i] == child ) {
-            return i;
-        }
+static void
+entitytainer__set_payload( const TheEntitytainer*           entitytainer,
+                           const TheEntitytainerBucketList* bucket_list,
+                           TheEntitytainerEntry             lookup,
+                           int                              slot,
+                           const void*                      payload ) {
+    unsigned char* dst = entitytainer__payload( entitytainer, bucket_list, lookup, slot );
+    if ( dst == NULL ) {
+        return;
     }
 
-    return -1;
+    if ( payload != NULL ) {
+        ENTITYTAINER_memcpy( dst, payload, entitytainer->config.payload_size );
+    }
+    else {
+        ENTITYTAINER_memset( dst, 0, entitytainer->config.payload_size );
+    }
 }
 
-ENTITYTAINER_API TheEntitytainerEntity
-entitytainer_get_parent( TheEntitytainer* entitytainer, TheEntitytainerEntity child ) {
-    TheEntitytainerEntity parent = entitytainer->entry_parent_lookup[child];
-    return parent;
+// For a child that's in both parents' buckets while it's moved. Both are looked up after the insert into parent_dst,
+// since that can grow a bucket list and move parent_src's bucket along with it.
+static void
+entitytainer__copy_child_payload( TheEntitytainer*      entitytainer,
+                                  TheEntitytainerEntity parent_src,
+                                  TheEntitytainerEntity parent_dst,
+                                  TheEntitytainerEntity child ) {
+    if ( entitytainer->config.payload_size == 0 || parent_src == ENTITYTAINER_InvalidEntity ) {
+        return;
+    }
+
+    const void* src = entitytainer_get_child_payload( entitytainer, parent_src, child );
+    void*       dst = entitytainer_get_child_payload( entitytainer, parent_dst, child );
+    if ( src != NULL && dst != NULL ) {
+        ENTITYTAINER_memcpy( dst, src, entitytainer->config.payload_size );
+    }
 }
 
-ENTITYTAINER_API bool
-entitytainer_is_added( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[entity];
-    return lookup != 0;
+static int
+entitytainer__num_channels( const struct TheEntitytainerConfig* config ) {
+    return config->num_channels > 0 ? config->num_channels : 1;
 }
 
-ENTITYTAINER_API void
-entitytainer_remove_holes( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
-    // TODO
-    ENTITYTAINER_assert( false );
-    TheEntitytainerEntry lookup = entitytainer->entry_lookup[entity];
-    ENTITYTAINER_assert( lookup != 0 );
-    int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-    TheEntitytainerBucketList* bucket_list       = entitytainer->bucket_lists + bucket_list_index;
-    int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-    int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-    TheEntitytainerEntity*     bucket            = (TheEntitytainerEntity*)( bucket_list->bucket_data + bucket_offset );
-    int                        first_free_index  = 1;
-    for ( int i = 1; i < bucket_list->bucket_size; ++i ) {
-        TheEntitytainerEntity child = bucket[i];
-        if ( child != ENTITYTAINER_InvalidEntity ) {
-            for ( int i_free = first_free_index; i_free < i; ++i_free ) {
-                if ( bucket[i_free] == ENTITYTAINER_InvalidEntity ) {
-                    first_free_index = i_free + 1;
-                    bucket[i_free]   = child;
-                    bucket[i]        = ENTITYTAINER_InvalidEntity;
-                    break;
-                }
-            }
+// The channels are copies of the main entitytainer, placed right after it, looking at their own column of the lookups.
+static void
+entitytainer__assign_channels( TheEntitytainer* entitytainer ) {
+    for ( int channel = 1; channel < entitytainer__num_channels( &entitytainer->config ); ++channel ) {
+        TheEntitytainer* entitytainer_channel = entitytainer + channel;
+        *entitytainer_channel                 = *entitytainer;
+        entitytainer_channel->channel         = channel;
+        entitytainer_channel->entry_lookup += channel;
+        if ( entitytainer->config.multi_parent ) {
+            entitytainer_channel->entry_parents_lookup += channel;
+        }
+        else {
+            entitytainer_channel->entry_parent_lookup += channel;
         }
     }
 }
 
-ENTITYTAINER_API int
-entitytainer_save( TheEntitytainer* entitytainer, unsigned char* buffer, int buffer_size ) {
+static TheEntitytainerEntry*
+entitytainer__entry( const TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    return (TheEntitytainerEntry*)( (unsigned char*)entitytainer->entry_lookup + entity * entitytainer->entry_stride );
+}
 
-    TheEntitytainerBucketList* last       = &entitytainer->bucket_lists[entitytainer->num_bucket_lists - 1];
-    TheEntitytainerEntity*     entity_end = last->bucket_data + last->bucket_size * last->total_buckets;
-    unsigned char*             begin      = (unsigned char*)entitytainer;
-    unsigned char*             end        = (unsigned char*)entity_end;
-    int                        size       = (int)( end - begin );
-    if ( size > buffer_size ) {
-        return size;
-    }
+static TheEntitytainerEntry*
+entitytainer__parents_entry( const TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    return (TheEntitytainerEntry*)( (unsigned char*)entitytainer->entry_parents_lookup +
+                                    entity * entitytainer->entry_stride );
+}
 
-    ENTITYTAINER_memcpy( buffer, entitytainer, size );
-    return size;
+static TheEntitytainerEntity*
+entitytainer__parent( const TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    return (TheEntitytainerEntity*)( (unsigned char*)entitytainer->entry_parent_lookup +
+                                     entity * entitytainer->parent_stride );
 }
 
-ENTITYTAINER_API TheEntitytainer*
-                 entitytainer_load( unsigned char* buffer, int buffer_size ) {
-    ENTITYTAINER_assert( entitytainer__ptr_to_aligned_ptr( buffer, (int)ENTITYTAINER_alignof( TheEntitytainer ) ) ==
-                         buffer );
+// One record per entity: the entries of all channels, then their parents, padded so both stay aligned.
+static int
+entitytainer__interleaved_stride( const struct TheEntitytainerConfig* config, int* parent_offset ) {
+    int num_channels = entitytainer__num_channels( config );
+    int entry_size   = (int)sizeof( TheEntitytainerEntry );
+    int parent_size  = config->multi_parent ? entry_size : (int)sizeof( TheEntitytainerEntity );
+    int align        = entry_size > parent_size ? entry_size : parent_size;
+    *parent_offset   = ( entry_size * num_channels + parent_size - 1 ) / parent_size * parent_size;
+    return ( *parent_offset + parent_size * num_channels + align - 1 ) / align * align;
+}
 
-    // Fix pointers
-    TheEntitytainer* entitytainer = (TheEntitytainer*)buffer;
-    buffer += sizeof( TheEntitytainer );
-    entitytainer->entry_lookup = (TheEntitytainerEntry*)buffer;
-    buffer += sizeof( TheEntitytainerEntry ) * entitytainer->entry_lookup_size;
-    entitytainer->entry_parent_lookup = (TheEntitytainerEntity*)buffer;
-    buffer += sizeof( TheEntitytainerEntity ) * entitytainer->entry_lookup_size;
+static unsigned char*
+entitytainer__assign_lookups( TheEntitytainer* entitytainer, unsigned char* buffer ) {
+    int num_entries                    = entitytainer->entry_lookup_size;
+    int num_channels                   = entitytainer__num_channels( &entitytainer->config );
+    entitytainer->channel              = 0;
+    entitytainer->entry_stride         = sizeof( TheEntitytainerEntry ) * num_channels;
+    entitytainer->entry_lookup         = (TheEntitytainerEntry*)buffer;
+    entitytainer->parent_stride        = sizeof( TheEntitytainerEntity ) * num_channels;
+    entitytainer->entry_parent_lookup  = NULL;
+    entitytainer->entry_parents_lookup = NULL;
+    if ( entitytainer->config.interleaved_lookups ) {
+        int parent_offset;
+        int stride                  = entitytainer__interleaved_stride( &entitytainer->config, &parent_offset );
+        entitytainer->entry_stride  = stride;
+        entitytainer->parent_stride = stride;
+        if ( entitytainer->config.multi_parent ) {
+            entitytainer->entry_parents_lookup = (TheEntitytainerEntry*)( buffer + parent_offset );
+        }
+        else {
+            entitytainer->entry_parent_lookup = (TheEntitytainerEntity*)( buffer + parent_offset );
+        }
 
-    buffer                     = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer,
-                                                               (int)ENTITYTAINER_alignof( TheEntitytainerBucketList ) );
-    entitytainer->bucket_lists = (TheEntitytainerBucketList*)buffer;
+        buffer += stride * num_entries;
+    }
+    else {
+        buffer += sizeof( TheEntitytainerEntry ) * num_entries * num_channels;
+        if ( entitytainer->config.multi_parent ) {
+            entitytainer->entry_parents_lookup = (TheEntitytainerEntry*)buffer;
+            buffer += sizeof( TheEntitytainerEntry ) * num_entries * num_channels;
+        }
+        else {
+            entitytainer->entry_parent_lookup = (TheEntitytainerEntity*)buffer;
+            buffer += sizeof( TheEntitytainerEntity ) * num_entries * num_channels;
+        }
+    }
 
-    unsigned char* bucket_list_end = buffer + sizeof( TheEntitytainerBucketList ) * entitytainer->num_bucket_lists;
-    TheEntitytainerEntity* bucket_data_start = (TheEntitytainerEntity*)bucket_list_end;
-    TheEntitytainerEntity* bucket_data       = bucket_data_start;
-    for ( int i = 0; i < entitytainer->num_bucket_lists; ++i ) {
-        TheEntitytainerBucketList* list = (TheEntitytainerBucketList*)buffer;
-        list->bucket_data               = bucket_data;
-        buffer += sizeof( TheEntitytainerBucketList );
-        bucket_data += list->bucket_size * list->total_buckets;
+    entitytainer->entry_depth_lookup    = NULL;
+    entitytainer->entry_ancestor_lookup = NULL;
+    if ( entitytainer->config.ancestry_levels > 0 ) {
+        entitytainer->entry_depth_lookup = (TheEntitytainerEntity*)buffer;
+        buffer += sizeof( TheEntitytainerEntity ) * num_entries;
+        entitytainer->entry_ancestor_lookup = (TheEntitytainerEntity*)buffer;
+        buffer += sizeof( TheEntitytainerEntity ) * num_entries * entitytainer->config.ancestry_levels;
     }
 
-    (void)buffer_size;
-    ENTITYTAINER_assert( (unsigned char*)bucket_data <= buffer + buffer_size );
-    return entitytainer;
+    entitytainer->entry_preorder_lookup   = NULL;
+    entitytainer->preorder_entities       = NULL;
+    entitytainer->preorder_subtree_sizes  = NULL;
+    entitytainer->preorder_parent_indices = NULL;
+    if ( entitytainer->config.preorder_index ) {
+        entitytainer->preorder_entities = (TheEntitytainerEntity*)buffer;
+        buffer += sizeof( TheEntitytainerEntity ) * num_entries;
+        buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer, (int)ENTITYTAINER_alignof( int ) );
+        entitytainer->entry_preorder_lookup = (int*)buffer;
+        buffer += sizeof( int ) * num_entries;
+        entitytainer->preorder_subtree_sizes = (int*)buffer;
+        buffer += sizeof( int ) * num_entries;
+        entitytainer->preorder_parent_indices = (int*)buffer;
+        buffer += sizeof( int ) * num_entries;
+    }
+
+    entitytainer->dirty_bits = NULL;
+    if ( entitytainer->config.dirty_tracking ) {
+        buffer = (unsigned char*)entitytainer__ptr_to_aligned_ptr( buffer,
+                                                                   (int)ENTITYTAINER_alignof( TheEntitytainerBitWord ) );
+        entitytainer->dirty_bits = (TheEntitytainerBitWord*)buffer;
+        buffer += ( num_entries + ENTITYTAINER_BitWordBits - 1 ) / ENTITYTAINER_BitWordBits *
+                  sizeof( TheEntitytainerBitWord );
+    }
+
+    return buffer;
 }
 
-ENTITYTAINER_API void
-entitytainer_load_into( TheEntitytainer* entitytainer_dst, const TheEntitytainer* entitytainer_src ) {
-    // if ( ENTITYTAINER_memcmp( &entitytainer_dst->config, &entitytainer_src->config, sizeof( TheEntitytainerConfig
-    // ) )
-    // ==
-    //      0 ) {
-    //     ENTITYTAINER_memcpy( entitytainer_dst, entitytainer_src, sizeof( TheEntitytainerConfig ) );
-    //     return;
-    // }
+static bool
+entitytainer__has_children( TheEntitytainer* entitytainer, TheEntitytainerEntity entity ) {
+    return *entitytainer__entry( entitytainer, entity ) != 0 && entitytainer_num_children( entitytainer, entity ) > 0;
+}
 
-    // Only allow grow for now
-    ENTITYTAINER_assert( entitytainer_src->config.num_bucket_lists == entitytainer_dst->config.num_bucket_lists );
-    for ( int i_bl = 0; i_bl < entitytainer_src->config.num_bucket_lists; ++i_bl ) {
-        ENTITYTAINER_assert( entitytainer_src->config.bucket_sizes[i_bl] <=
-                             entitytainer_dst->config.bucket_sizes[i_bl] );
-        ENTITYTAINER_assert( entitytainer_src->config.bucket_list_sizes[i_bl] <=
-                             entitytainer_dst->config.bucket_list_sizes[i_bl] );
+static void
+entitytainer__on_link( TheEntitytainer* entitytainer, TheEntitytainerEntity parent, TheEntitytainerEntity child ) {
+    // Only written when there's an index, so concurrent adds don't all write the same flag.
+    if ( entitytainer->config.preorder_index ) {
+        entitytainer->preorder_dirty = true;
+    }
 
-        if ( entitytainer_src->config.bucket_sizes[i_bl] == entitytainer_dst->config.bucket_sizes[i_bl] ) {
-            int bucket_list_size = sizeof( TheEntitytainerEntity ) * entitytainer_src->config.bucket_list_sizes[i_bl] *
-                                   entitytainer_src->config.bucket_sizes[i_bl];
-            ENTITYTAINER_memcpy( entitytainer_dst->bucket_lists[i_bl].bucket_data,
-                                 entitytainer_src->bucket_lists[i_bl].bucket_data,
-                                 bucket_list_size );
+    if ( entitytainer->config.dirty_tracking && entitytainer_is_dirty( entitytainer, parent ) ) {
+        entitytainer_mark_dirty_subtree( entitytainer, child );
+    }
+
+    if ( entitytainer->config.ancestry_levels > 0 && !entitytainer->ancestry_dirty ) {
+        if ( entitytainer__has_children( entitytainer, child ) ) {
+            // A whole subtree changed depth, cheaper to rebuild everything on the next query.
+            entitytainer->ancestry_dirty = true;
         }
         else {
-            TheEntitytainerBucketList* bucket_list_src = &entitytainer_src->bucket_lists[i_bl];
-            int                        bucket_size_src = entitytainer_src->config.bucket_sizes[i_bl];
-            TheEntitytainerBucketList* bucket_list_dst = &entitytainer_dst->bucket_lists[i_bl];
-            int                        bucket_size_dst = entitytainer_dst->config.bucket_sizes[i_bl];
-            for ( int i_bucket = 0; i_bucket < entitytainer_src->config.bucket_list_sizes[i_bl]; ++i_bucket ) {
-                int                    bucket_offset_src = i_bucket * bucket_size_src;
-                TheEntitytainerEntity* bucket_src        = bucket_list_src->bucket_data + bucket_offset_src;
-                int                    bucket_offset_dst = i_bucket * bucket_size_dst;
-                TheEntitytainerEntity* bucket_dst        = bucket_list_dst->bucket_data + bucket_offset_dst;
-                ENTITYTAINER_memcpy( bucket_dst, bucket_src, bucket_size_src * sizeof( TheEntitytainerEntity ) );
+            TheEntitytainerEntity* ancestors        = entitytainer->entry_ancestor_lookup;
+            int                    levels           = entitytainer->config.ancestry_levels;
+            entitytainer->entry_depth_lookup[child] = entitytainer->entry_depth_lookup[parent] + 1;
+            ancestors[child * levels]               = parent;
+            for ( int level = 1; level < levels; ++level ) {
+                TheEntitytainerEntity halfway     = ancestors[child * levels + level - 1];
+                ancestors[child * levels + level] = ancestors[halfway * levels + level - 1];
             }
         }
-        entitytainer_dst->bucket_lists[i_bl].first_free_bucket = entitytainer_src->bucket_lists[i_bl].first_free_bucket;
-        entitytainer_dst->bucket_lists[i_bl].used_buckets      = entitytainer_src->bucket_lists[i_bl].used_buckets;
     }
+}
 
-    ENTITYTAINER_memcpy( entitytainer_dst->entry_lookup,
-                         entitytainer_src->entry_lookup,
-                         sizeof( TheEntitytainerEntry ) * entitytainer_src->entry_lookup_size );
-    ENTITYTAINER_memcpy( entitytainer_dst->entry_parent_lookup,
-                         entitytainer_src->entry_parent_lookup,
-                         sizeof( TheEntitytainerEntity ) * entitytainer_src->entry_lookup_size );
+static void
+entitytainer__on_unlink( TheEntitytainer* entitytainer, TheEntitytainerEntity child ) {
+    if ( entitytainer->config.preorder_index ) {
+        entitytainer->preorder_dirty = true;
+    }
 
-#if ENTITYTAINER_DEFENSIVE_CHECKS
-    for ( TheEntitytainerEntity entity = 0; entity < entitytainer_dst->config.num_entries; ++entity ) {
-        TheEntitytainerEntry lookup = entitytainer_dst->entry_lookup[entity];
-        if ( lookup == 0 ) {
-            continue;
+    if ( entitytainer->config.ancestry_levels > 0 && !entitytainer->ancestry_dirty ) {
+        if ( entitytainer__has_children( entitytainer, child ) ) {
+            entitytainer->ancestry_dirty = true;
         }
-
-        int                        bucket_list_index = lookup >> ENTITYTAINER_BucketListOffset;
-        TheEntitytainerBucketList* bucket_list       = entitytainer_dst->bucket_lists + bucket_list_index;
-        int                        bucket_index      = lookup & ENTITYTAINER_BucketMask;
-        int                        bucket_offset     = bucket_index * bucket_list->bucket_size;
-        TheEntitytainerEntity*     bucket            = bucket_list->bucket_data + bucket_offset;
-
-        TheEntitytainerEntity count       = bucket[0];
-        TheEntitytainerEntity found_count = 0;
-        for ( int i_child1 = 1; i_child1 < bucket_list->bucket_size; ++i_child1 ) {
-            if ( found_count == count ) {
-                break;
-            }
-
-            if ( bucket[i_child1] == ENTITYTAINER_InvalidEntity ) {
-                continue;
-            }
-
-            ++found_count;
-            for ( int i_child2 = i_child1 + 1; i_child2 < bucket_list->bucket_size; ++i_child2 ) {
-                if ( bucket[i_child1] == bucket[i_child2] ) {
-                    if ( entitytainer_dst->remove_with_holes ) {
-                        ENTITYTAINER_assert( entitytainer_dst->keep_capacity_on_remove, "untested" );
-                        bucket[0]--;
-                        bucket[i_child2] = 0;
-                        // entitytainer_remove_child_with_holes( entitytainer_dst, entity, bucket[i_child1] );
-                    }
-                    else {
-                        ENTITYTAINER_assert( false, "untested" );
-                    }
-                }
-            }
+        else {
+            int levels                              = entitytainer->config.ancestry_levels;
+            entitytainer->entry_depth_lookup[child] = 0;
+            ENTITYTAINER_memset( entitytainer->entry_ancestor_lookup + child * levels,
+                                 0,
+                                 levels * sizeof( TheEntitytainerEntity ) );
         }
     }
-#endif
 }
 
-static void*
-entitytainer__ptr_to_aligned_ptr( void* ptr, int align ) {
-    if ( align == 0 ) {
-        return ptr;
+static void
+entitytainer__journal( TheEntitytainer*      entitytainer,
+                       int                   op,
+                       TheEntitytainerEntity entity,
+                       TheEntitytainerEntity parent,
+                       TheEntitytainerEntity old_parent ) {
+    TheEntitytainer* root = entitytainer - entitytainer->channel;
+    if ( root->config.journal == NULL ) {
+        return;
     }
 
-    long long int ptr_address = (long long int)ptr;
-    int           offset      = ( ~(int)ptr_address + 1 ) & ( align - 1 );
-    void*         aligned_ptr = (char*)ptr + offset;
-    return aligned_ptr;
-}
-
-static bool
-entitytainer__child_in_bucket( TheEntitytainerEntity*     bucket,
-                               TheEntitytainerBucketList* bucket_list,
-                               TheEntitytainerEntity      child ) {
+    if ( root->journal_count == root->config.journal_size ) {
+        ++root->journal_dropped;
+        return;
+    }
 
-    TheEntitytainerEntity count = bucket[0];
-    int                   found = 0;
-    for ( int i = 1; i < bucket_list->bucket_size; ++i ) {
-        if ( found == count ) {
-            break;
-        }
+    int index = root->journal_first + root->journal_count;
+    if ( index >= root->config.journal_size ) {
+        index -= root->config.journal_size;
+    }
 
-        if ( bucket[i] == ENTITYTAINER_InvalidEntity ) {
-            continue;
-        }
+    entitytainer__record( &root->config.journal[index], op, entitytainer->channel, entity, parent, old_parent );
+    ++root->journal_count;
+}
 
-        if ( bucket[i] == child ) {
-            return true;
-        }
+static bool
+entitytainer__test_and_set_bit( TheEntitytainerBitWord* bits, int index ) {
+    TheEntitytainerBitWord* word    = &bits[index / ENTITYTAINER_BitWordBits];
+    TheEntitytainerBitWord  bit     = (TheEntitytainerBitWord)1 << ( index % ENTITYTAINER_BitWordBits );
+    bool                    was_set = ( *word & bit ) != 0;
+    *word |= bit;
+    return was_set;
+}
 
-        ++found;
+// Counts a problem found by entitytainer_validate, and where it was if it's the first.
+static void
+entitytainer__report( TheEntitytainerValidation* report, int* problems, int entity, int bucket_list_index ) {
+    if ( report->num_problems == 0 ) {
+        report->first_entity      = (TheEntitytainerEntity)entity;
+        report->first_bucket_list = bucket_list_index;
     }
 
-    return false;
+    ++report->num_problems;
+    ++*problems;
+}
+
+static void
+entitytainer__record( TheEntitytainerJournalRecord* record,
+                      int                           op,
+                      int                           channel,
+                      TheEntitytainerEntity         entity,
+                      TheEntitytainerEntity         parent,
+                      TheEntitytainerEntity         old_parent ) {
+    record->op         = (unsigned char)op;
+    record->channel    = (unsigned char)channel;
+    record->entity     = entity;
+    record->parent     = parent;
+    record->old_parent = old_parent;
 }
 
 #endif // ENTITYTAINER_IMPLEMENTATION
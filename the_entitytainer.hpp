@@ -0,0 +1,266 @@
+/* clang-format on */
+
+/*
+the_entitytainer.hpp - C++17 front end for the_entitytainer.h
+
+Wraps the same data layout as the C API, so a TheEntitytainer* can be shared between C and C++ code, and images saved
+by one can be loaded by the other. The tiers are template parameters, so the bucket offsets are constants (shifts when
+the bucket sizes are powers of two), and the needed memory size is a constant expression.
+
+Changes go through the C functions. Reads (children, parent, number of children) are decoded inline.
+
+```C++
+    using Hierarchy = entitytainer::Entitytainer<TheEntitytainerEntity,
+                                                 TheEntitytainerEntry,
+                                                 1024,
+                                                 entitytainer::Tier<4, 256>,
+                                                 entitytainer::Tier<16, 32>,
+                                                 entitytainer::Tier<256, 4>>;
+    static entitytainer::Storage<Hierarchy> storage;
+    Hierarchy hierarchy( storage.memory, sizeof( storage.memory ) );
+
+    hierarchy.add_entity( 3 );
+    hierarchy.add_child( 3, 10 );
+    for ( TheEntitytainerEntity child : hierarchy.children( 3 ) ) {
+        ...
+    }
+```
+
+The C implementation still has to be compiled in one C source file, see the_entitytainer.h.
+
+*/
+
+#ifndef INCLUDE_THE_ENTITYTAINER_HPP
+#define INCLUDE_THE_ENTITYTAINER_HPP
+
+#include <stddef.h>
+#include <type_traits>
+
+#include "the_entitytainer.h"
+
+namespace entitytainer {
+
+template<int BucketSize, int NumBuckets>
+struct Tier {
+    static_assert( BucketSize * sizeof( TheEntitytainerEntity ) >= sizeof( int ),
+                   "A bucket needs to fit the free list index" );
+    static constexpr int bucket_size = BucketSize;
+    static constexpr int num_buckets = NumBuckets;
+};
+
+// Children of a parent, usable with range-for.
+template<typename TEntity>
+struct Children {
+    const TEntity* first;
+    const TEntity* last;
+
+    const TEntity*
+    begin() const {
+        return first;
+    }
+    const TEntity*
+    end() const {
+        return last;
+    }
+    int
+    size() const {
+        return (int)( last - first );
+    }
+    bool
+    empty() const {
+        return first == last;
+    }
+    const TEntity& operator[]( int i ) const {
+        return first[i];
+    }
+};
+
+template<typename TEntity, typename TEntry, int NumEntries, typename... Tiers>
+class Entitytainer {
+    // The layout is shared with the C code, so the types have to be the ones it was compiled with.
+    static_assert( std::is_same<TEntity, TheEntitytainerEntity>::value, "Must match ENTITYTAINER_Entity" );
+    static_assert( std::is_same<TEntry, TheEntitytainerEntry>::value, "Must match ENTITYTAINER_Entry" );
+    static_assert( sizeof...( Tiers ) > 0 && sizeof...( Tiers ) <= ENTITYTAINER_MAX_BUCKET_LISTS, "1 to 8 tiers" );
+
+    // Same as entitytainer__bucket_list_offset.
+    static constexpr int
+    list_offset( int num_lists ) {
+        int list_bits = 1;
+        while ( ( 1 << list_bits ) < num_lists ) {
+            ++list_bits;
+        }
+        return ENTITYTAINER_EntryBits - list_bits < 30 ? ENTITYTAINER_EntryBits - list_bits : 30;
+    }
+
+  public:
+    static constexpr int num_entries       = NumEntries;
+    static constexpr int num_tiers         = sizeof...( Tiers );
+    static constexpr int bucket_sizes[]    = { Tiers::bucket_size... };
+    static constexpr int bucket_counts[]   = { Tiers::num_buckets... };
+    static constexpr bool pow2_bucket_sizes = ( ( ( Tiers::bucket_size & ( Tiers::bucket_size - 1 ) ) == 0 ) && ... );
+
+    // Entries are split like in the C code, with just enough top bits for the tier.
+    static constexpr int bucket_list_offset = list_offset( num_tiers );
+    static constexpr int bucket_mask        = ( 1 << bucket_list_offset ) - 1;
+    static_assert( ( ( Tiers::num_buckets <= bucket_mask + 1 ) && ... ), "Too many buckets for an entry" );
+
+    // Same as entitytainer_needed_size for a config without any of the optional indices, channels or payloads.
+    static constexpr int needed_size =
+      (int)( sizeof( TheEntitytainer ) + NumEntries * sizeof( TEntry ) + NumEntries * sizeof( TEntity ) +
+             num_tiers * sizeof( TheEntitytainerBucketList ) +
+             ( ( Tiers::bucket_size * Tiers::num_buckets * sizeof( TEntity ) ) + ... ) +
+             ( 6 + 2 * num_tiers ) * sizeof( void* ) * 16 );
+
+    static TheEntitytainerConfig
+    config( void* memory, int memory_size ) {
+        TheEntitytainerConfig config = {};
+        config.memory                = memory;
+        config.memory_size           = memory_size;
+        config.num_entries           = NumEntries;
+        config.num_bucket_lists      = num_tiers;
+        for ( int i = 0; i < num_tiers; ++i ) {
+            config.bucket_sizes[i]      = bucket_sizes[i];
+            config.bucket_list_sizes[i] = bucket_counts[i];
+        }
+
+        return config;
+    }
+
+    Entitytainer( void* memory, int memory_size ) {
+        TheEntitytainerConfig config = Entitytainer::config( memory, memory_size );
+        ENTITYTAINER_assert( entitytainer_needed_size( &config ) <= memory_size );
+        attach( entitytainer_create( &config ) );
+    }
+
+    // Wraps an entitytainer created or loaded by the C API. Its tiers must match.
+    explicit Entitytainer( TheEntitytainer* entitytainer ) {
+        attach( entitytainer );
+    }
+
+    TheEntitytainer*
+    get() const {
+        return entitytainer_;
+    }
+
+    void
+    add_entity( TEntity entity ) {
+        entitytainer_add_entity( entitytainer_, entity );
+    }
+    void
+    remove_entity( TEntity entity ) {
+        entitytainer_remove_entity( entitytainer_, entity );
+    }
+    void
+    add_child( TEntity parent, TEntity child ) {
+        entitytainer_add_child( entitytainer_, parent, child );
+    }
+    void
+    remove_child( TEntity parent, TEntity child ) {
+        if ( entitytainer_->remove_with_holes ) {
+            entitytainer_remove_child_with_holes( entitytainer_, parent, child );
+        }
+        else {
+            entitytainer_remove_child_no_holes( entitytainer_, parent, child );
+        }
+    }
+    void
+    reparent( TEntity child, TEntity new_parent ) {
+        entitytainer_reparent( entitytainer_, child, new_parent );
+    }
+
+    bool
+    is_added( TEntity entity ) const {
+        return entry( entity ) != 0;
+    }
+
+    // Without holes, the children of an added parent.
+    Children<TEntity>
+    children( TEntity parent ) const {
+        ENTITYTAINER_assert( !entitytainer_->remove_with_holes );
+        const TEntity* bucket = get_bucket( parent );
+        return Children<TEntity>{ bucket + 1, bucket + 1 + bucket[0] };
+    }
+
+    // All child slots of an added parent, including holes, which are ENTITYTAINER_InvalidEntity.
+    Children<TEntity>
+    slots( TEntity parent ) const {
+        TEntry lookup = entry( parent );
+        ENTITYTAINER_assert( lookup != 0 );
+        const TEntity* bucket = get_bucket( parent );
+        return Children<TEntity>{ bucket + 1, bucket + bucket_sizes[lookup >> bucket_list_offset] };
+    }
+
+    int
+    num_children( TEntity parent ) const {
+        return (int)get_bucket( parent )[0];
+    }
+
+    TEntity
+    parent( TEntity child ) const {
+        return *(const TEntity*)( (const unsigned char*)entitytainer_->entry_parent_lookup +
+                                  child * entitytainer_->parent_stride );
+    }
+
+  private:
+    static constexpr int
+    bucket_shift( int bucket_size ) {
+        int shift = 0;
+        while ( ( 1 << shift ) < bucket_size ) {
+            ++shift;
+        }
+        return shift;
+    }
+
+    static constexpr int bucket_shifts[] = { bucket_shift( Tiers::bucket_size )... };
+
+    void
+    attach( TheEntitytainer* entitytainer ) {
+        ENTITYTAINER_assert( entitytainer->num_bucket_lists == num_tiers );
+        ENTITYTAINER_assert( entitytainer->entry_lookup_size == NumEntries );
+        ENTITYTAINER_assert( entitytainer->bucket_list_offset == bucket_list_offset );
+        ENTITYTAINER_assert( entitytainer->config.num_channels <= 1 && !entitytainer->config.multi_parent );
+        // The buckets are cached per tier, so they can't move.
+        ENTITYTAINER_assert( entitytainer->config.allocate == NULL );
+        entitytainer_ = entitytainer;
+        for ( int i = 0; i < num_tiers; ++i ) {
+            ENTITYTAINER_assert( entitytainer->bucket_lists[i].bucket_size == bucket_sizes[i] );
+            ENTITYTAINER_assert( entitytainer->bucket_lists[i].total_buckets == bucket_counts[i] );
+            ENTITYTAINER_assert( entitytainer->bucket_lists[i].pages == NULL );
+            tier_data_[i] = entitytainer->bucket_lists[i].bucket_data;
+        }
+    }
+
+    // The lookups may be interleaved, see TheEntitytainerConfig::interleaved_lookups.
+    TEntry
+    entry( TEntity entity ) const {
+        return *(const TEntry*)( (const unsigned char*)entitytainer_->entry_lookup +
+                                 entity * entitytainer_->entry_stride );
+    }
+
+    const TEntity*
+    get_bucket( TEntity parent ) const {
+        TEntry lookup = entry( parent );
+        ENTITYTAINER_assert( lookup != 0 );
+        int tier         = lookup >> bucket_list_offset;
+        int bucket_index = lookup & bucket_mask;
+        if constexpr ( pow2_bucket_sizes ) {
+            return tier_data_[tier] + ( bucket_index << bucket_shifts[tier] );
+        }
+        else {
+            return tier_data_[tier] + bucket_index * bucket_sizes[tier];
+        }
+    }
+
+    TheEntitytainer* entitytainer_ = nullptr;
+    TEntity*         tier_data_[num_tiers];
+};
+
+// Memory for an Entitytainer, e.g. as a static.
+template<typename TEntitytainer>
+struct Storage {
+    alignas( void* ) unsigned char memory[TEntitytainer::needed_size];
+};
+
+} // namespace entitytainer
+
+#endif // INCLUDE_THE_ENTITYTAINER_HPP